@@ -0,0 +1,109 @@
+#!/bin/bash
+# Benchmark fcheck on synthetic images of growing size.
+#
+#   ./bench.sh                       time ./fcheck on the default sizes
+#   SIZES="1G 32G" ./bench.sh        pick the image sizes
+#   BASELINE=/path/to/old/fcheck ./bench.sh
+#                                    also time another build, for regressions
+#
+# Settings, from the environment:
+#   FCHECK    binary to time (./fcheck)
+#   BASELINE  binary to compare against (none)
+#   MKIMAGE   image generator (./mkimage)
+#   SIZES     image sizes, with K, M or G suffix (8M 64M 512M 4G)
+#   CONFIGS   fcheck options to time, one run set each ("" "-j $(nproc)" -p -S)
+#   RUNS      runs per configuration, the best and the median are reported (5)
+#   COLD      1 to drop the page cache before every run, needs root (0)
+#   DIR       where the images go (/tmp), they are sparse
+#   GENOPTS   extra mkimage options (-A -d 64 -s exp:8 -l 0.05)
+#   STATS     1 to also print the per-phase --stats table of every size,
+#             FCHECK must be built with -DFCHECK_STATS (0)
+
+FCHECK=${FCHECK:-./fcheck}
+MKIMAGE=${MKIMAGE:-./mkimage}
+SIZES=${SIZES:-"8M 64M 512M 4G"}
+RUNS=${RUNS:-5}
+COLD=${COLD:-0}
+DIR=${DIR:-/tmp}
+GENOPTS=${GENOPTS:-"-A -d 64 -s exp:8 -l 0.05"}
+STATS=${STATS:-0}
+if [ -z "${CONFIGS+set}" ]; then
+  CONFIGS=("" "-j $(nproc)" "-p" "-S")
+else
+  read -r -a CONFIGS <<< "$CONFIGS"
+fi
+
+# bytes of a size like 512M
+bytes() {
+  local n=${1%[KMG]}
+  case $1 in
+    *K) echo $((n << 10)) ;;
+    *M) echo $((n << 20)) ;;
+    *G) echo $((n << 30)) ;;
+    *) echo "$n" ;;
+  esac
+}
+
+# time one run in milliseconds, the exit status of fcheck goes to $status
+timeRun() {
+  local start end
+  [ "$COLD" = 1 ] && sync && echo 3 > /proc/sys/vm/drop_caches
+  start=$(date +%s%N)
+  "$@" > /dev/null 2>&1
+  status=$?
+  end=$(date +%s%N)
+  echo $(((end - start) / 1000000))
+}
+
+# best and median of RUNS runs of the command
+timeRuns() {
+  local i times=()
+  for ((i = 0; i < RUNS; i++)); do
+    times+=("$(timeRun "$@")")
+  done
+  sort -n <<< "$(printf '%s\n' "${times[@]}")" | awk '{t[NR] = $1} END {print t[1], t[int((NR + 1) / 2)]}'
+}
+
+for tool in "$FCHECK" "$MKIMAGE" ${BASELINE:+"$BASELINE"}; do
+  if [ ! -x "$tool" ]; then
+    echo "$tool not found, build it first (see README.md)" >&2
+    exit 1
+  fi
+done
+
+printf "%-6s %-10s %10s %10s" size options best-ms median-ms
+[ -n "$BASELINE" ] && printf " %10s %10s %7s" base-best base-median speedup
+printf "\n"
+
+for size in $SIZES; do
+  blocks=$(($(bytes "$size") / 512))
+  # one inode per 16 blocks, up to what a dirent can name
+  inodes=$((blocks / 16))
+  [ $inodes -gt 65536 ] && inodes=65536
+  [ $inodes -lt 16 ] && inodes=16
+  img=$DIR/fcheck-bench-$size.img
+  if ! "$MKIMAGE" -r 1 -i $inodes -b $blocks $GENOPTS "$img" > /dev/null; then
+    echo "cannot generate $img" >&2
+    exit 1
+  fi
+  timeRun "$FCHECK" "$img" > /dev/null
+  if [ $status != 0 ]; then
+    echo "$FCHECK finds errors in the clean image $img" >&2
+    exit 1
+  fi
+
+  for opts in "${CONFIGS[@]}"; do
+    read -r best median <<< "$(timeRuns "$FCHECK" $opts "$img")"
+    printf "%-6s %-10s %10s %10s" "$size" "${opts:--}" "$best" "$median"
+    if [ -n "$BASELINE" ]; then
+      read -r bbest bmedian <<< "$(timeRuns "$BASELINE" $opts "$img")"
+      printf " %10s %10s %7s" "$bbest" "$bmedian" \
+        "$(awk -v a="$median" -v b="$bmedian" 'BEGIN {printf (a ? "%.2f" : "-"), b / a}')"
+    fi
+    printf "\n"
+  done
+  if [ "$STATS" = 1 ]; then
+    "$FCHECK" --stats "$img" 2>&1 > /dev/null | sed 's/^/    /'
+  fi
+  rm -f "$img"
+done
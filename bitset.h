@@ -0,0 +1,166 @@
+#ifndef _BITSET_H_
+#define _BITSET_H_
+
+// Packed bit sets and compact counters used by the checker to track
+// per-block and per-inode state. Bit sets use one bit per element and are
+// handled a 64-bit word at a time; counters use 16 bits per element and
+// saturate instead of wrapping.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <endian.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define BITSET_X86
+#endif
+
+typedef uint64_t bitword;
+
+#define WORDBITS            64
+#define BITSET_WORDS(n)     (((uint64_t)(n) + WORDBITS - 1) / WORDBITS)
+#define COUNTER_MAX         0xffff
+
+// allocate a zeroed bit set of nbits bits
+static inline bitword *bitsetAlloc(uint64_t nbits) {
+  bitword *bs = calloc(BITSET_WORDS(nbits) + 1, sizeof(bitword));
+  if (bs == NULL) {
+    perror("bitset");
+    exit(1);
+  }
+  return bs;
+}
+
+static inline void bitsetSet(bitword *bs, uint64_t i) {
+  bs[i / WORDBITS] |= (bitword)1 << (i % WORDBITS);
+}
+
+static inline void bitsetClear(bitword *bs, uint64_t i) {
+  bs[i / WORDBITS] &= ~((bitword)1 << (i % WORDBITS));
+}
+
+static inline bool bitsetTest(const bitword *bs, uint64_t i) {
+  return (bs[i / WORDBITS] >> (i % WORDBITS)) & 1;
+}
+
+// set bit i and return its previous value
+static inline bool bitsetTestAndSet(bitword *bs, uint64_t i) {
+  bitword mask = (bitword)1 << (i % WORDBITS);
+  bitword old = bs[i / WORDBITS];
+  bs[i / WORDBITS] = old | mask;
+  return (old & mask) != 0;
+}
+
+// Thread-safe variants for sets shared between scanning threads. The plain
+// load first keeps already-set bits from bouncing the cache line around.
+static inline void bitsetSetAtomic(bitword *bs, uint64_t i) {
+  bitword mask = (bitword)1 << (i % WORDBITS);
+  if (!(__atomic_load_n(&bs[i / WORDBITS], __ATOMIC_RELAXED) & mask))
+    __atomic_fetch_or(&bs[i / WORDBITS], mask, __ATOMIC_RELAXED);
+}
+
+static inline bool bitsetTestAndSetAtomic(bitword *bs, uint64_t i) {
+  bitword mask = (bitword)1 << (i % WORDBITS);
+  return (__atomic_fetch_or(&bs[i / WORDBITS], mask, __ATOMIC_RELAXED) & mask) != 0;
+}
+
+// number of set bits among the first nbits bits
+static inline uint64_t bitsetCount(const bitword *bs, uint64_t nbits) {
+  uint64_t i, count = 0;
+  uint64_t words = nbits / WORDBITS;
+
+  for (i = 0; i < words; i++)
+    count += __builtin_popcountll(bs[i]);
+  if (nbits % WORDBITS)
+    count += __builtin_popcountll(bs[words] & (((bitword)1 << (nbits % WORDBITS)) - 1));
+  return count;
+}
+
+// allocate n zeroed counters
+static inline uint16_t *counterAlloc(uint64_t n) {
+  uint16_t *c = calloc(n + 1, sizeof(uint16_t));
+  if (c == NULL) {
+    perror("counter");
+    exit(1);
+  }
+  return c;
+}
+
+static inline void counterInc(uint16_t *c, uint64_t i) {
+  if (c[i] != COUNTER_MAX)
+    c[i]++;
+}
+
+static inline void counterIncAtomic(uint16_t *c, uint64_t i) {
+  uint16_t old = __atomic_load_n(&c[i], __ATOMIC_RELAXED);
+  while (old != COUNTER_MAX &&
+         !__atomic_compare_exchange_n(&c[i], &old, old + 1, true,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    ;
+}
+
+// Bitmap reconciliation. Given the on-disk bitmap and two computed sets,
+// find the first word at or after w, below nwords, where a bit is set in
+// ref but not in disk, or set in disk but not in used. Returns nwords if
+// the sets agree. The on-disk bitmap has bit b in bit b%8 of byte b/8,
+// which is the layout of a little-endian bit set.
+typedef uint64_t (*reconcilefn)(const bitword *disk, const bitword *ref,
+                                const bitword *used, uint64_t w, uint64_t nwords);
+
+static inline uint64_t reconcileScalar(const bitword *disk, const bitword *ref,
+                                       const bitword *used, uint64_t w, uint64_t nwords) {
+  for (; w < nwords; w++) {
+    bitword d = le64toh(disk[w]);
+    if ((ref[w] & ~d) | (d & ~used[w]))
+      break;
+  }
+  return w;
+}
+
+#ifdef BITSET_X86
+// 256 bits per step, the scalar loop pins down the word once a step differs
+__attribute__((target("avx2")))
+static inline uint64_t reconcileAvx2(const bitword *disk, const bitword *ref,
+                                     const bitword *used, uint64_t w, uint64_t nwords) {
+  for (; w + 4 <= nwords; w += 4) {
+    __m256i d = _mm256_loadu_si256((const __m256i *) (disk + w));
+    __m256i r = _mm256_loadu_si256((const __m256i *) (ref + w));
+    __m256i u = _mm256_loadu_si256((const __m256i *) (used + w));
+    __m256i bad = _mm256_or_si256(_mm256_andnot_si256(d, r), _mm256_andnot_si256(u, d));
+    if (!_mm256_testz_si256(bad, bad))
+      break;
+  }
+  return reconcileScalar(disk, ref, used, w, nwords);
+}
+
+// 512 bits per step, (r & ~d) | (d & ~u) is a single ternary logic op
+__attribute__((target("avx512f")))
+static inline uint64_t reconcileAvx512(const bitword *disk, const bitword *ref,
+                                       const bitword *used, uint64_t w, uint64_t nwords) {
+  for (; w + 8 <= nwords; w += 8) {
+    __m512i d = _mm512_loadu_si512((const void *) (disk + w));
+    __m512i r = _mm512_loadu_si512((const void *) (ref + w));
+    __m512i u = _mm512_loadu_si512((const void *) (used + w));
+    __m512i bad = _mm512_ternarylogic_epi64(d, r, u, 0x5c);
+    if (_mm512_test_epi64_mask(bad, bad))
+      break;
+  }
+  return reconcileScalar(disk, ref, used, w, nwords);
+}
+#endif
+
+// widest kernel the CPU supports
+static inline reconcilefn reconcileKernel(void) {
+#ifdef BITSET_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f"))
+    return reconcileAvx512;
+  if (__builtin_cpu_supports("avx2"))
+    return reconcileAvx2;
+#endif
+  return reconcileScalar;
+}
+
+#endif // _BITSET_H_
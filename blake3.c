@@ -0,0 +1,425 @@
+// BLAKE3
+#include <stdbool.h>
+#include <string.h>
+#include <endian.h>
+
+#include "blake3.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define BLAKE3_X86
+#endif
+
+// domain flags
+#define CHUNK_START  1
+#define CHUNK_END    2
+#define PARENT       4
+#define ROOT         8
+
+static const uint32_t IV[8] = {
+  0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+  0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+};
+
+// message word order of every round
+static const uint8_t SCHEDULE[7][16] = {
+  { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 },
+  { 2, 6, 3, 10, 7, 0, 4, 13, 1, 11, 12, 5, 9, 14, 15, 8 },
+  { 3, 4, 10, 12, 13, 2, 7, 14, 6, 5, 9, 0, 11, 15, 8, 1 },
+  { 10, 7, 12, 9, 14, 3, 13, 15, 4, 0, 11, 2, 5, 8, 1, 6 },
+  { 12, 13, 9, 11, 15, 10, 14, 8, 7, 2, 5, 3, 0, 1, 6, 4 },
+  { 9, 14, 11, 5, 8, 12, 15, 1, 13, 3, 0, 10, 2, 6, 4, 7 },
+  { 11, 15, 5, 0, 1, 9, 8, 6, 14, 10, 2, 12, 3, 4, 7, 13 },
+};
+
+static inline uint32_t rotr(uint32_t x, int r) {
+  return (x >> r) | (x << (32 - r));
+}
+
+static inline void g(uint32_t *v, int a, int b, int c, int d, uint32_t x, uint32_t y) {
+  v[a] = v[a] + v[b] + x;
+  v[d] = rotr(v[d] ^ v[a], 16);
+  v[c] = v[c] + v[d];
+  v[b] = rotr(v[b] ^ v[c], 12);
+  v[a] = v[a] + v[b] + y;
+  v[d] = rotr(v[d] ^ v[a], 8);
+  v[c] = v[c] + v[d];
+  v[b] = rotr(v[b] ^ v[c], 7);
+}
+
+// the compression function, all 16 words of the result
+static void compress(const uint32_t cv[8], const uint8_t block[BLAKE3_BLOCK_LEN],
+                     uint8_t blockLen, uint64_t counter, uint8_t flags, uint32_t out[16]) {
+  uint32_t m[16], v[16];
+  int i, r;
+
+  for (i = 0; i < 16; i++) {
+    uint32_t w;
+    memcpy(&w, block + 4 * i, 4);
+    m[i] = le32toh(w);
+  }
+  memcpy(v, cv, 8 * sizeof(uint32_t));
+  memcpy(v + 8, IV, 4 * sizeof(uint32_t));
+  v[12] = (uint32_t)counter;
+  v[13] = (uint32_t)(counter >> 32);
+  v[14] = blockLen;
+  v[15] = flags;
+  for (r = 0; r < 7; r++) {
+    const uint8_t *s = SCHEDULE[r];
+    g(v, 0, 4, 8, 12, m[s[0]], m[s[1]]);
+    g(v, 1, 5, 9, 13, m[s[2]], m[s[3]]);
+    g(v, 2, 6, 10, 14, m[s[4]], m[s[5]]);
+    g(v, 3, 7, 11, 15, m[s[6]], m[s[7]]);
+    g(v, 0, 5, 10, 15, m[s[8]], m[s[9]]);
+    g(v, 1, 6, 11, 12, m[s[10]], m[s[11]]);
+    g(v, 2, 7, 8, 13, m[s[12]], m[s[13]]);
+    g(v, 3, 4, 9, 14, m[s[14]], m[s[15]]);
+  }
+  for (i = 0; i < 8; i++) {
+    out[i] = v[i] ^ v[i + 8];
+    out[i + 8] = v[i + 8] ^ cv[i];
+  }
+}
+
+/*
+Hash n inputs of the same number of blocks into n chaining values. The
+counter of input i is counter + i when incCounter is set, counter
+otherwise; flagsStart and flagsEnd go with the first and last block.
+*/
+typedef void (*hashmanyfn)(const uint8_t *const *inputs, size_t n, size_t blocks,
+                           uint64_t counter, bool incCounter, uint8_t flags,
+                           uint8_t flagsStart, uint8_t flagsEnd, uint32_t (*out)[8]);
+
+static void hashManyScalar(const uint8_t *const *inputs, size_t n, size_t blocks,
+                           uint64_t counter, bool incCounter, uint8_t flags,
+                           uint8_t flagsStart, uint8_t flagsEnd, uint32_t (*out)[8]) {
+  uint32_t cv[8], full[16];
+  size_t i, b;
+
+  for (i = 0; i < n; i++) {
+    memcpy(cv, IV, sizeof(cv));
+    for (b = 0; b < blocks; b++) {
+      uint8_t f = flags | (b == 0 ? flagsStart : 0) | (b == blocks - 1 ? flagsEnd : 0);
+      compress(cv, inputs[i] + b * BLAKE3_BLOCK_LEN, BLAKE3_BLOCK_LEN,
+               counter + (incCounter ? i : 0), f, full);
+      memcpy(cv, full, sizeof(cv));
+    }
+    memcpy(out[i], cv, sizeof(cv));
+  }
+}
+
+#ifdef BLAKE3_X86
+#define AVX2_FN __attribute__((target("avx2")))
+
+AVX2_FN static inline __m256i rot16(__m256i x) {
+  return _mm256_shuffle_epi8(x, _mm256_set_epi8(
+    13, 12, 15, 14, 9, 8, 11, 10, 5, 4, 7, 6, 1, 0, 3, 2,
+    13, 12, 15, 14, 9, 8, 11, 10, 5, 4, 7, 6, 1, 0, 3, 2));
+}
+
+AVX2_FN static inline __m256i rot8(__m256i x) {
+  return _mm256_shuffle_epi8(x, _mm256_set_epi8(
+    12, 15, 14, 13, 8, 11, 10, 9, 4, 7, 6, 5, 0, 3, 2, 1,
+    12, 15, 14, 13, 8, 11, 10, 9, 4, 7, 6, 5, 0, 3, 2, 1));
+}
+
+AVX2_FN static inline __m256i rotrBits(__m256i x, int r) {
+  return _mm256_or_si256(_mm256_srli_epi32(x, r), _mm256_slli_epi32(x, 32 - r));
+}
+
+AVX2_FN static inline void g8(__m256i *v, int a, int b, int c, int d, __m256i x, __m256i y) {
+  v[a] = _mm256_add_epi32(_mm256_add_epi32(v[a], v[b]), x);
+  v[d] = rot16(_mm256_xor_si256(v[d], v[a]));
+  v[c] = _mm256_add_epi32(v[c], v[d]);
+  v[b] = rotrBits(_mm256_xor_si256(v[b], v[c]), 12);
+  v[a] = _mm256_add_epi32(_mm256_add_epi32(v[a], v[b]), y);
+  v[d] = rot8(_mm256_xor_si256(v[d], v[a]));
+  v[c] = _mm256_add_epi32(v[c], v[d]);
+  v[b] = rotrBits(_mm256_xor_si256(v[b], v[c]), 7);
+}
+
+// row i of the 8x8 matrix of 32-bit words becomes column i
+AVX2_FN static inline void transpose8(__m256i *v) {
+  __m256i ab0145 = _mm256_unpacklo_epi32(v[0], v[1]);
+  __m256i ab2367 = _mm256_unpackhi_epi32(v[0], v[1]);
+  __m256i cd0145 = _mm256_unpacklo_epi32(v[2], v[3]);
+  __m256i cd2367 = _mm256_unpackhi_epi32(v[2], v[3]);
+  __m256i ef0145 = _mm256_unpacklo_epi32(v[4], v[5]);
+  __m256i ef2367 = _mm256_unpackhi_epi32(v[4], v[5]);
+  __m256i gh0145 = _mm256_unpacklo_epi32(v[6], v[7]);
+  __m256i gh2367 = _mm256_unpackhi_epi32(v[6], v[7]);
+  __m256i abcd04 = _mm256_unpacklo_epi64(ab0145, cd0145);
+  __m256i abcd15 = _mm256_unpackhi_epi64(ab0145, cd0145);
+  __m256i abcd26 = _mm256_unpacklo_epi64(ab2367, cd2367);
+  __m256i abcd37 = _mm256_unpackhi_epi64(ab2367, cd2367);
+  __m256i efgh04 = _mm256_unpacklo_epi64(ef0145, gh0145);
+  __m256i efgh15 = _mm256_unpackhi_epi64(ef0145, gh0145);
+  __m256i efgh26 = _mm256_unpacklo_epi64(ef2367, gh2367);
+  __m256i efgh37 = _mm256_unpackhi_epi64(ef2367, gh2367);
+  v[0] = _mm256_permute2x128_si256(abcd04, efgh04, 0x20);
+  v[1] = _mm256_permute2x128_si256(abcd15, efgh15, 0x20);
+  v[2] = _mm256_permute2x128_si256(abcd26, efgh26, 0x20);
+  v[3] = _mm256_permute2x128_si256(abcd37, efgh37, 0x20);
+  v[4] = _mm256_permute2x128_si256(abcd04, efgh04, 0x31);
+  v[5] = _mm256_permute2x128_si256(abcd15, efgh15, 0x31);
+  v[6] = _mm256_permute2x128_si256(abcd26, efgh26, 0x31);
+  v[7] = _mm256_permute2x128_si256(abcd37, efgh37, 0x31);
+}
+
+// eight inputs at once, one in every 32-bit lane
+AVX2_FN static void hash8Avx2(const uint8_t *const *inputs, size_t blocks, uint64_t counter,
+                              bool incCounter, uint8_t flags, uint8_t flagsStart,
+                              uint8_t flagsEnd, uint32_t (*out)[8]) {
+  __m256i h[8], m[16], v[16], ctrLo, ctrHi;
+  uint32_t lo[8], hi[8];
+  size_t b;
+  int i, r;
+
+  for (i = 0; i < 8; i++) {
+    uint64_t c = counter + (incCounter ? i : 0);
+    lo[i] = (uint32_t)c;
+    hi[i] = (uint32_t)(c >> 32);
+    h[i] = _mm256_set1_epi32(IV[i]);
+  }
+  ctrLo = _mm256_loadu_si256((const __m256i *)lo);
+  ctrHi = _mm256_loadu_si256((const __m256i *)hi);
+  for (b = 0; b < blocks; b++) {
+    uint8_t f = flags | (b == 0 ? flagsStart : 0) | (b == blocks - 1 ? flagsEnd : 0);
+    for (i = 0; i < 8; i++) {
+      m[i] = _mm256_loadu_si256((const __m256i *)(inputs[i] + b * BLAKE3_BLOCK_LEN));
+      m[i + 8] = _mm256_loadu_si256((const __m256i *)(inputs[i] + b * BLAKE3_BLOCK_LEN + 32));
+    }
+    transpose8(m);
+    transpose8(m + 8);
+    for (i = 0; i < 8; i++)
+      v[i] = h[i];
+    for (i = 0; i < 4; i++)
+      v[i + 8] = _mm256_set1_epi32(IV[i]);
+    v[12] = ctrLo;
+    v[13] = ctrHi;
+    v[14] = _mm256_set1_epi32(BLAKE3_BLOCK_LEN);
+    v[15] = _mm256_set1_epi32(f);
+    for (r = 0; r < 7; r++) {
+      const uint8_t *s = SCHEDULE[r];
+      g8(v, 0, 4, 8, 12, m[s[0]], m[s[1]]);
+      g8(v, 1, 5, 9, 13, m[s[2]], m[s[3]]);
+      g8(v, 2, 6, 10, 14, m[s[4]], m[s[5]]);
+      g8(v, 3, 7, 11, 15, m[s[6]], m[s[7]]);
+      g8(v, 0, 5, 10, 15, m[s[8]], m[s[9]]);
+      g8(v, 1, 6, 11, 12, m[s[10]], m[s[11]]);
+      g8(v, 2, 7, 8, 13, m[s[12]], m[s[13]]);
+      g8(v, 3, 4, 9, 14, m[s[14]], m[s[15]]);
+    }
+    for (i = 0; i < 8; i++)
+      h[i] = _mm256_xor_si256(v[i], v[i + 8]);
+  }
+  transpose8(h);
+  for (i = 0; i < 8; i++)
+    _mm256_storeu_si256((__m256i *)out[i], h[i]);
+}
+
+AVX2_FN static void hashManyAvx2(const uint8_t *const *inputs, size_t n, size_t blocks,
+                                 uint64_t counter, bool incCounter, uint8_t flags,
+                                 uint8_t flagsStart, uint8_t flagsEnd, uint32_t (*out)[8]) {
+  for (; n >= 8; n -= 8, inputs += 8, out += 8) {
+    hash8Avx2(inputs, blocks, counter, incCounter, flags, flagsStart, flagsEnd, out);
+    if (incCounter)
+      counter += 8;
+  }
+  hashManyScalar(inputs, n, blocks, counter, incCounter, flags, flagsStart, flagsEnd, out);
+}
+#endif
+
+// widest kernel the CPU supports
+static hashmanyfn hashManyKernel(void) {
+#ifdef BLAKE3_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+    return hashManyAvx2;
+#endif
+  return hashManyScalar;
+}
+
+static void chunkInit(struct blake3chunk *c, uint64_t counter) {
+  memcpy(c->cv, IV, sizeof(c->cv));
+  c->counter = counter;
+  c->bufLen = 0;
+  c->blocksCompressed = 0;
+}
+
+static size_t chunkLen(const struct blake3chunk *c) {
+  return (size_t)c->blocksCompressed * BLAKE3_BLOCK_LEN + c->bufLen;
+}
+
+// add bytes to the chunk, the last block is kept for chunkOutput
+static void chunkUpdate(struct blake3chunk *c, const uint8_t *in, size_t n) {
+  uint32_t full[16];
+
+  while (n > 0) {
+    size_t take;
+    if (c->bufLen == BLAKE3_BLOCK_LEN) {
+      compress(c->cv, c->buf, BLAKE3_BLOCK_LEN, c->counter,
+               c->blocksCompressed == 0 ? CHUNK_START : 0, full);
+      memcpy(c->cv, full, sizeof(c->cv));
+      c->blocksCompressed++;
+      c->bufLen = 0;
+    }
+    take = BLAKE3_BLOCK_LEN - c->bufLen;
+    if (take > n)
+      take = n;
+    memcpy(c->buf + c->bufLen, in, take);
+    c->bufLen += take;
+    in += take;
+    n -= take;
+  }
+}
+
+// what the last compression of a node gets, it can still become the root
+struct output {
+  uint32_t cv[8];
+  uint8_t block[BLAKE3_BLOCK_LEN];
+  uint8_t blockLen;
+  uint64_t counter;
+  uint8_t flags;
+};
+
+static struct output chunkOutput(const struct blake3chunk *c) {
+  struct output o;
+
+  memcpy(o.cv, c->cv, sizeof(o.cv));
+  memset(o.block, 0, sizeof(o.block));
+  memcpy(o.block, c->buf, c->bufLen);
+  o.blockLen = c->bufLen;
+  o.counter = c->counter;
+  o.flags = CHUNK_END | (c->blocksCompressed == 0 ? CHUNK_START : 0);
+  return o;
+}
+
+static struct output parentOutput(const uint32_t left[8], const uint32_t right[8]) {
+  struct output o;
+  int i;
+
+  memcpy(o.cv, IV, sizeof(o.cv));
+  for (i = 0; i < 8; i++) {
+    uint32_t l = htole32(left[i]), r = htole32(right[i]);
+    memcpy(o.block + 4 * i, &l, 4);
+    memcpy(o.block + 32 + 4 * i, &r, 4);
+  }
+  o.blockLen = BLAKE3_BLOCK_LEN;
+  o.counter = 0;
+  o.flags = PARENT;
+  return o;
+}
+
+static void outputCv(const struct output *o, uint32_t cv[8]) {
+  uint32_t full[16];
+
+  compress(o->cv, o->block, o->blockLen, o->counter, o->flags, full);
+  memcpy(cv, full, 8 * sizeof(uint32_t));
+}
+
+// fold the stack until it holds one subtree per bit of the chunk count,
+// the last subtree is only merged once more input shows it is not the root
+static void mergeStack(struct blake3 *h, uint64_t totalChunks) {
+  int keep = __builtin_popcountll(totalChunks);
+
+  while (h->stackLen > keep) {
+    struct output o = parentOutput(h->stack[h->stackLen - 2], h->stack[h->stackLen - 1]);
+    outputCv(&o, h->stack[h->stackLen - 2]);
+    h->stackLen--;
+  }
+}
+
+static void pushCv(struct blake3 *h, const uint32_t cv[8], uint64_t counter) {
+  mergeStack(h, counter);
+  memcpy(h->stack[h->stackLen++], cv, 8 * sizeof(uint32_t));
+}
+
+void blake3Init(struct blake3 *h) {
+  chunkInit(&h->chunk, 0);
+  h->stackLen = 0;
+}
+
+void blake3Update(struct blake3 *h, const void *in, size_t n) {
+  const uint8_t *p = in;
+  uint32_t cv[8];
+
+  while (n > 0) {
+    size_t take;
+    if (chunkLen(&h->chunk) == BLAKE3_CHUNK_LEN) {
+      struct output o = chunkOutput(&h->chunk);
+      outputCv(&o, cv);
+      pushCv(h, cv, h->chunk.counter);
+      chunkInit(&h->chunk, h->chunk.counter + 1);
+    }
+    take = BLAKE3_CHUNK_LEN - chunkLen(&h->chunk);
+    if (take > n)
+      take = n;
+    chunkUpdate(&h->chunk, p, take);
+    p += take;
+    n -= take;
+  }
+  if (chunkLen(&h->chunk) > 0)
+    mergeStack(h, h->chunk.counter);
+}
+
+// Add the chaining value of a complete subtree of nchunks chunks, a power
+// of two, that starts at a multiple of nchunks and is not the whole input.
+// The hasher must be at a chunk boundary.
+void blake3PushSubtree(struct blake3 *h, const uint32_t cv[8], uint64_t nchunks) {
+  pushCv(h, cv, h->chunk.counter);
+  chunkInit(&h->chunk, h->chunk.counter + nchunks);
+}
+
+void blake3Final(struct blake3 *h, uint8_t out[BLAKE3_OUT_LEN]) {
+  struct output o;
+  uint32_t full[16], cv[8];
+  int i, left;
+
+  if (chunkLen(&h->chunk) > 0 || h->stackLen == 0) {
+    o = chunkOutput(&h->chunk);
+    left = h->stackLen;
+  } else {
+    o = parentOutput(h->stack[h->stackLen - 2], h->stack[h->stackLen - 1]);
+    left = h->stackLen - 2;
+  }
+  while (left > 0) {
+    outputCv(&o, cv);
+    o = parentOutput(h->stack[--left], cv);
+  }
+  compress(o.cv, o.block, o.blockLen, o.counter, o.flags | ROOT, full);
+  for (i = 0; i < 8; i++) {
+    uint32_t w = htole32(full[i]);
+    memcpy(out + 4 * i, &w, 4);
+  }
+}
+
+/*
+Chaining value of the complete subtree over nchunks chunks at in, a power
+of two of at least 2, whose first chunk has index counter. It is never the
+root. scratch holds nchunks chaining values.
+*/
+void blake3Subtree(const void *in, uint64_t nchunks, uint64_t counter, uint32_t *scratch,
+                   uint32_t cv[8]) {
+  hashmanyfn hashMany = hashManyKernel();
+  const uint8_t *inputs[64];
+  uint32_t (*cvs)[8] = (uint32_t (*)[8])scratch;
+  uint64_t i, j, n;
+
+  for (i = 0; i < nchunks; i += j) {
+    for (j = 0; j < 64 && i + j < nchunks; j++)
+      inputs[j] = (const uint8_t *)in + (i + j) * BLAKE3_CHUNK_LEN;
+    hashMany(inputs, j, BLAKE3_CHUNK_LEN / BLAKE3_BLOCK_LEN, counter + i, true, 0,
+             CHUNK_START, CHUNK_END, cvs + i);
+  }
+  // every level of parents is one pass, a parent block is two chaining
+  // values side by side, which is how they are laid out already
+  for (n = nchunks; n > 1; n /= 2) {
+    for (i = 0; i < n / 2; i += j) {
+      for (j = 0; j < 64 && i + j < n / 2; j++)
+        inputs[j] = (const uint8_t *)cvs[2 * (i + j)];
+      hashMany(inputs, j, 1, 0, false, PARENT, 0, 0, cvs + i);
+    }
+  }
+  memcpy(cv, cvs[0], 8 * sizeof(uint32_t));
+}
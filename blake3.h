@@ -0,0 +1,40 @@
+#ifndef _BLAKE3_H_
+#define _BLAKE3_H_
+
+// BLAKE3 hashing, for the image fingerprints. The input is a binary tree
+// of 1 KB chunks, so separate threads can hash aligned subtrees and a
+// hasher joins their chaining values. Chunks and parent nodes are hashed
+// eight at a time with AVX2 where the CPU has it.
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define BLAKE3_OUT_LEN    32
+#define BLAKE3_BLOCK_LEN  64
+#define BLAKE3_CHUNK_LEN  1024
+
+// chunk being hashed
+struct blake3chunk {
+  uint32_t cv[8];
+  uint64_t counter;                // index of the chunk in the input
+  uint8_t buf[BLAKE3_BLOCK_LEN];
+  uint8_t bufLen;
+  uint8_t blocksCompressed;
+};
+
+// incremental hasher, a stack of the chaining values of complete subtrees
+// left of the current chunk
+struct blake3 {
+  struct blake3chunk chunk;
+  uint32_t stack[54][8];
+  uint8_t stackLen;
+};
+
+void blake3Init(struct blake3 *h);
+void blake3Update(struct blake3 *h, const void *in, size_t n);
+void blake3PushSubtree(struct blake3 *h, const uint32_t cv[8], uint64_t nchunks);
+void blake3Final(struct blake3 *h, uint8_t out[BLAKE3_OUT_LEN]);
+void blake3Subtree(const void *in, uint64_t nchunks, uint64_t counter, uint32_t *scratch,
+                   uint32_t cv[8]);
+
+#endif // _BLAKE3_H_
@@ -0,0 +1,309 @@
+// Block source
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "types.h"
+#include "fs.h"
+#include "blocksource.h"
+
+// wanted blocks this close together are asked for as one extent
+#define EXTENT_GAP 8
+
+// bytes a pipe is copied in at a time
+#define SPOOL_CHUNK (1 << 20)
+
+// Copy a file that cannot be read at an offset (a pipe, a terminal) to an
+// unlinked temporary file, which can. The buffer is the caller's own, as
+// batch and --serve workers may spool at the same time. Returns the new
+// descriptor or -1.
+static int spool(int fd) {
+  char *buf;
+  FILE *tmp = tmpfile();
+  ssize_t n;
+  int out;
+
+  if (tmp == NULL)
+    return -1;
+  out = dup(fileno(tmp));
+  fclose(tmp);
+  if (out < 0)
+    return -1;
+  if ((buf = malloc(SPOOL_CHUNK)) == NULL) {
+    close(out);
+    return -1;
+  }
+  while ((n = read(fd, buf, SPOOL_CHUNK)) > 0) {
+    if (write(out, buf, n) != n) {
+      n = -1;
+      break;
+    }
+  }
+  free(buf);
+  if (n < 0) {
+    close(out);
+    return -1;
+  }
+  return out;
+}
+
+/*
+Open the image at path, - for the standard input. Regular files are mapped
+unless stream is set or the mapping fails, then they are read with pread.
+Anything else is first copied to a temporary file. With writable, the image
+is opened for sourceWrite, shared, and must be a file or a block device.
+Returns why the image could not be opened, or NULL.
+*/
+const char *sourceOpen(struct blocksource *src, const char *path, bool stream, bool writable) {
+  int fsfd;
+  struct stat st;
+
+  memset(src, 0, sizeof(*src));
+  src->fd = -1;
+
+  // open the image file
+  if (writable && strcmp(path, "-") == 0)
+    return "cannot write to the standard input";
+  fsfd = strcmp(path, "-") == 0 ? dup(0) : open(path, writable ? O_RDWR : O_RDONLY);
+  if(fsfd < 0)
+    return "image not found";
+
+  // use fstat to get the file size
+  if (fstat(fsfd, &st) != 0) {
+    close(fsfd);
+    return "stat failed";
+  }
+  if (writable && !S_ISREG(st.st_mode) && !S_ISBLK(st.st_mode)) {
+    close(fsfd);
+    return "cannot write to the image";
+  }
+  if (!S_ISREG(st.st_mode) && !S_ISBLK(st.st_mode)) {
+    int tmp = spool(fsfd);
+    close(fsfd);
+    if (tmp < 0 || fstat(tmp, &st) != 0) {
+      if (tmp >= 0)
+        close(tmp);
+      return "cannot read image";
+    }
+    fsfd = tmp;
+    stream = true;
+  } else if (S_ISBLK(st.st_mode)) {
+    // block devices have no size in st_size
+    st.st_size = lseek(fsfd, 0, SEEK_END);
+  }
+
+  // boot block and super block at least
+  if (st.st_size < 2 * BSIZE) {
+    close(fsfd);
+    return "image too small";
+  }
+  src->size = st.st_size;
+  sourceSetBlockSize(src, BSIZE);
+
+  // memory map image file
+  if (!stream) {
+    src->map = writable ? mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fsfd, 0)
+                        : mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fsfd, 0);
+    if (src->map != MAP_FAILED) {
+      src->mapSize = st.st_size;
+      close(fsfd);
+      return NULL;
+    }
+    src->map = NULL;
+  }
+  src->fd = fsfd;
+  // the inode table and the bitmap are read front to back
+  posix_fadvise(fsfd, 0, 0, POSIX_FADV_SEQUENTIAL);
+  return NULL;
+}
+
+// read the image from size bytes at buf, which the caller keeps until the
+// source is closed and does not change meanwhile
+const char *sourceOpenBuffer(struct blocksource *src, const void *buf, size_t size) {
+  memset(src, 0, sizeof(*src));
+  src->fd = -1;
+  if (size < 2 * BSIZE)
+    return "image too small";
+  src->size = size;
+  sourceSetBlockSize(src, BSIZE);
+  src->map = (char *) buf;
+  src->mapSize = size;
+  src->borrowed = true;
+  return NULL;
+}
+
+// count blocks of blockSize bytes from now on, a multiple of BSIZE, once
+// the geometry of the image is known
+void sourceSetBlockSize(struct blocksource *src, uint blockSize) {
+  src->blockSize = blockSize;
+  src->nblocks = src->size / blockSize;
+}
+
+// the first logged block whose home is in [block, block + n), or nlogged
+static uint firstLogged(const struct blocksource *src, uint block, uint n) {
+  uint lo = 0, hi = src->nlogged;
+
+  while (lo < hi) {
+    uint mid = lo + (hi - lo) / 2;
+    if (src->logged[mid].home < block)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo < src->nlogged && src->logged[lo].home - block < n ? lo : src->nlogged;
+}
+
+// whether blocks [block, block + n) can be used in place
+bool sourceInMap(const struct blocksource *src, uint block, uint n) {
+  return src->map != NULL && block <= src->nblocks && n <= src->nblocks - block &&
+         (src->nlogged == 0 || firstLogged(src, block, n) == src->nlogged);
+}
+
+// blocks [block, block + n) as they are in the image, into buf unless mapped
+static const void *readBlocks(struct blocksource *src, uint block, uint n, void *buf) {
+  size_t have = 0, want;
+
+  if (src->map != NULL && block <= src->nblocks && n <= src->nblocks - block)
+    return src->map + (size_t)block * src->blockSize;
+  if (block < src->nblocks) {
+    want = (size_t)(n < src->nblocks - block ? n : src->nblocks - block) * src->blockSize;
+    if (src->map != NULL) {
+      memcpy(buf, src->map + (size_t)block * src->blockSize, want);
+      have = want;
+    } else {
+      while (have < want) {
+        ssize_t r = pread(src->fd, (char *) buf + have, want - have,
+                          (off_t)block * src->blockSize + have);
+        if (r <= 0) {
+          __atomic_fetch_add(&src->readErrors, 1, __ATOMIC_RELAXED);
+          break;
+        }
+        have += r;
+      }
+    }
+  }
+  memset((char *) buf + have, 0, (size_t)n * src->blockSize - have);
+  return buf;
+}
+
+/*
+Blocks [block, block + n) of the image, with the logged blocks in them
+replayed. Returns a pointer into the mapping when possible, a lone logged
+block included, otherwise reads them into buf, which must hold n blocks,
+and returns buf. Blocks past the end of the image read as zeros.
+*/
+const void *sourceBlocks(struct blocksource *src, uint block, uint n, void *buf) {
+  const void *p;
+  char *to;
+  uint i;
+
+  if (src->nlogged == 0 || (i = firstLogged(src, block, n)) == src->nlogged)
+    return readBlocks(src, block, n, buf);
+  if (n == 1)
+    return readBlocks(src, src->logged[i].copy, 1, buf);
+  if ((p = readBlocks(src, block, n, buf)) != buf)
+    memcpy(buf, p, (size_t)n * src->blockSize);
+  for (; i < src->nlogged && src->logged[i].home - block < n; i++) {
+    to = (char *) buf + (size_t)(src->logged[i].home - block) * src->blockSize;
+    if ((p = readBlocks(src, src->logged[i].copy, 1, to)) != to)
+      memcpy(to, p, src->blockSize);
+  }
+  return buf;
+}
+
+/*
+Lay the committed blocks of a log over the image: from now on their home
+blocks read as the copies in the log, without writing either. logged is
+sorted by home block, one entry per home, in blocks of the final block
+size, and is freed with the source; NULL drops the overlay.
+*/
+void sourceOverlay(struct blocksource *src, struct loggedblock *logged, uint n) {
+  free(src->logged);
+  src->logged = logged;
+  src->nlogged = logged != NULL ? n : 0;
+}
+
+// start reading blocks that are about to be needed, without waiting for them
+void sourceWillNeed(struct blocksource *src, uint block, uint n) {
+  if (block >= src->nblocks)
+    return;
+  if (n > src->nblocks - block)
+    n = src->nblocks - block;
+  if (src->map != NULL) {
+    // madvise wants a page aligned start
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t start = (size_t)block * src->blockSize, aligned = start & ~(page - 1);
+    madvise(src->map + aligned, start - aligned + (size_t)n * src->blockSize, MADV_WILLNEED);
+  } else
+    posix_fadvise(src->fd, (off_t)block * src->blockSize, (off_t)n * src->blockSize,
+                  POSIX_FADV_WILLNEED);
+}
+
+static int compareBlocks(const void *a, const void *b) {
+  uint x = *(const uint *) a, y = *(const uint *) b;
+  return (x > y) - (x < y);
+}
+
+// Ask for a set of scattered blocks, sorted in place, in ascending order.
+// Blocks close to each other are merged into one extent, so the device
+// sees a few large forward reads instead of many small random ones.
+void sourceWillNeedList(struct blocksource *src, uint *blocks, size_t n) {
+  size_t i;
+  uint start, end;
+
+  if (n == 0)
+    return;
+  qsort(blocks, n, sizeof(uint), compareBlocks);
+  start = end = blocks[0];
+  for (i = 1; i < n; i++) {
+    if (blocks[i] - end > EXTENT_GAP) {
+      sourceWillNeed(src, start, end - start + 1);
+      start = blocks[i];
+    }
+    end = blocks[i];
+  }
+  sourceWillNeed(src, start, end - start + 1);
+}
+
+// Write n blocks of data at block, which must be in the image, through the
+// mapping or with pwrite; a logged home block still reads from the log.
+// Returns -1 if the write failed.
+int sourceWrite(struct blocksource *src, uint block, uint n, const void *data) {
+  size_t done = 0, want = (size_t)n * src->blockSize;
+
+  if (block > src->nblocks || n > src->nblocks - block)
+    return -1;
+  if (src->map != NULL) {
+    memcpy(src->map + (size_t)block * src->blockSize, data, want);
+    return 0;
+  }
+  while (done < want) {
+    ssize_t r = pwrite(src->fd, (const char *) data + done, want - done,
+                       (off_t)block * src->blockSize + done);
+    if (r <= 0)
+      return -1;
+    done += r;
+  }
+  return 0;
+}
+
+// flush everything written to the device, once. Returns -1 if that failed.
+int sourceSync(struct blocksource *src) {
+  if (src->map != NULL)
+    return msync(src->map, src->mapSize, MS_SYNC);
+  return fsync(src->fd);
+}
+
+void sourceClose(struct blocksource *src) {
+  sourceOverlay(src, NULL, 0);
+  if (src->map != NULL && !src->borrowed)
+    munmap(src->map, src->mapSize);
+  if (src->fd >= 0)
+    close(src->fd);
+  src->map = NULL;
+  src->fd = -1;
+}
@@ -0,0 +1,46 @@
+#ifndef _BLOCKSOURCE_H_
+#define _BLOCKSOURCE_H_
+
+// Where the checker reads image blocks from: either the whole image mapped
+// into memory, or already in memory, or a file read with pread a batch of
+// blocks at a time. A repair writes them back the same way. The committed
+// blocks of a log can be laid over the image, so that their home blocks
+// read as replayed.
+// Include types.h and fs.h first.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// a home block replaced by its committed copy in the log
+struct loggedblock {
+  uint home;
+  uint copy;
+};
+
+struct blocksource {
+  uint blockSize;        // bytes in a block of the image's geometry
+  uint nblocks;          // whole blocks in the image
+  uint64_t size;         // bytes in the image
+  char *map;             // mapped image, NULL when reading with pread
+  size_t mapSize;
+  bool borrowed;         // map is the caller's buffer, not to be unmapped
+  int fd;                // image file when reading with pread, else -1
+  uint readErrors;       // reads that failed, their blocks read as zeros
+  struct loggedblock *logged; // replayed log, by ascending home block
+  uint nlogged;
+};
+
+const char *sourceOpen(struct blocksource *src, const char *path, bool stream, bool writable);
+const char *sourceOpenBuffer(struct blocksource *src, const void *buf, size_t size);
+void sourceSetBlockSize(struct blocksource *src, uint blockSize);
+const void *sourceBlocks(struct blocksource *src, uint block, uint n, void *buf);
+bool sourceInMap(const struct blocksource *src, uint block, uint n);
+void sourceWillNeed(struct blocksource *src, uint block, uint n);
+void sourceWillNeedList(struct blocksource *src, uint *blocks, size_t n);
+void sourceOverlay(struct blocksource *src, struct loggedblock *logged, uint n);
+int sourceWrite(struct blocksource *src, uint block, uint n, const void *data);
+int sourceSync(struct blocksource *src);
+void sourceClose(struct blocksource *src);
+
+#endif // _BLOCKSOURCE_H_
@@ -0,0 +1,81 @@
+#ifndef _CHECK_H_
+#define _CHECK_H_
+
+// The checker is compiled from checker.c once per on-disk geometry (block
+// size and the direct and indirect addresses of an inode), by the geom*.c
+// files, so that the geometry is a constant in all of its loops. fcheck
+// picks the geometry of every image and calls that checker.
+// Include types.h and fs.h first.
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "report.h"
+#include "blocksource.h"
+#include "stats.h"
+#include "delta.h"
+
+// how to check an image
+struct checkopts {
+  int nthreads;               // threads scanning the inode table
+  bool collectAll;            // report every error instead of the first one
+  const char *indexPath;      // write the directory index to this file, if set
+  bool stream;                // read the image with pread instead of mapping it
+  bool prefetch;              // fetch directory and indirect blocks in address order first
+  struct checkstats *stats;   // per-phase statistics, or NULL
+  const char *manifestPath;   // -M: check against this manifest and update it
+  bool fingerprint;           // -F: also hash the image, with the result
+  const struct geometry *geometry; // -g: geometry of every image, NULL to detect it
+  bool repair;                // --repair: fix the image in place before checking it
+  const char *treePath;       // -T: write the path of every entry to this file, if set
+  uint rules;                 // bit r set to check rule r, 0 for every rule
+  uint quickSamples;          // --quick: inodes to sample instead of checking them all
+  uint quickMillis;           // --quick-ms: time the sample may take, 0 for no limit
+  uint64_t quickBytes;        // --quick-mb: bytes of the image it may read, 0 for no limit
+  struct scratch *scratch;    // arena the buffers of the check come from, NULL for the heap
+};
+
+// a checker compiled for one geometry
+struct geometry {
+  uint blockSize;
+  uint ndirect;
+  // the errors go to rp, returns 1 if the image has errors, 0 if not
+  int (*checkImage)(struct blocksource *src, struct superblock *sb, struct checkopts *opts,
+                    struct report *rp);
+  // --quick: the super block and the root, then a sample of the inodes
+  // against the rules one inode can tell; what it covered goes to rp too
+  int (*quickCheck)(struct blocksource *src, struct superblock *sb, struct checkopts *opts,
+                    struct report *rp);
+  // heap the check of an image needs
+  uint64_t (*checkMemory)(struct superblock *sb, struct checkopts *opts);
+  // how well the image decodes in the geometry, the source counting in blockSize;
+  // the directories that decode count for more than the inodes that do
+  uint (*probeDirs)(struct blocksource *src, struct superblock *sb);
+  // whether the layout the super block gives fits the image, returns what
+  // is wrong with it or NULL
+  const char *(*checkLayout)(struct blocksource *src, struct superblock *sb);
+  // lay the committed blocks of the log over the image, returns why the
+  // log cannot be replayed or NULL
+  const char *(*replayLog)(struct blocksource *src, struct superblock *sb);
+  // fix what can be fixed in place, the fixes go to fixes; returns the
+  // blocks written, -1 if the image could not be written
+  int (*repairImage)(struct blocksource *src, struct superblock *sb, struct report *fixes);
+  // what changed in the metadata from the image before to the one after
+  void (*diffImages)(struct blocksource *before, struct superblock *sbBefore,
+                     struct blocksource *after, struct superblock *sbAfter, struct delta *delta);
+};
+
+// in image.c
+const char *openImage(const char *path, struct checkopts *opts, struct blocksource *src,
+                      struct superblock *sb, const struct geometry **geo);
+const char *loadImage(struct blocksource *src, struct checkopts *opts, struct superblock *sb,
+                      const struct geometry **geo);
+const struct geometry *findGeometry(struct blocksource *src, struct superblock *sb);
+const struct geometry *parseGeometry(const char *arg);
+const struct geometry *lookupGeometry(uint blockSize, uint ndirect);
+void readSuperBlock(struct blocksource *src, const struct geometry *g, struct superblock *sb);
+
+extern const struct geometry geom512x12, geom1024x12, geom1024x11d, geom1024x28, geom4096x12,
+                             geom4096x10t, geom4096x28;
+
+#endif // _CHECK_H_
@@ -0,0 +1,1936 @@
+// File system checker for one geometry
+//
+// Compiled once per geometry by the geom*.c files, which set BSIZE and
+// NDIRECT and name the geometry before including this file, so the block
+// size, the inode size and the address counts are constants everywhere
+// below, and in repair.c, diff.c and quick.c, included at the end. Only the
+// geometry itself is visible outside.
+#ifndef GEOMETRY
+#error "checker.c is compiled through the geom*.c files"
+#endif
+
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <assert.h>
+#include <stdbool.h>
+#include <endian.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "types.h"
+#include "fs.h"
+#include "bitset.h"
+#include "check.h"
+#include "dirindex.h"
+#include "dirscan.h"
+#include "manifest.h"
+#include "fingerprint.h"
+
+#define BLOCK_SIZE (BSIZE)
+
+// inodes handed to a scanning thread at a time, a multiple of 64 so that
+// every word of the per-inode bit sets is only written by one thread
+#define INODE_CHUNK 1024
+
+// inode chunks the kernel is asked to read ahead of the scan
+#define READAHEAD_CHUNKS 4
+
+// -M: manifest blocks at most VERIFY_GAP apart are read as one extent of at
+// most VERIFY_EXTENT blocks
+#define VERIFY_GAP 8
+#define VERIFY_EXTENT 256
+
+#define DPB (BLOCK_SIZE / sizeof(struct dirent)) // dirents per block
+
+// inodes looked at to tell the geometry of an image, a multiple of IPB
+#define PROBE_INODES 64
+
+// directories of the tree walk handed to a thread at a time, and the
+// entries a level needs before it is walked by more than one thread
+#define TREE_CHUNK 64
+#define TREE_PARALLEL 65536
+
+// depth of a directory the tree walk did not reach
+#define TREE_UNSEEN UINT32_MAX
+
+// levels of indirection below the addresses in an inode
+#define WALK_HEIGHT (NTINDIRECT ? 3 : NDINDIRECT ? 2 : 1)
+
+// Error slots, one per rule group. The slot order is the order in which the
+// rules used to be validated one after another, so the error printed is the
+// same one the sequential checker would have stopped on.
+enum {
+  PHASE_RULE1,
+  PHASE_RULE2,
+  PHASE_RULE3,
+  PHASE_RULE4,
+  PHASE_RULE5,
+  PHASE_RULE6,
+  PHASE_RULE7_8,
+  PHASE_RULE9,
+  PHASE_RULE10,
+  PHASE_RULE11_12,
+  PHASE_RULE13_14,
+  NPHASE
+};
+
+// state of every rule, fed by a single traversal of the image and shared by
+// all scanning threads
+struct checkstate {
+  struct blocksource *src;    // image blocks
+  struct superblock *sb;      // copy of the super block
+  uint imageBlocks;           // number of blocks in the image
+  uint firstDataBlock;        // valid data blocks are in [firstDataBlock, dataBlockEnd)
+  uint dataBlockEnd;
+  const char *bitmapBlock;    // on-disk free bitmap
+  char *bitmapBuf;            // bitmap read from the image, when not used in place
+  dirscanfn scanDirents;      // classifies the entries of a directory block
+  bitword *isBlockUsed;       // rules 6, 7, 8: blocks referenced by in-use inodes
+  bitword *isBlockReferenced; // rule 5: addresses that must be marked in the bitmap
+  uint *blockOwner;           // -a, rules 7, 8: first inode to use every data block plus 1, 0 if none
+  bitword *isOwnerIndirect;   // -a: that use is not a direct address, by data block
+  bitword *isInodeInUse;      // rules 9, 10: inodes of a valid type
+  bitword *isInodeFile;       // rule 11
+  bitword *isInodeDir;        // rules 4, 12
+  uint16_t *inodeNlink;       // rule 11: link count of every inode
+  struct dirindex index;      // rules 3, 4, 9, 10, 11, 12: every used dirent
+  uint nextInode;             // first inode of the next chunk to hand out
+  bool threaded;              // shared state needs atomic updates
+  bool collectAll;            // keep every error, not only the first of each group
+  bool record;                // -M: log what the inodes of every inode table block lead to
+  uint nunits;                // -M: inode table blocks
+  uint64_t *unitHash;         // -M: hash of every inode table block
+  struct fingerprint *fp;     // -F: pieces of the image to hash, or NULL
+  struct scratch *scratch;    // arena the buffers of the check come from, or NULL
+  uint rules;                 // bit r set to check rule r, 0 for every rule
+};
+
+// a use of a data block some inode owns already, rules 7 and 8
+struct blockuse {
+  uint block;
+  uint inum;
+  uint indirect;  // the address is not a direct one
+};
+
+// growable list of them
+struct uselist {
+  struct blockuse *uses;
+  size_t count;
+  size_t capacity;
+  struct scratch *scratch;
+};
+
+// per-thread part of the check state, merged once all threads are done
+struct checkshard {
+  struct checkstate *cs;
+  struct diagnostic first[NPHASE]; // first error found by each rule group
+  struct report report;            // every error, when collecting all of them
+  struct dirindex index;           // dirents of the directories this thread visited
+  struct dinode *inodeBuf;         // inode chunk being visited, when not used in place
+  uint indBuf[WALK_HEIGHT][NINDIRECT]; // indirect blocks being walked, likewise
+  struct dirent *dirBuf;           // directory blocks being decoded, likewise
+  struct unitlog log;              // -M: blocks this thread read and marked
+  struct uselist conflicts;        // -a: uses of data blocks another use owns
+  void *pieceBuf;                  // -F: piece being hashed, when not used in place
+  uint32_t *pieceScratch;          // -F: chaining values of its chunks
+#ifdef FCHECK_STATS
+  struct statcounts counts;        // work done by this thread
+#endif
+};
+
+// growable list of block addresses, or of inodes
+struct blocklist {
+  uint *blocks;
+  size_t count;
+  size_t capacity;
+  struct scratch *scratch;
+};
+
+// a block of an inode, as the block walker finds it
+struct blockref {
+  uint block;     // its address
+  uint fileBlock; // first block of the file it maps
+  uint height;    // 0 for a data block, the levels of indirection below it otherwise
+  bool inInode;   // the address is in the inode, not in an indirect block
+};
+
+// Iterator over the blocks of an inode in file order, direct, indirect,
+// doubly and triply indirect ones. Zero addresses are skipped, and an
+// indirect block is only entered once the caller hands its contents to
+// walkDescend, so a walk costs the blocks the inode has, not the blocks
+// its size could map.
+struct blockwalk {
+  int depth; // level being walked, 0 for the addresses in the inode
+  struct {
+    const uint *addrs; // addresses of the level
+    uint count;        // how many
+    uint next;         // the next one to look at
+    uint height;       // height of the indirect block holding them
+    uint fileBlock;    // first block of the file they map
+  } level[WALK_HEIGHT + 1];
+};
+
+// The directory tree, walked breadth first from the root one level at a
+// time. Directories of a level are claimed by the threads walking it in
+// chunks; each directory takes the lowest directory of the level above
+// with an entry for it as its parent, whichever thread finds that entry.
+struct treewalk {
+  struct checkstate *cs;
+  uint ninodes;               // inodes the walk covers, up to the last an entry names
+  uint *first;                // entries of directory d are order[first[d]] to order[first[d + 1]]
+  uint *order;                // entries of the index by directory
+  uint *depth;                // level a directory was reached at, TREE_UNSEEN if not
+  uint *parent;               // its parent in the tree
+  uint *frontier;             // directories of the level being walked
+  uint nfrontier;
+  uint level;
+  uint nextDir;               // first directory of the next chunk to hand out
+  uint levels;                // levels walked
+};
+
+// a thread walking a level, and the directories it reached
+struct treeshard {
+  struct treewalk *tw;
+  struct blocklist found;
+};
+
+// function declarations
+static uint64_t checkMemory(struct superblock *sb, struct checkopts *opts);
+static uint probeDirs(struct blocksource *src, struct superblock *sb);
+static const char *checkLayout(struct blocksource *src, struct superblock *sb);
+static const char *replayLog(struct blocksource *src, struct superblock *sb);
+static int compareLogged(const void *a, const void *b);
+static int checkImage(struct blocksource *src, struct superblock *sb, struct checkopts *opts,
+                      struct report *rp);
+static void initCheck(struct checkstate *cs, struct blocksource *src, struct superblock *sb,
+                      struct checkopts *opts);
+static void initShard(struct checkstate *cs, struct checkshard *sh);
+static bitword *checkBitset(struct checkstate *cs, uint64_t nbits);
+static uint16_t *checkCounters(struct checkstate *cs, uint64_t n);
+static void validateGlobal(struct checkstate *cs, struct checkshard *result,
+                           struct checkopts *opts);
+static void finishCheck(struct checkstate *cs, struct checkshard *result, struct checkopts *opts,
+                        struct report *rp);
+static void freeCheck(struct checkstate *cs);
+static int recheckImage(struct checkstate *cs, struct manifest *m, struct checkopts *opts,
+                        struct report *rp);
+static void hashInodeTable(struct checkstate *cs, struct manifest *m, bitword *dirty,
+                           struct dinode *buf, struct statcounts *counts);
+static int verifyDeps(struct checkstate *cs, struct manifest *m, bitword *dirty,
+                      struct statcounts *counts);
+static void saveManifest(struct checkstate *cs, struct unitlog *log, const char *path);
+static void fingerprintImage(struct checkstate *cs, struct checkopts *opts, struct report *rp);
+static void prefetchBlocks(struct checkstate *cs, struct dinode *buf, struct statcounts *counts);
+static void prefetchChildren(struct checkstate *cs, uint block, void *buf, struct blocklist *bl,
+                             struct statcounts *counts);
+static void blocklistAdd(struct blocklist *bl, uint block);
+static void *scanInodes(void *arg);
+static void visitInode(struct checkstate *cs, struct checkshard *sh, uint inum,
+                       const struct dinode *dip);
+static bool noteInode(struct checkstate *cs, uint inum, const struct dinode *dip);
+static inline void walkInode(struct blockwalk *w, const struct dinode *dip);
+static inline bool walkNext(struct blockwalk *w, struct blockref *ref);
+static inline void walkDescend(struct blockwalk *w, const struct blockref *ref, const uint *addrs);
+static inline uint slotHeight(uint slot);
+static inline uint slotFileBlock(uint slot);
+static bool probeLayout(const struct dinode *dip);
+static inline uint dirBlockEntries(uint size, uint fileBlock);
+static void visitDirBlock(struct checkstate *cs, struct checkshard *sh, uint inum, uint size,
+                          uint fileBlock, uint block);
+static void markBlockUsed(struct checkstate *cs, struct checkshard *sh, int rule, uint inum,
+                          uint block, const char *dupError);
+static void uselistAdd(struct uselist *ul, uint block, uint inum, bool indirect);
+static int compareUses(const void *a, const void *b);
+static void reportConflicts(struct checkstate *cs, struct checkshard *sh, struct uselist *ul);
+static void reportConflict(struct checkshard *sh, const struct blockuse *use,
+                           const struct blockuse *owner);
+static void markBlockReferenced(struct checkstate *cs, struct checkshard *sh, uint inum,
+                                uint block);
+static void validateBitmap(struct checkstate *cs, struct checkshard *sh);
+static void reconcileWord(struct checkstate *cs, struct checkshard *sh, uint64_t w, bitword mask);
+static void validateNamespace(struct checkstate *cs, struct checkshard *sh);
+static void validateTree(struct checkstate *cs, struct checkshard *sh, struct checkopts *opts);
+static void *walkTreeShard(void *arg);
+static void walkTreeLevel(struct treewalk *tw, uint from, uint to, struct blocklist *found);
+static uint appendTreeName(char *path, const char *name);
+static void dumpTree(struct checkstate *cs, struct treewalk *tw, const char *path);
+static uint fileBlockAddress(struct blocksource *src, const struct dinode *dip, uint fileBlock,
+                             uint *buf);
+static void reportError(struct checkshard *sh, int phase, int rule, long inum, long block,
+                        const char *error);
+static void reportDirentError(struct checkshard *sh, int phase, int rule, uint dirInum, long slot,
+                              const struct dirent *de, const char *error);
+static void addError(struct checkshard *sh, int phase, const struct diagnostic *d);
+static bool rulesEnabled(struct checkstate *cs, uint rules);
+static void keepFirstError(struct checkshard *sh, int phase, const struct diagnostic *d);
+
+// heap used by the check of an image, what a batch counts against its cap
+static uint64_t checkMemory(struct superblock *sb, struct checkopts *opts) {
+  uint64_t blocks = BBLOCK(0, (uint64_t)sb->ninodes) + sb->size/BPB + 1 + sb->nblocks;
+  uint64_t inodes = sb->ninodes;
+  uint64_t named = inodes < (1 << 16) ? inodes : (1 << 16); // what a 16-bit entry can name
+
+  return 2 * BITSET_WORDS(blocks) * sizeof(bitword)  // block sets
+       + 6 * BITSET_WORDS(inodes) * sizeof(bitword)  // inode sets
+       + 2 * inodes * sizeof(uint16_t)               // link and reference counts
+       + inodes * sizeof(struct dirindexent)         // about one dirent per inode
+       + (inodes + 3 * named) * sizeof(uint)         // tree walk
+       + (opts->collectAll ? sb->nblocks * sizeof(uint) + BITSET_WORDS(sb->nblocks) * sizeof(bitword)
+                           : 0);                     // block owners
+}
+
+// How well the image decodes in this geometry: the directories among the
+// first PROBE_INODES inodes whose first block is a data block that starts
+// with their own "." entry. Another inode size misplaces the inodes and
+// another block size the blocks, so few directories survive either. Ties
+// between geometries that only lay out the addresses of an inode apart go
+// to the one in which more of those inodes have the addresses their size
+// needs.
+static uint probeDirs(struct blocksource *src, struct superblock *sb) {
+  struct dinode inodes[PROBE_INODES];
+  struct dirent dirents[DPB];
+  const struct dinode *dip;
+  const struct dirent *de;
+  uint64_t firstDataBlock = BBLOCK(0, (uint64_t)sb->ninodes) + sb->size/BPB + 1;
+  uint i, n = 0, fits = 0;
+
+  dip = sourceBlocks(src, IBLOCK(0), PROBE_INODES / IPB, inodes);
+  for (i = 0; i < PROBE_INODES && i < sb->ninodes; i++) {
+    if (dip[i].type >= 1 && dip[i].type <= 3 && probeLayout(&dip[i]))
+      fits++;
+    if (dip[i].type != 1 || dip[i].addrs[0] < firstDataBlock || dip[i].addrs[0] >= src->nblocks)
+      continue;
+    de = sourceBlocks(src, dip[i].addrs[0], 1, dirents);
+    if (de->inum == i && strncmp(de->name, ".", DIRSIZ) == 0)
+      n++;
+  }
+  return n * (PROBE_INODES + 1) + fits;
+}
+
+/*
+Whether the super block describes a layout the checker can work on: every
+block number of the layout fits in 32 bits, so the data area does not wrap
+around and start after its end, and the inode table and the bitmap are in
+the image. The rules index the block and inode sets with numbers they only
+compare against the layout, so this is what keeps a corrupt super block
+from sending them out of bounds. Returns what is wrong, or NULL.
+*/
+static const char *checkLayout(struct blocksource *src, struct superblock *sb) {
+  uint64_t firstDataBlock = BBLOCK(0, (uint64_t)sb->ninodes) + sb->size/BPB + 1;
+
+  if (firstDataBlock + sb->nblocks > UINT32_MAX)
+    return "bad super block";
+  if (firstDataBlock > src->nblocks)
+    return "super block larger than the image";
+  return NULL;
+}
+
+/*
+Replay the log of an image xv6 left behind mid-transaction, the way the
+kernel does at boot: the header, in the first of the last nlog blocks,
+names the home block of each committed block that follows it. Nothing is
+copied; the source reads those home blocks from the log from now on. A
+block logged twice replays its last copy. Returns why the log cannot be
+replayed, or NULL.
+*/
+static const char *replayLog(struct blocksource *src, struct superblock *sb) {
+  int hdr[NINDIRECT];
+  const struct logheader *lh;
+  struct loggedblock *logged;
+  uint64_t dataBlockEnd = BBLOCK(0, (uint64_t)sb->ninodes) + sb->size/BPB + 1 + sb->nblocks;
+  uint logStart, i, n = 0;
+
+  if (sb->nlog == 0)
+    return NULL;
+  // the log follows the data blocks, a header and at least one block
+  if (sb->nlog < 2 || sb->nlog > sb->size || dataBlockEnd > sb->size - sb->nlog)
+    return "bad log header";
+  logStart = sb->size - sb->nlog;
+  lh = sourceBlocks(src, logStart, 1, hdr);
+  if (lh->n == 0)
+    return NULL;
+  if (lh->n < 0 || (uint)lh->n >= sb->nlog || (uint)lh->n >= NINDIRECT)
+    return "bad log header";
+
+  logged = malloc(lh->n * sizeof(struct loggedblock));
+  if (logged == NULL) {
+    perror("log");
+    exit(1);
+  }
+  for (i = 0; i < (uint)lh->n; i++) {
+    uint home = lh->sector[i];  // a negative one wraps past logStart
+    if (home < IBLOCK(0) || home >= logStart) {
+      free(logged);
+      return "bad log header";
+    }
+    logged[i] = (struct loggedblock){ home, logStart + 1 + i };
+  }
+  // by home block, and of the copies of one home the last one
+  qsort(logged, lh->n, sizeof(struct loggedblock), compareLogged);
+  for (i = 0; i < (uint)lh->n; i++)
+    if (i + 1 == (uint)lh->n || logged[i + 1].home != logged[i].home)
+      logged[n++] = logged[i];
+  sourceOverlay(src, logged, n);
+  return NULL;
+}
+
+static int compareLogged(const void *a, const void *b) {
+  const struct loggedblock *x = a, *y = b;
+
+  if (x->home != y->home)
+    return (x->home > y->home) - (x->home < y->home);
+  return (x->copy > y->copy) - (x->copy < y->copy);
+}
+
+// whether an inode has an address in exactly the slots its size needs, and
+// its size fits them
+static bool probeLayout(const struct dinode *dip) {
+  uint64_t nblocks = ((uint64_t)dip->size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+  uint j;
+
+  if (nblocks > MAXFILE)
+    return false;
+
+  for (j = 0; j < NADDRS; j++)
+    if ((dip->addrs[j] != 0) != (nblocks > slotFileBlock(j)))
+      return false;
+  return true;
+}
+
+/*
+Walk the inode table once. Every inode feeds the per-inode rules directly,
+and the blocks of every directory are decoded once, into the directory
+index, while the inode is visited. Rules that need the whole image (5, 6,
+and the namespace rules) are finished from the collected state afterwards,
+without touching the image again.
+
+With more than one thread the inode table is cut into chunks that idle
+threads claim from a shared cursor. Cross-inode state is updated with
+atomic operations; errors and directory entries are kept per thread and
+merged at the end, preferring the lowest inode so the report does not
+depend on scheduling.
+
+The errors go to rp: every error when collecting all of them, otherwise
+only the one the first failing rule would have stopped on. Returns 1 if
+the image has errors, 0 if not.
+*/
+static int checkImage(struct blocksource *src, struct superblock *sb, struct checkopts *opts,
+                      struct report *rp) {
+  int t, nthreads = opts->nthreads;
+  uint i;
+  size_t k;
+  bool clean = true;
+  struct checkstate cs;
+  struct checkshard *shards, result;
+  struct unitlog log = { 0 };
+  struct manifest m;
+  pthread_t *threads;
+
+  // with -M, an image that changed little since its last clean check is
+  // checked from the manifest; anything else falls through to a full check
+  if (opts->manifestPath != NULL && manifestOpen(&m, opts->manifestPath) == 0) {
+    initCheck(&cs, src, sb, opts);
+    t = recheckImage(&cs, &m, opts, rp);
+    manifestClose(&m);
+    if (t == 0 && cs.fp != NULL)
+      fingerprintImage(&cs, opts, rp);
+    freeCheck(&cs);
+    if (t == 0)
+      return 0;
+  }
+
+  initCheck(&cs, src, sb, opts);
+
+  // iterate through all inodes, once
+  shards = scratchAlloc(cs.scratch, nthreads * sizeof(struct checkshard));
+  threads = scratchAlloc(cs.scratch, nthreads * sizeof(pthread_t));
+  for (t = 0; t < nthreads; t++)
+    initShard(&cs, &shards[t]);
+  if (opts->prefetch) {
+    struct statcounts counts = { 0 };
+    STAT_BEGIN(opts->stats);
+    prefetchBlocks(&cs, shards[0].inodeBuf, &counts);
+    STAT_END(opts->stats, STAT_PREFETCH, &counts);
+  }
+  STAT_BEGIN(opts->stats);
+  for (t = 1; t < nthreads; t++) {
+    if (pthread_create(&threads[t], NULL, scanInodes, &shards[t]) != 0) {
+      perror("pthread_create");
+      exit(1);
+    }
+  }
+  scanInodes(&shards[0]);
+  for (t = 1; t < nthreads; t++)
+    pthread_join(threads[t], NULL);
+#ifdef FCHECK_STATS
+  if (opts->stats) {
+    struct statcounts counts = { 0 };
+    for (t = 0; t < nthreads; t++) {
+      counts.inodes += shards[t].counts.inodes;
+      counts.dirents += shards[t].counts.dirents;
+      counts.indirect += shards[t].counts.indirect;
+      counts.bytes += shards[t].counts.bytes;
+    }
+    STAT_END(opts->stats, STAT_SCAN, &counts);
+  }
+#endif
+  if (cs.fp != NULL) {
+    STAT_BEGIN(opts->stats);
+    fingerprintFinish(cs.fp, src, shards[0].pieceBuf, &rp->digests);
+    STAT_END(opts->stats, STAT_DIGEST, (&(struct statcounts){ 0 }));
+  }
+
+  // merge the errors, directory entries and block conflicts of all threads
+  memset(&result, 0, sizeof(result));
+  result.cs = &cs;
+  result.report.scratch = cs.scratch;
+  result.conflicts.scratch = cs.scratch;
+  for (t = 0; t < nthreads; t++) {
+    for (i = 0; i < NPHASE; i++)
+      if (shards[t].first[i].error != NULL)
+        keepFirstError(&result, i, &shards[t].first[i]);
+    reportMerge(&result.report, &shards[t].report);
+    for (k = 0; k < shards[t].conflicts.count; k++)
+      uselistAdd(&result.conflicts, shards[t].conflicts.uses[k].block,
+                 shards[t].conflicts.uses[k].inum, shards[t].conflicts.uses[k].indirect);
+    scratchFree(cs.scratch, shards[t].conflicts.uses);
+    dirindexMerge(&cs.index, &shards[t].index);
+    unitlogAppend(&log, shards[t].log.deps, shards[t].log.ndeps, shards[t].log.owned,
+                  shards[t].log.nowned);
+    unitlogFree(&shards[t].log);
+    scratchFree(cs.scratch, shards[t].inodeBuf);
+    scratchFree(cs.scratch, shards[t].dirBuf);
+    free(shards[t].pieceBuf);
+    free(shards[t].pieceScratch);
+  }
+  if (cs.blockOwner != NULL)
+    reportConflicts(&cs, &result, &result.conflicts);
+
+  validateGlobal(&cs, &result, opts);
+
+  // only a clean image is worth a manifest
+  for (i = 0; i < NPHASE; i++)
+    if (result.first[i].error != NULL)
+      clean = false;
+  if (cs.record && clean && src->readErrors == 0) {
+    unitlogSort(&log);
+    saveManifest(&cs, &log, opts->manifestPath);
+  }
+  finishCheck(&cs, &result, opts, rp);
+
+  unitlogFree(&log);
+  scratchFree(cs.scratch, shards);
+  scratchFree(cs.scratch, threads);
+  freeCheck(&cs);
+
+  return rp->count > 0;
+}
+
+// geometry of the image and empty rule state
+static void initCheck(struct checkstate *cs, struct blocksource *src, struct superblock *sb,
+                      struct checkopts *opts) {
+  uint i, bitmapStart, bitmapBlocks;
+
+  memset(cs, 0, sizeof(*cs));
+  cs->src = src;
+  cs->sb = sb;
+  cs->imageBlocks = src->nblocks;
+  cs->threaded = opts->nthreads > 1;
+  cs->collectAll = opts->collectAll;
+  cs->scratch = opts->scratch;
+  cs->rules = opts->rules;
+  cs->index.scratch = opts->scratch;
+  // the bitmap follows the inode blocks and has a bit for every block of the
+  // image, data blocks follow the bitmap (same layout as mkfs)
+  cs->firstDataBlock = BBLOCK(0, sb->ninodes) + sb->size/BPB + 1;
+  cs->dataBlockEnd = cs->firstDataBlock + sb->nblocks;
+  bitmapStart = BBLOCK(0, sb->ninodes);
+  bitmapBlocks = (BITSET_WORDS(cs->dataBlockEnd) * sizeof(bitword) + BLOCK_SIZE - 1) / BLOCK_SIZE;
+  if (!sourceInMap(src, bitmapStart, bitmapBlocks))
+    cs->bitmapBuf = scratchAlloc(cs->scratch, (size_t)bitmapBlocks * BLOCK_SIZE);
+  cs->bitmapBlock = sourceBlocks(src, bitmapStart, bitmapBlocks, cs->bitmapBuf);
+  cs->scanDirents = dirscanKernel();
+
+  // one bit per block and per inode, 16 bit counters for link counts
+  cs->isBlockUsed = checkBitset(cs, cs->dataBlockEnd);
+  cs->isBlockReferenced = checkBitset(cs, cs->dataBlockEnd);
+  if (cs->collectAll) {
+    cs->blockOwner = scratchCalloc(cs->scratch, ((size_t)sb->nblocks + 1) * sizeof(uint));
+    cs->isOwnerIndirect = checkBitset(cs, sb->nblocks);
+  }
+  cs->isInodeInUse = checkBitset(cs, sb->ninodes);
+  cs->isInodeFile = checkBitset(cs, sb->ninodes);
+  cs->isInodeDir = checkBitset(cs, sb->ninodes);
+  cs->inodeNlink = checkCounters(cs, sb->ninodes);
+
+  if (opts->manifestPath != NULL) {
+    cs->record = true;
+    cs->nunits = (sb->ninodes + IPB - 1) / IPB;
+    cs->unitHash = calloc(cs->nunits + 1, sizeof(uint64_t));
+    if (cs->unitHash == NULL) {
+      perror("calloc");
+      exit(1);
+    }
+  }
+
+  if (opts->fingerprint) {
+    // regions in block order, cut short by the end of the image
+    uint start[NREGION + 1] = { 0, 2, bitmapStart, cs->firstDataBlock, cs->imageBlocks };
+    for (i = 1; i <= NREGION; i++) {
+      if (start[i] > cs->imageBlocks)
+        start[i] = cs->imageBlocks;
+      if (start[i] < start[i - 1])
+        start[i] = start[i - 1];
+    }
+    cs->fp = malloc(sizeof(struct fingerprint));
+    if (cs->fp == NULL) {
+      perror("malloc");
+      exit(1);
+    }
+    fingerprintInit(cs->fp, start, BLOCK_SIZE);
+  }
+}
+
+static void initShard(struct checkstate *cs, struct checkshard *sh) {
+  memset(sh, 0, sizeof(*sh));
+  sh->cs = cs;
+  sh->report.scratch = cs->scratch;
+  sh->index.scratch = cs->scratch;
+  sh->conflicts.scratch = cs->scratch;
+  // also needed when mapped, for blocks that run past the end of the image
+  sh->inodeBuf = scratchAlloc(cs->scratch, INODE_CHUNK * sizeof(struct dinode));
+  sh->dirBuf = scratchAlloc(cs->scratch, BLOCK_SIZE);
+  if (cs->fp != NULL) {
+    sh->pieceBuf = malloc(FP_PIECE_BYTES);
+    sh->pieceScratch = malloc(FP_PIECE_BYTES / BLAKE3_CHUNK_LEN * 8 * sizeof(uint32_t));
+    if (sh->pieceBuf == NULL || sh->pieceScratch == NULL) {
+      perror("malloc");
+      exit(1);
+    }
+  }
+}
+
+// bitsetAlloc and counterAlloc, from the arena of the check
+static bitword *checkBitset(struct checkstate *cs, uint64_t nbits) {
+  return scratchCalloc(cs->scratch, (BITSET_WORDS(nbits) + 1) * sizeof(bitword));
+}
+
+static uint16_t *checkCounters(struct checkstate *cs, uint64_t n) {
+  return scratchCalloc(cs->scratch, (n + 1) * sizeof(uint16_t));
+}
+
+// the rules that need the state of the whole image
+static void validateGlobal(struct checkstate *cs, struct checkshard *result,
+                           struct checkopts *opts) {
+  STAT_BEGIN(opts->stats);
+  if (rulesEnabled(cs, 1u << 5 | 1u << 6))
+    validateBitmap(cs, result);
+  STAT_END(opts->stats, STAT_BITMAP,
+           (&(struct statcounts){ .bytes = BITSET_WORDS(cs->dataBlockEnd) * sizeof(bitword) }));
+  STAT_BEGIN(opts->stats);
+  if (rulesEnabled(cs, 1u << 3 | 1u << 4 | 0xfu << 9))
+    validateNamespace(cs, result);
+  if (rulesEnabled(cs, 1u << 13 | 1u << 14) || opts->treePath != NULL)
+    validateTree(cs, result, opts);
+  STAT_END(opts->stats, STAT_NAMESPACE,
+           (&(struct statcounts){ .inodes = cs->sb->ninodes, .dirents = cs->index.count }));
+}
+
+// dump the index if asked to, and move the errors to rp
+static void finishCheck(struct checkstate *cs, struct checkshard *result, struct checkopts *opts,
+                        struct report *rp) {
+  uint i;
+
+  if (opts->indexPath != NULL) {
+    FILE *f = fopen(opts->indexPath, "w");
+    if (f == NULL) {
+      perror(opts->indexPath);
+      exit(1);
+    }
+    dirindexSort(&cs->index);
+    dirindexDump(f, &cs->index);
+    fclose(f);
+  }
+
+  if (cs->collectAll) {
+    reportMerge(rp, &result->report);
+    reportSort(rp);
+  } else {
+    // report the error the first failing rule would have stopped on
+    for (i = 0; i < NPHASE; i++) {
+      if (result->first[i].error != NULL) {
+        reportAdd(rp, &result->first[i]);
+        break;
+      }
+    }
+  }
+  reportFree(&result->report);
+}
+
+static void freeCheck(struct checkstate *cs) {
+  scratchFree(cs->scratch, cs->bitmapBuf);
+  scratchFree(cs->scratch, cs->isBlockUsed);
+  scratchFree(cs->scratch, cs->isBlockReferenced);
+  scratchFree(cs->scratch, cs->blockOwner);
+  scratchFree(cs->scratch, cs->isOwnerIndirect);
+  scratchFree(cs->scratch, cs->isInodeInUse);
+  scratchFree(cs->scratch, cs->isInodeFile);
+  scratchFree(cs->scratch, cs->isInodeDir);
+  scratchFree(cs->scratch, cs->inodeNlink);
+  free(cs->unitHash);
+  if (cs->fp != NULL)
+    fingerprintFree(cs->fp);
+  free(cs->fp);
+  dirindexFree(&cs->index);
+}
+
+/*
+Check the image against the manifest of its last clean check. Every block
+the check reads is hashed, and a unit (an inode table block) is dirty when
+its own block or any directory or indirect block its inodes led to has
+changed. The block sets and the directory index start out as the manifest
+left them, minus what dirty units had marked, and only the inodes of dirty
+units are visited again; the bitmap and namespace rules then run on the
+whole state as usual.
+
+Returns 0 if the image is clean, and updates the manifest. Returns -1 if
+the manifest does not describe the image or the image has errors: which
+error gets reported depends on the order the inodes are visited in, so
+the full check has to find it.
+*/
+static int recheckImage(struct checkstate *cs, struct manifest *m, struct checkopts *opts,
+                        struct report *rp) {
+  struct checkshard sh, result;
+  struct unitlog log = { 0 };
+  struct statcounts counts = { 0 };
+  const struct dinode *inodes;
+  const struct dirindexent *ents = m->index;
+  bitword *dirty;
+  uint u, i, ninodes = cs->sb->ninodes;
+  uint64_t k, e, end, ndirty = 0;
+  size_t d = 0, o = 0, d0, o0;
+  int r = -1;
+
+  if (m->h.size != cs->sb->size || m->h.nblocks != cs->sb->nblocks ||
+      m->h.ninodes != ninodes || m->h.imageBlocks != cs->imageBlocks ||
+      m->h.blockSize != BLOCK_SIZE || m->h.ndirect != NDIRECT ||
+      m->h.nunits != cs->nunits ||
+      m->h.nwords != BITSET_WORDS(cs->dataBlockEnd))
+    return -1;
+
+  dirty = bitsetAlloc(cs->nunits);
+  initShard(cs, &sh);
+  STAT_BEGIN(opts->stats);
+  hashInodeTable(cs, m, dirty, sh.inodeBuf, &counts);
+  if (verifyDeps(cs, m, dirty, &counts) != 0)
+    goto out;
+
+  // block sets of the clean units, as the manifest has them
+  memcpy(cs->isBlockUsed, m->used, m->h.nwords * sizeof(bitword));
+  memcpy(cs->isBlockReferenced, m->referenced, m->h.nwords * sizeof(bitword));
+  for (u = 0; u < cs->nunits; u++) {
+    if (!bitsetTest(dirty, u))
+      continue;
+    ndirty++;
+    for (k = m->ownStart[u]; k < m->ownStart[u + 1]; k++) {
+      const struct mown *own = &m->owned[k];
+      if (own->block >= cs->dataBlockEnd)
+        goto out;
+      if (own->kind & MOWN_USED)
+        bitsetClear(cs->isBlockUsed, own->block);
+      // below the data blocks several inodes may reference the same block,
+      // keeping the bit can only cost a full check
+      if ((own->kind & MOWN_REFERENCED) && own->block >= cs->firstDataBlock)
+        bitsetClear(cs->isBlockReferenced, own->block);
+    }
+  }
+
+  // dirents of the clean directories, in runs
+  for (e = 0; e < m->h.nindex; e = end) {
+    bool keep;
+    if (ents[e].parent >= ninodes || ents[e].child >= ninodes)
+      goto out;
+    keep = !bitsetTest(dirty, ents[e].parent / IPB);
+    for (end = e + 1; end < m->h.nindex && ents[end].parent < ninodes &&
+         !bitsetTest(dirty, ents[end].parent / IPB) == keep; end++)
+      ;
+    if (keep)
+      dirindexAppend(&cs->index, &ents[e], end - e);
+  }
+
+  // visit the inodes of the dirty units again
+  for (u = 0; u < cs->nunits; u++) {
+    if (!bitsetTest(dirty, u))
+      continue;
+    inodes = sourceBlocks(cs->src, IBLOCK(u * IPB), 1, sh.inodeBuf);
+    for (i = u * IPB; i < ninodes && i < (u + 1) * IPB; i++)
+      visitInode(cs, &sh, i, &inodes[i - u * IPB]);
+  }
+  STAT_COUNT(&counts, inodes, ndirty * IPB);
+#ifdef FCHECK_STATS
+  counts.dirents += sh.counts.dirents;
+  counts.indirect += sh.counts.indirect;
+  counts.bytes += sh.counts.bytes;
+#endif
+  STAT_END(opts->stats, STAT_SCAN, &counts);
+
+  memset(&result, 0, sizeof(result));
+  result.cs = cs;
+  for (i = 0; i < NPHASE; i++)
+    if (sh.first[i].error != NULL)
+      keepFirstError(&result, i, &sh.first[i]);
+  dirindexMerge(&cs->index, &sh.index);
+  validateGlobal(cs, &result, opts);
+  for (i = 0; i < NPHASE; i++)
+    if (result.first[i].error != NULL)
+      goto out;
+
+  // new manifest: records of clean units from the old one, in unit order
+  if (ndirty > 0 && cs->src->readErrors == 0) {
+    unitlogSort(&sh.log);
+    for (u = 0; u < cs->nunits; u++) {
+      if (bitsetTest(dirty, u)) {
+        for (d0 = d; d < sh.log.ndeps && sh.log.deps[d].unit == u; d++)
+          ;
+        for (o0 = o; o < sh.log.nowned && sh.log.owned[o].unit == u; o++)
+          ;
+        unitlogAppend(&log, &sh.log.deps[d0], d - d0, &sh.log.owned[o0], o - o0);
+      } else
+        unitlogAppend(&log, &m->deps[m->depStart[u]], m->depStart[u + 1] - m->depStart[u],
+                      &m->owned[m->ownStart[u]], m->ownStart[u + 1] - m->ownStart[u]);
+    }
+    saveManifest(cs, &log, opts->manifestPath);
+  }
+  finishCheck(cs, &result, opts, rp);
+  r = 0;
+
+out:
+  unitlogFree(&sh.log);
+  unitlogFree(&log);
+  dirindexFree(&sh.index);
+  reportFree(&sh.report);
+  scratchFree(cs->scratch, sh.inodeBuf);
+  scratchFree(cs->scratch, sh.dirBuf);
+  free(sh.pieceBuf);
+  free(sh.pieceScratch);
+  free(dirty);
+  return r;
+}
+
+// hash every inode table block and mark the units that changed, note the
+// type and link count of every inode. buf holds INODE_CHUNK inodes.
+static void hashInodeTable(struct checkstate *cs, struct manifest *m, bitword *dirty,
+                           struct dinode *buf, struct statcounts *counts) {
+  const struct dinode *inodes;
+  uint i, u, first, last, ninodes = cs->sb->ninodes;
+
+  (void) counts;  // only counted with FCHECK_STATS
+  for (first = 0; first < ninodes; first = last) {
+    last = ninodes - first < INODE_CHUNK ? ninodes : first + INODE_CHUNK;
+    if (last < ninodes)
+      sourceWillNeed(cs->src, IBLOCK(last), READAHEAD_CHUNKS * INODE_CHUNK / IPB);
+    inodes = sourceBlocks(cs->src, IBLOCK(first), (last - first + IPB - 1) / IPB, buf);
+    STAT_COUNT(counts, bytes, (last - first + IPB - 1) / IPB * BLOCK_SIZE);
+    for (u = first / IPB; u * IPB < last; u++) {
+      cs->unitHash[u] = manifestHash(&inodes[u * IPB - first], BLOCK_SIZE);
+      if (cs->unitHash[u] != m->unitHash[u])
+        bitsetSet(dirty, u);
+    }
+    for (i = first; i < last; i++)
+      noteInode(cs, i, &inodes[i - first]);
+  }
+}
+
+static int compareDepBlocks(const void *a, const void *b) {
+  const struct mdep *x = a, *y = b;
+  return (x->block > y->block) - (x->block < y->block);
+}
+
+// hash the directory and indirect blocks of the units still clean, in
+// address order, and mark the units whose blocks changed. Returns -1 if
+// the manifest asks for reads the check would not make.
+static int verifyDeps(struct checkstate *cs, struct manifest *m, bitword *dirty,
+                      struct statcounts *counts) {
+  struct mdep *deps;
+  struct blocklist blocks = { 0 };
+  size_t n = 0, k, next;
+  uint64_t j;
+  uint u;
+  int r = 0;
+  char *extent;
+
+  (void) counts;  // only counted with FCHECK_STATS
+  deps = malloc((m->h.ndeps + 1) * sizeof(struct mdep));
+  extent = malloc((size_t)VERIFY_EXTENT * BLOCK_SIZE);
+  if (deps == NULL || extent == NULL) {
+    perror("malloc");
+    exit(1);
+  }
+  for (u = 0; u < cs->nunits; u++) {
+    if (bitsetTest(dirty, u))
+      continue;
+    for (j = m->depStart[u]; j < m->depStart[u + 1]; j++) {
+      deps[n] = m->deps[j];
+      deps[n++].unit = u;
+    }
+  }
+  qsort(deps, n, sizeof(struct mdep), compareDepBlocks);
+  for (k = 0; k < n; k++)
+    if (k == 0 || deps[k].block != deps[k - 1].block)
+      blocklistAdd(&blocks, deps[k].block);
+  sourceWillNeedList(cs->src, blocks.blocks, blocks.count);
+
+  for (k = 0; k < n; k++) {
+    if (deps[k].nblocks != 1) {
+      r = -1;
+      goto out;
+    }
+  }
+
+  // blocks close together are read at once, which the scan in inode order
+  // cannot do
+  for (k = 0; k < n; k = next) {
+    const char *p;
+    uint start = deps[k].block, end = start + deps[k].nblocks;
+    for (next = k + 1; next < n && deps[next].block <= end + VERIFY_GAP; next++) {
+      uint depEnd = deps[next].block + deps[next].nblocks;
+      if ((depEnd > end ? depEnd : end) - start > VERIFY_EXTENT)
+        break;
+      if (depEnd > end)
+        end = depEnd;
+    }
+    p = sourceBlocks(cs->src, start, end - start, extent);
+    STAT_COUNT(counts, bytes, (uint64_t)(end - start) * BLOCK_SIZE);
+    for (j = k; j < next; j++)
+      if (manifestHash(p + (size_t)(deps[j].block - start) * BLOCK_SIZE,
+                       (size_t)deps[j].nblocks * BLOCK_SIZE) != deps[j].hash)
+        bitsetSet(dirty, deps[j].unit);
+  }
+
+out:
+  free(blocks.blocks);
+  free(deps);
+  free(extent);
+  return r;
+}
+
+// write the manifest of a clean check, a failure only costs the next check
+static void saveManifest(struct checkstate *cs, struct unitlog *log, const char *path) {
+  struct manifestheader h = {
+    .size = cs->sb->size, .nblocks = cs->sb->nblocks, .ninodes = cs->sb->ninodes,
+    .imageBlocks = cs->imageBlocks, .blockSize = BLOCK_SIZE, .ndirect = NDIRECT,
+    .nunits = cs->nunits,
+    .nwords = BITSET_WORDS(cs->dataBlockEnd)
+  };
+
+  if (manifestWrite(path, &h, cs->unitHash, log, cs->isBlockUsed, cs->isBlockReferenced,
+                    &cs->index) != 0)
+    fprintf(stderr, "%s: cannot write manifest\n", path);
+}
+
+// -F after a check that did not scan the inode table: the scanning threads
+// find no inodes left and only hash the image
+static void fingerprintImage(struct checkstate *cs, struct checkopts *opts, struct report *rp) {
+  int t, nthreads = opts->nthreads;
+  struct checkshard *shards = calloc(nthreads, sizeof(struct checkshard));
+  pthread_t *threads = calloc(nthreads, sizeof(pthread_t));
+
+  if (shards == NULL || threads == NULL) {
+    perror("calloc");
+    exit(1);
+  }
+  STAT_BEGIN(opts->stats);
+  cs->nextInode = cs->sb->ninodes;
+  for (t = 0; t < nthreads; t++)
+    initShard(cs, &shards[t]);
+  for (t = 1; t < nthreads; t++) {
+    if (pthread_create(&threads[t], NULL, scanInodes, &shards[t]) != 0) {
+      perror("pthread_create");
+      exit(1);
+    }
+  }
+  scanInodes(&shards[0]);
+  for (t = 1; t < nthreads; t++)
+    pthread_join(threads[t], NULL);
+  fingerprintFinish(cs->fp, cs->src, shards[0].pieceBuf, &rp->digests);
+#ifdef FCHECK_STATS
+  if (opts->stats) {
+    struct statcounts counts = { 0 };
+    for (t = 0; t < nthreads; t++)
+      counts.bytes += shards[t].counts.bytes;
+    STAT_END(opts->stats, STAT_DIGEST, &counts);
+  }
+#endif
+  for (t = 0; t < nthreads; t++) {
+    scratchFree(cs->scratch, shards[t].inodeBuf);
+    scratchFree(cs->scratch, shards[t].dirBuf);
+    free(shards[t].pieceBuf);
+    free(shards[t].pieceScratch);
+  }
+  free(shards);
+  free(threads);
+}
+
+// report an error about an inode and, if not NOVALUE, one of its blocks
+static void reportError(struct checkshard *sh, int phase, int rule, long inum, long block,
+                        const char *error) {
+  struct diagnostic d = { .rule = rule, .inum = inum, .block = block,
+                          .dirInum = NOVALUE, .slot = NOVALUE, .error = error };
+  addError(sh, phase, &d);
+}
+
+// report an error about entry slot of directory dirInum
+static void reportDirentError(struct checkshard *sh, int phase, int rule, uint dirInum, long slot,
+                              const struct dirent *de, const char *error) {
+  struct diagnostic d = { .rule = rule, .inum = de->inum, .block = NOVALUE,
+                          .dirInum = dirInum, .slot = slot, .error = error };
+  memcpy(d.name, de->name, DIRSIZ);
+  d.name[DIRSIZ] = '\0';
+  addError(sh, phase, &d);
+}
+
+// keep the first error of every rule group, and every error if asked to
+static void addError(struct checkshard *sh, int phase, const struct diagnostic *d) {
+  if (!rulesEnabled(sh->cs, 1u << d->rule))
+    return;
+  keepFirstError(sh, phase, d);
+  if (sh->cs->collectAll)
+    reportAdd(&sh->report, d);
+}
+
+// whether any of the rules (bit r for rule r) is checked
+static bool rulesEnabled(struct checkstate *cs, uint rules) {
+  return cs->rules == 0 || (cs->rules & rules) != 0;
+}
+
+// the first error of a group is the one at the lowest inode, or block
+static void keepFirstError(struct checkshard *sh, int phase, const struct diagnostic *d) {
+  struct diagnostic *first = &sh->first[phase];
+  long key = d->inum != NOVALUE ? d->inum : d->block;
+
+  if (first->error == NULL || key < (first->inum != NOVALUE ? first->inum : first->block))
+    *first = *d;
+}
+
+/*
+Two-phase I/O: before the scan, collect the address of every block the scan
+will read outside the inode table and ask for them in ascending order, so
+that a cold image is read in a few forward sweeps instead of in inode order.
+Indirect blocks come first, from the highest level of indirection down: the
+blocks below a doubly or triply indirect block, and the blocks of
+directories that have an indirect one, are only known once it is in, so
+they are asked for in the following rounds. The scan then finds the blocks
+in the page cache. buf holds INODE_CHUNK inodes, the work done is counted
+in counts for --stats.
+*/
+static void prefetchBlocks(struct checkstate *cs, struct dinode *buf, struct statcounts *counts) {
+  // indirect blocks by height, and those of directories again
+  struct blocklist indirect[WALK_HEIGHT + 1] = { 0 }, dirIndirect[WALK_HEIGHT + 1] = { 0 };
+  struct blocklist dirData = { 0 };
+  struct blockwalk w;
+  struct blockref ref;
+  const struct dinode *inodes;
+  uint i, h, first, last;
+  size_t k;
+
+  for (first = 0; first < cs->sb->ninodes; first = last) {
+    last = cs->sb->ninodes - first < INODE_CHUNK ? cs->sb->ninodes : first + INODE_CHUNK;
+    inodes = sourceBlocks(cs->src, IBLOCK(first), (last - first + IPB - 1) / IPB, buf);
+    STAT_COUNT(counts, inodes, last - first);
+    STAT_COUNT(counts, bytes, (last - first + IPB - 1) / IPB * BLOCK_SIZE);
+    for (i = first; i < last; i++) {
+      const struct dinode *dip = &inodes[i - first];
+      if (dip->type != 1 && dip->type != 2 && dip->type != 3)
+        continue;
+      // the addresses in the inode, the walk does not descend
+      walkInode(&w, dip);
+      while (walkNext(&w, &ref)) {
+        if (ref.block >= cs->imageBlocks)
+          continue;
+        if (ref.height > 0) {
+          blocklistAdd(&indirect[ref.height], ref.block);
+          if (dip->type == 1)
+            blocklistAdd(&dirIndirect[ref.height], ref.block);
+        } else if (dip->type == 1)
+          blocklistAdd(&dirData, ref.block);
+      }
+    }
+  }
+
+  for (h = WALK_HEIGHT; h > 0; h--) {
+    sourceWillNeedList(cs->src, indirect[h].blocks, indirect[h].count);
+    // what lies below a block of more than one level is read by the scan
+    // whatever the file
+    if (h > 1)
+      for (k = 0; k < indirect[h].count; k++)
+        prefetchChildren(cs, indirect[h].blocks[k], buf, &indirect[h - 1], counts);
+    // read the indirect blocks of directories in address order, they are
+    // already on their way, asking again only sorts the list
+    sourceWillNeedList(cs->src, dirIndirect[h].blocks, dirIndirect[h].count);
+    for (k = 0; k < dirIndirect[h].count; k++)
+      prefetchChildren(cs, dirIndirect[h].blocks[k], buf, h > 1 ? &dirIndirect[h - 1] : &dirData,
+                       counts);
+    free(indirect[h].blocks);
+    free(dirIndirect[h].blocks);
+  }
+  sourceWillNeedList(cs->src, dirData.blocks, dirData.count);
+
+  free(dirData.blocks);
+}
+
+// read indirect block block into buf and add the addresses in it to bl
+static void prefetchChildren(struct checkstate *cs, uint block, void *buf, struct blocklist *bl,
+                             struct statcounts *counts) {
+  const uint *ind = sourceBlocks(cs->src, block, 1, buf);
+  uint j;
+
+  (void) counts;  // only counted with FCHECK_STATS
+  STAT_COUNT(counts, indirect, 1);
+  STAT_COUNT(counts, bytes, BLOCK_SIZE);
+  for (j = 0; j < NINDIRECT; j++)
+    if (ind[j] != 0 && ind[j] < cs->imageBlocks)
+      blocklistAdd(bl, ind[j]);
+}
+
+static void blocklistAdd(struct blocklist *bl, uint block) {
+  if (bl->count == bl->capacity) {
+    size_t capacity = bl->capacity ? bl->capacity * 2 : 256;
+    bl->blocks = scratchRealloc(bl->scratch, bl->blocks, bl->capacity * sizeof(uint),
+                                capacity * sizeof(uint));
+    bl->capacity = capacity;
+  }
+  bl->blocks[bl->count++] = block;
+}
+
+// claim chunks of the inode table until all inodes are visited
+static void *scanInodes(void *arg) {
+  struct checkshard *sh = arg;
+  struct checkstate *cs = sh->cs;
+  const struct dinode *inodes;
+  uint i, u, first, last;
+
+  for (;;) {
+    first = __atomic_fetch_add(&cs->nextInode, INODE_CHUNK, __ATOMIC_RELAXED);
+    if (first >= cs->sb->ninodes)
+      break;
+    last = cs->sb->ninodes - first < INODE_CHUNK ? cs->sb->ninodes : first + INODE_CHUNK;
+    // the chunks after this one are next, for any thread
+    if (last < cs->sb->ninodes)
+      sourceWillNeed(cs->src, IBLOCK(last), READAHEAD_CHUNKS * INODE_CHUNK / IPB);
+    inodes = sourceBlocks(cs->src, IBLOCK(first), (last - first + IPB - 1) / IPB, sh->inodeBuf);
+    STAT_COUNT(&sh->counts, inodes, last - first);
+    STAT_COUNT(&sh->counts, bytes, (last - first + IPB - 1) / IPB * BLOCK_SIZE);
+    if (cs->record)
+      for (u = first / IPB; u * IPB < last; u++)
+        cs->unitHash[u] = manifestHash(&inodes[u * IPB - first], BLOCK_SIZE);
+    for (i = first; i < last; i++)
+      visitInode(cs, sh, i, &inodes[i - first]);
+  }
+  // then help hash the image, the inodes being done
+  if (cs->fp != NULL)
+    while (fingerprintWork(cs->fp, cs->src, sh->pieceBuf, sh->pieceScratch))
+      STAT_COUNT(&sh->counts, bytes, FP_PIECE_BYTES);
+  return NULL;
+}
+
+// feed one inode to every rule
+static void visitInode(struct checkstate *cs, struct checkshard *sh, uint inum,
+                       const struct dinode *dip) {
+  struct blockwalk w;
+  struct blockref ref;
+  bool isDir;
+
+  if (dip->type == 0) // inode not in use
+    return;
+  if (!noteInode(cs, inum, dip)) {
+    /*
+    Rule 1:
+      Not one of the valid types (T_FILE, T_DIR, T_DEV).
+      print ERROR: bad inode.
+    */
+    reportError(sh, PHASE_RULE1, 1, inum, NOVALUE, "ERROR: bad inode.");
+    return;
+  }
+  isDir = (dip->type == 1);
+
+  walkInode(&w, dip);
+  while (walkNext(&w, &ref)) {
+    uint block = ref.block;
+    bool invalid = block < cs->firstDataBlock || block >= cs->dataBlockEnd;
+
+    // check direct blocks
+    if (ref.inInode && ref.height == 0) {
+      if (dip->size != 0 && invalid) {
+        /*
+        Rule 2:
+          If the direct block is used and is invalid, print
+          ERROR: bad direct address in inode.
+        */
+        reportError(sh, PHASE_RULE2, 2, inum, block, "ERROR: bad direct address in inode.");
+      }
+      // rule 5 only looks at direct blocks within valid range
+      if (!invalid)
+        markBlockReferenced(cs, sh, inum, block);
+      /*
+      Rule 7:
+        For in-use inodes, each direct address in use is only used once. If not,
+        print ERROR: direct address used more than once.
+      */
+      markBlockUsed(cs, sh, 7, inum, block, "ERROR: direct address used more than once.");
+      if (isDir)
+        visitDirBlock(cs, sh, inum, dip->size, ref.fileBlock, block);
+      continue;
+    }
+
+    // check indirect blocks, and the blocks they point to
+    if (dip->size != 0 && invalid) {
+      /*
+      Rule 2:
+        if the indirect block is in use and is invalid, print
+        ERROR: bad indirect address in inode.
+      */
+      reportError(sh, PHASE_RULE2, 2, inum, block, "ERROR: bad indirect address in inode.");
+    }
+    // rule 5 does not look at the indirect blocks of the inode itself
+    if (!ref.inInode)
+      markBlockReferenced(cs, sh, inum, block);
+    /*
+    Rule 8:
+      For in-use inodes, each indirect address in use is only used once. If not,
+      print ERROR: indirect address used more than once.
+    */
+    markBlockUsed(cs, sh, 8, inum, block, "ERROR: indirect address used more than once.");
+    if (ref.height == 0) {
+      if (isDir)
+        visitDirBlock(cs, sh, inum, dip->size, ref.fileBlock, block);
+    } else if (!invalid) {
+      // a bad indirect address is not followed, whatever block it names
+      const uint *addrs = sourceBlocks(cs->src, block, 1, sh->indBuf[w.depth]);
+      STAT_COUNT(&sh->counts, indirect, 1);
+      STAT_COUNT(&sh->counts, bytes, BLOCK_SIZE);
+      if (cs->record)
+        unitlogDep(&sh->log, inum / IPB, block, 1, manifestHash(addrs, BLOCK_SIZE));
+      walkDescend(&w, &ref, addrs);
+    }
+  }
+}
+
+// note the type and link count of an inode, false if the type is not valid
+static bool noteInode(struct checkstate *cs, uint inum, const struct dinode *dip) {
+  if (dip->type != 1 && dip->type != 2 && dip->type != 3)
+    return false;
+  bitsetSet(cs->isInodeInUse, inum);
+  if (dip->type == 1)
+    bitsetSet(cs->isInodeDir, inum);
+  if (dip->type == 2) {
+    bitsetSet(cs->isInodeFile, inum);
+    cs->inodeNlink[inum] = dip->nlink;
+  }
+  return true;
+}
+
+// start a walk over the addresses of an inode
+static inline void walkInode(struct blockwalk *w, const struct dinode *dip) {
+  w->depth = 0;
+  w->level[0].addrs = dip->addrs;
+  w->level[0].count = NADDRS;
+  w->level[0].next = 0;
+}
+
+// the next address in use, false once the walk is over
+static inline bool walkNext(struct blockwalk *w, struct blockref *ref) {
+  typeof(w->level[0]) *l;
+  uint j;
+
+  for (;;) {
+    l = &w->level[w->depth];
+    while (l->next < l->count && l->addrs[l->next] == 0)
+      l->next++;
+    if (l->next < l->count)
+      break;
+    if (w->depth == 0)
+      return false;
+    w->depth--;
+  }
+  j = l->next++;
+  ref->block = l->addrs[j];
+  ref->inInode = w->depth == 0;
+  if (ref->inInode) {
+    ref->height = slotHeight(j);
+    ref->fileBlock = slotFileBlock(j);
+  } else {
+    // every address of the level maps NINDIRECT^height blocks
+    ref->height = l->height - 1;
+    ref->fileBlock = l->fileBlock +
+                     j * (ref->height == 0 ? 1 : ref->height == 1 ? NINDIRECT : NINDIRECT * NINDIRECT);
+  }
+  return true;
+}
+
+// walk the addresses in indirect block ref, the one walkNext just gave,
+// before the addresses after it. addrs holds the block and must stay valid
+// until the walk leaves it.
+static inline void walkDescend(struct blockwalk *w, const struct blockref *ref, const uint *addrs) {
+  w->depth++;
+  w->level[w->depth].addrs = addrs;
+  w->level[w->depth].count = NINDIRECT;
+  w->level[w->depth].next = 0;
+  w->level[w->depth].height = ref->height;
+  w->level[w->depth].fileBlock = ref->fileBlock;
+}
+
+// levels of indirection below inode address slot
+static inline uint slotHeight(uint slot) {
+  if (slot < NDIRECT)
+    return 0;
+  if (slot == NDIRECT)
+    return 1;
+  return slot <= NDIRECT + NDINDIRECT ? 2 : 3;
+}
+
+// first file block mapped by inode address slot
+static inline uint slotFileBlock(uint slot) {
+  if (slot <= NDIRECT)
+    return slot;
+  if (slot <= NDIRECT + NDINDIRECT)
+    return NDIRECT + NINDIRECT + (slot - NDIRECT - 1) * NINDIRECT * NINDIRECT;
+  return NDIRECT + NINDIRECT + NDINDIRECT * NINDIRECT * NINDIRECT +
+         (slot - NDIRECT - 1 - NDINDIRECT) * NINDIRECT * NINDIRECT * NINDIRECT;
+}
+
+// the address of block fileBlock of an inode, 0 if it has none; the
+// indirect blocks on the way are read into buf
+static uint fileBlockAddress(struct blocksource *src, const struct dinode *dip, uint fileBlock,
+                             uint *buf) {
+  uint j, h, span, addr;
+  const uint *ind;
+
+  if (fileBlock < NDIRECT)
+    return dip->addrs[fileBlock];
+  if (fileBlock >= MAXFILE)
+    return 0;
+  for (j = NADDRS - 1; slotFileBlock(j) > fileBlock; j--)
+    ;
+  addr = dip->addrs[j];
+  fileBlock -= slotFileBlock(j);
+  for (h = slotHeight(j); h > 0 && addr != 0; h--) {
+    for (span = 1, j = 1; j < h; j++)
+      span *= NINDIRECT;
+    ind = sourceBlocks(src, addr, 1, buf);
+    addr = ind[fileBlock / span];
+    fileBlock %= span;
+  }
+  return addr;
+}
+
+// entries of block fileBlock of a directory of size bytes, the ones its
+// size covers
+static inline uint dirBlockEntries(uint size, uint fileBlock) {
+  uint64_t start = (uint64_t)fileBlock * BLOCK_SIZE;
+
+  if (size <= start)
+    return 0;
+  return size - start >= BLOCK_SIZE ? DPB : (size - start) / sizeof(struct dirent);
+}
+
+/*
+Add the entries in use of block fileBlock of a directory of size bytes to
+the directory index. How many entries of the block the directory holds
+comes from its own size, so a block past the end of a directory is not
+read, and the last one only as far as the size goes. The block is
+classified at once, which entries are in use and which are "." and "..",
+so only the entries in use are looked at one by one.
+*/
+static void visitDirBlock(struct checkstate *cs, struct checkshard *sh, uint inum, uint size,
+                          uint fileBlock, uint block) {
+  uint n = dirBlockEntries(size, fileBlock), w, k;
+  const struct dirent *de;
+  struct dirscan scan;
+
+  if (n == 0 || block >= cs->imageBlocks) // not in the image, caught by rule 2
+    return;
+  de = sourceBlocks(cs->src, block, 1, sh->dirBuf);
+  STAT_COUNT(&sh->counts, dirents, n);
+  STAT_COUNT(&sh->counts, bytes, BLOCK_SIZE);
+  if (cs->record)
+    unitlogDep(&sh->log, inum / IPB, block, 1, manifestHash(de, BLOCK_SIZE));
+  cs->scanDirents(de, &scan);
+  for (w = 0; w * WORDBITS < n; w++) {
+    bitword used = scan.used[w];
+    if (n - w * WORDBITS < WORDBITS)
+      used &= ((bitword)1 << (n - w * WORDBITS)) - 1;
+    for (; used; used &= used - 1) {
+      uint bit = __builtin_ctzll(used);
+      k = w * WORDBITS + bit;
+      if (de[k].inum >= cs->sb->ninodes) {
+        // inode number past the inode table can never be in use
+        reportDirentError(sh, PHASE_RULE10, 10, inum, fileBlock * DPB + k, &de[k],
+                          "ERROR: inode referred to in directory but marked free.");
+        continue;
+      }
+      dirindexAdd(&sh->index, inum, fileBlock * DPB + k, &de[k],
+                  (scan.dot[w] >> bit & 1 ? DE_DOT : 0) | (scan.dotdot[w] >> bit & 1 ? DE_DOTDOT : 0));
+    }
+  }
+}
+
+// Rule 5 checks the address against the bitmap once all inodes are visited.
+// When collecting all errors the bit is checked right away instead, which
+// is what ties the error to the inode.
+static void markBlockReferenced(struct checkstate *cs, struct checkshard *sh, uint inum,
+                                uint block) {
+  if (block >= cs->dataBlockEnd) // not covered by the bitmap, caught by rule 2
+    return;
+  if (cs->collectAll) {
+    if (!(cs->bitmapBlock[block / 8] & (1 << (block % 8))))
+      reportError(sh, PHASE_RULE5, 5, inum, block,
+                  "ERROR: address used by inode but marked free in bitmap.");
+  } else {
+    if (cs->threaded)
+      bitsetSetAtomic(cs->isBlockReferenced, block);
+    else
+      bitsetSet(cs->isBlockReferenced, block);
+    if (cs->record)
+      unitlogOwn(&sh->log, inum / IPB, block, MOWN_REFERENCED);
+  }
+}
+
+/*
+Mark a data block as used, rules 7 and 8 fire on the second use. When
+every error is wanted, the inode of the first use is kept in the owner
+map, claimed with a compare and swap so that the threads agree on it, and
+every later use is kept as a conflict; reportConflicts tells every inode
+sharing the block once the scan is done.
+*/
+static void markBlockUsed(struct checkstate *cs, struct checkshard *sh, int rule, uint inum,
+                          uint block, const char *dupError) {
+  uint none = 0;
+
+  // blocks outside the data area are caught by rule 2
+  if (block < cs->firstDataBlock || block >= cs->dataBlockEnd)
+    return;
+  if (cs->blockOwner != NULL) {
+    if (__atomic_compare_exchange_n(&cs->blockOwner[block - cs->firstDataBlock], &none, inum + 1,
+                                    false, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+      if (cs->threaded) {
+        bitsetSetAtomic(cs->isBlockUsed, block);
+        if (rule == 8)
+          bitsetSetAtomic(cs->isOwnerIndirect, block - cs->firstDataBlock);
+      } else {
+        bitsetSet(cs->isBlockUsed, block);
+        if (rule == 8)
+          bitsetSet(cs->isOwnerIndirect, block - cs->firstDataBlock);
+      }
+    } else
+      uselistAdd(&sh->conflicts, block, inum, rule == 8);
+    return;
+  }
+  if (cs->threaded ? bitsetTestAndSetAtomic(cs->isBlockUsed, block)
+                   : bitsetTestAndSet(cs->isBlockUsed, block)) // already used
+    reportError(sh, PHASE_RULE7_8, rule, inum, block, dupError);
+  else if (cs->record)
+    unitlogOwn(&sh->log, inum / IPB, block, MOWN_USED);
+}
+
+static void uselistAdd(struct uselist *ul, uint block, uint inum, bool indirect) {
+  if (ul->count == ul->capacity) {
+    size_t capacity = ul->capacity ? ul->capacity * 2 : 64;
+    ul->uses = scratchRealloc(ul->scratch, ul->uses, ul->capacity * sizeof(struct blockuse),
+                              capacity * sizeof(struct blockuse));
+    ul->capacity = capacity;
+  }
+  ul->uses[ul->count++] = (struct blockuse){ block, inum, indirect };
+}
+
+// by block, then inode, direct uses first
+static int compareUses(const void *a, const void *b) {
+  const struct blockuse *x = a, *y = b;
+
+  if (x->block != y->block)
+    return (x->block > y->block) - (x->block < y->block);
+  if (x->inum != y->inum)
+    return (x->inum > y->inum) - (x->inum < y->inum);
+  return (x->indirect > y->indirect) - (x->indirect < y->indirect);
+}
+
+/*
+Report every inode sharing a data block: the uses of each block, the
+conflicts and the one in the owner map, are ordered by inode, and every
+use but the first is an error of rule 7 (a direct address) or 8 (any
+other), which names the inode of the first use and how it used the
+block. Which use claimed the block depends on the threads, the lowest
+inode does not, so the report stays the same. Only the blocks used more
+than once are sorted.
+*/
+static void reportConflicts(struct checkstate *cs, struct checkshard *sh, struct uselist *ul) {
+  size_t k, end, j;
+
+  if (ul->count == 0) // no block is shared
+    return;
+  qsort(ul->uses, ul->count, sizeof(struct blockuse), compareUses);
+  for (k = 0; k < ul->count; k = end) {
+    uint b = ul->uses[k].block - cs->firstDataBlock;
+    struct blockuse owner = { ul->uses[k].block, cs->blockOwner[b] - 1,
+                              bitsetTest(cs->isOwnerIndirect, b) };
+    for (end = k + 1; end < ul->count && ul->uses[end].block == owner.block; end++)
+      ;
+    if (compareUses(&owner, &ul->uses[k]) <= 0) {
+      for (j = k; j < end; j++)
+        reportConflict(sh, &ul->uses[j], &owner);
+    } else {
+      reportConflict(sh, &owner, &ul->uses[k]);
+      for (j = k + 1; j < end; j++)
+        reportConflict(sh, &ul->uses[j], &ul->uses[k]);
+    }
+  }
+  scratchFree(cs->scratch, ul->uses);
+  ul->uses = NULL;
+  ul->count = ul->capacity = 0;
+}
+
+// report a use of a block owner made first
+static void reportConflict(struct checkshard *sh, const struct blockuse *use,
+                           const struct blockuse *owner) {
+  struct diagnostic d = { .rule = use->indirect ? 8 : 7, .inum = use->inum, .block = use->block,
+                          .dirInum = NOVALUE, .slot = NOVALUE, .owner = owner->inum,
+                          .ownerUse = owner->indirect ? "indirect" : "direct",
+                          .error = use->indirect ? "ERROR: indirect address used more than once."
+                                                 : "ERROR: direct address used more than once." };
+  addError(sh, PHASE_RULE7_8, &d);
+}
+
+/*
+Rule 5:
+  For in-use inodes, each block address in use is also marked in use in the
+  bitmap. If not, print ERROR: address used by inode but marked free in bitmap.
+
+Rule 6:
+  For blocks marked in-use in bitmap, the block should actually be in-use in an
+  inode or indirect block somewhere. If not, print ERROR: bitmap marks block
+  in use but it is not in use.
+
+Both rules compare the on-disk bitmap with the collected block sets in one
+pass, with the widest vector kernel available. Only words that differ are
+looked at bit by bit.
+*/
+static void validateBitmap(struct checkstate *cs, struct checkshard *sh) {
+  uint64_t w = 0;
+  uint64_t nwords = cs->dataBlockEnd / WORDBITS; // words fully inside the bitmap
+  const bitword *disk = (const bitword *) cs->bitmapBlock;
+  reconcilefn reconcile = reconcileKernel();
+
+  // blocks in front of the data blocks are in use by the file system itself
+  for (; w < cs->firstDataBlock / WORDBITS; w++)
+    cs->isBlockUsed[w] = ~(bitword)0;
+  if (cs->firstDataBlock % WORDBITS)
+    cs->isBlockUsed[w] |= ((bitword)1 << (cs->firstDataBlock % WORDBITS)) - 1;
+
+  for (w = 0; (w = reconcile(disk, cs->isBlockReferenced, cs->isBlockUsed, w, nwords)) < nwords; w++) {
+    reconcileWord(cs, sh, w, ~(bitword)0);
+    if (!cs->collectAll && sh->first[PHASE_RULE5].error != NULL &&
+        sh->first[PHASE_RULE6].error != NULL)
+      return;
+  }
+  if (cs->dataBlockEnd % WORDBITS)
+    reconcileWord(cs, sh, nwords, ((bitword)1 << (cs->dataBlockEnd % WORDBITS)) - 1);
+}
+
+// report the blocks of one bitmap word that break rule 5 or 6
+static void reconcileWord(struct checkstate *cs, struct checkshard *sh, uint64_t w, bitword mask) {
+  bitword onDisk = le64toh(((const bitword *) cs->bitmapBlock)[w]);
+  // address used by an inode, but marked free in the bitmap
+  bitword unmarked = cs->isBlockReferenced[w] & ~onDisk & mask;
+  // datablock is not used, but marked in bitmap as used
+  bitword unused = onDisk & ~cs->isBlockUsed[w] & mask;
+
+  // the first bit is enough unless every error is wanted
+  for (; unmarked; unmarked &= unmarked - 1) {
+    reportError(sh, PHASE_RULE5, 5, NOVALUE, w * WORDBITS + __builtin_ctzll(unmarked),
+                "ERROR: address used by inode but marked free in bitmap.");
+    if (!cs->collectAll)
+      break;
+  }
+  for (; unused; unused &= unused - 1) {
+    reportError(sh, PHASE_RULE6, 6, NOVALUE, w * WORDBITS + __builtin_ctzll(unused),
+                "ERROR: bitmap marks block in use but it is not in use.");
+    if (!cs->collectAll)
+      break;
+  }
+}
+
+/*
+Rule 3:
+  Root directory exists, its inode number is 1, and the parent of the root
+  directory is itself. If not, print ERROR: root directory does not exist.
+
+Rule 4:
+  Each directory contains . and .. entries, and the . entry points to
+  the directory itself. If not, print ERROR: directory not properly formatted.
+
+Rule 9:
+  For all inodes marked in use, each must be referred to in at least one
+  directory. If not, print ERROR: inode marked use but not found in a directory.
+
+Rule 10:
+  For each inode number that is referred to in a valid directory, it is
+  actually marked in use. If not, print ERROR: inode referred to in
+  directory but marked free.
+
+Rule 11:
+  Reference counts (number of links) for regular files match the number of
+  times file is referred to in directories (i.e., hard links work correctly).
+  If not, print ERROR: bad reference count for file.
+
+Rule 12:
+  No extra links allowed for directories (each directory only appears in one
+  other directory). If not, print ERROR: directory appears more than once
+  in file system.
+
+All of them are answered from the directory index: one pass over the
+entries collects what every inode needs, then one pass over the inodes
+checks it.
+*/
+static void validateNamespace(struct checkstate *cs, struct checkshard *sh) {
+  uint i, ninodes = cs->sb->ninodes;
+  size_t e;
+  bool rootDirInum = false, parentItself = false;
+  bitword *isInodeInDir = checkBitset(cs, ninodes);   // referenced by any dirent
+  bitword *hasDotToItself = checkBitset(cs, ninodes); // directory has . pointing to itself
+  bitword *hasDotDot = checkBitset(cs, ninodes);      // directory has ..
+  uint16_t *inodeRefCount = checkCounters(cs, ninodes); // references other than . and ..
+
+  for (e = 0; e < cs->index.count; e++) {
+    const struct dirindexent *de = &cs->index.ents[e];
+    bitsetSet(isInodeInDir, de->child);
+    if (de->flags & DE_DOT) {
+      if (de->child == de->parent)
+        bitsetSet(hasDotToItself, de->parent);
+    } else if (de->flags & DE_DOTDOT)
+      bitsetSet(hasDotDot, de->parent);
+    else
+      counterInc(inodeRefCount, de->child);
+    if (de->parent == ROOTINO) {
+      // the first entry of the root is inode 1, and so is its .. entry
+      // within the first block
+      if (de->slot == 0 && de->child == ROOTINO)
+        rootDirInum = true;
+      if ((de->flags & DE_DOTDOT) && de->slot < BLOCK_SIZE / sizeof(struct dirent) &&
+          de->child == ROOTINO)
+        parentItself = true;
+    }
+  }
+
+  if (!rootDirInum || !parentItself)
+    reportError(sh, PHASE_RULE3, 3, ROOTINO, NOVALUE, "ERROR: root directory does not exist.");
+
+  // iterate through the collected inode state
+  for (i = 0; i < ninodes; i++) {
+    bool inUse = bitsetTest(cs->isInodeInUse, i);
+    bool inDir = bitsetTest(isInodeInDir, i);
+    bool isDir = bitsetTest(cs->isInodeDir, i);
+    if (isDir && (!bitsetTest(hasDotToItself, i) || !bitsetTest(hasDotDot, i)))
+      reportError(sh, PHASE_RULE4, 4, i, NOVALUE, "ERROR: directory not properly formatted.");
+    if (inUse && !inDir) // used inode, but not found in a directory
+      reportError(sh, PHASE_RULE9, 9, i, NOVALUE, "ERROR: inode marked use but not found in a directory.");
+    if (!inUse && inDir) // inode is not used but found in directory
+      reportError(sh, PHASE_RULE10, 10, i, NOVALUE, "ERROR: inode referred to in directory but marked free.");
+    if (bitsetTest(cs->isInodeFile, i) && inodeRefCount[i] != cs->inodeNlink[i])
+      reportError(sh, PHASE_RULE11_12, 11, i, NOVALUE, "ERROR: bad reference count for file.");
+    if (isDir && inodeRefCount[i] > 1) // directory referenced more than once
+      reportError(sh, PHASE_RULE11_12, 12, i, NOVALUE, "ERROR: directory appears more than once in file system.");
+  }
+
+  scratchFree(cs->scratch, isInodeInDir);
+  scratchFree(cs->scratch, hasDotToItself);
+  scratchFree(cs->scratch, hasDotDot);
+  scratchFree(cs->scratch, inodeRefCount);
+}
+
+/*
+Rules 13 and 14, which no directory answers on its own:
+
+Rule 13:
+  Each .. entry in a directory refers to its parent, the directory with
+  the entry for it. If not, print ERROR: parent directory mismatch.
+
+Rule 14:
+  Every directory traces back to the root directory, so there is no
+  subtree cut off from it and no loop of directories. If not, print
+  ERROR: inaccessible directory exists.
+
+The index is sorted by directory with a counting sort, and the tree is
+walked breadth first from the root over it, so the walk is linear in the
+entries and the inodes. Levels with many entries are walked by all
+threads. A directory reached more than once keeps the lowest parent of
+the first level it is reached on; the other entries are rule 12.
+*/
+static void validateTree(struct checkstate *cs, struct checkshard *sh, struct checkopts *opts) {
+  uint ninodes = cs->sb->ninodes, i, d;
+  size_t e, entries;
+  struct treewalk tw = { .cs = cs };
+  struct treeshard *shards;
+  pthread_t *threads;
+  int t, nthreads = opts->nthreads;
+
+  // without a root directory nothing traces back to it, rule 3 says so
+  if (ninodes <= ROOTINO || !bitsetTest(cs->isInodeDir, ROOTINO))
+    return;
+
+  // a directory past the last inode an entry names is not reached, so the
+  // walk leaves it out, however many inodes the super block claims
+  tw.ninodes = ROOTINO + 1;
+  for (e = 0; e < cs->index.count; e++)
+    if (cs->index.ents[e].child >= tw.ninodes)
+      tw.ninodes = cs->index.ents[e].child + 1;
+
+  // entries by directory, in index order
+  tw.first = scratchCalloc(cs->scratch, ((size_t)tw.ninodes + 2) * sizeof(uint));
+  tw.order = scratchAlloc(cs->scratch, (cs->index.count + 1) * sizeof(uint));
+  tw.depth = scratchAlloc(cs->scratch, (size_t)tw.ninodes * sizeof(uint));
+  tw.parent = scratchAlloc(cs->scratch, (size_t)tw.ninodes * sizeof(uint));
+  tw.frontier = scratchAlloc(cs->scratch, sizeof(uint));
+  shards = scratchCalloc(cs->scratch, nthreads * sizeof(struct treeshard));
+  threads = scratchAlloc(cs->scratch, nthreads * sizeof(pthread_t));
+  for (e = 0; e < cs->index.count; e++)
+    if (cs->index.ents[e].parent < tw.ninodes)
+      tw.first[cs->index.ents[e].parent + 2]++;
+  for (i = 2; i < tw.ninodes + 2; i++)
+    tw.first[i] += tw.first[i - 1];
+  for (e = 0; e < cs->index.count; e++)
+    if (cs->index.ents[e].parent < tw.ninodes)
+      tw.order[tw.first[cs->index.ents[e].parent + 1]++] = e;
+
+  memset(tw.depth, 0xff, (size_t)tw.ninodes * sizeof(uint));
+  memset(tw.parent, 0xff, (size_t)tw.ninodes * sizeof(uint));
+  tw.depth[ROOTINO] = 0;
+  tw.parent[ROOTINO] = ROOTINO;
+  tw.frontier[0] = ROOTINO;
+  tw.nfrontier = 1;
+  for (t = 0; t < nthreads; t++) {
+    shards[t].tw = &tw;
+    shards[t].found.scratch = cs->scratch;
+  }
+  while (tw.nfrontier > 0) {
+    for (entries = 0, i = 0; i < tw.nfrontier; i++)
+      entries += tw.first[tw.frontier[i] + 1] - tw.first[tw.frontier[i]];
+    tw.nextDir = 0;
+    if (nthreads > 1 && entries >= TREE_PARALLEL) {
+      for (t = 1; t < nthreads; t++) {
+        if (pthread_create(&threads[t], NULL, walkTreeShard, &shards[t]) != 0) {
+          perror("pthread_create");
+          exit(1);
+        }
+      }
+      walkTreeShard(&shards[0]);
+      for (t = 1; t < nthreads; t++)
+        pthread_join(threads[t], NULL);
+    } else
+      walkTreeLevel(&tw, 0, tw.nfrontier, &shards[0].found);
+
+    // the directories reached make the next level
+    tw.nfrontier = 0;
+    for (t = 0; t < nthreads; t++)
+      tw.nfrontier += shards[t].found.count;
+    scratchFree(cs->scratch, tw.frontier);
+    tw.frontier = scratchAlloc(cs->scratch, ((size_t)tw.nfrontier + 1) * sizeof(uint));
+    for (i = 0, t = 0; t < nthreads; t++) {
+      if (shards[t].found.count > 0)
+        memcpy(tw.frontier + i, shards[t].found.blocks, shards[t].found.count * sizeof(uint));
+      i += shards[t].found.count;
+      shards[t].found.count = 0;
+    }
+    tw.level++;
+  }
+  tw.levels = tw.level;
+
+  for (d = 0; d < ninodes; d++)
+    if (bitsetTest(cs->isInodeDir, d) && (d >= tw.ninodes || tw.depth[d] == TREE_UNSEEN))
+      reportError(sh, PHASE_RULE13_14, 14, d, NOVALUE, "ERROR: inaccessible directory exists.");
+  for (e = 0; e < cs->index.count; e++) {
+    const struct dirindexent *de = &cs->index.ents[e];
+    if ((de->flags & DE_DOTDOT) && de->parent != ROOTINO && de->parent < tw.ninodes &&
+        tw.depth[de->parent] != TREE_UNSEEN && de->child != tw.parent[de->parent])
+      reportError(sh, PHASE_RULE13_14, 13, de->parent, NOVALUE, "ERROR: parent directory mismatch.");
+  }
+
+  if (opts->treePath != NULL)
+    dumpTree(cs, &tw, opts->treePath);
+
+  for (t = 0; t < nthreads; t++)
+    scratchFree(cs->scratch, shards[t].found.blocks);
+  scratchFree(cs->scratch, shards);
+  scratchFree(cs->scratch, threads);
+  scratchFree(cs->scratch, tw.first);
+  scratchFree(cs->scratch, tw.order);
+  scratchFree(cs->scratch, tw.depth);
+  scratchFree(cs->scratch, tw.parent);
+  scratchFree(cs->scratch, tw.frontier);
+}
+
+// claim chunks of the level until all its directories are walked
+static void *walkTreeShard(void *arg) {
+  struct treeshard *ts = arg;
+  struct treewalk *tw = ts->tw;
+  uint from;
+
+  while ((from = __atomic_fetch_add(&tw->nextDir, TREE_CHUNK, __ATOMIC_RELAXED)) < tw->nfrontier)
+    walkTreeLevel(tw, from, from + TREE_CHUNK < tw->nfrontier ? from + TREE_CHUNK : tw->nfrontier,
+                  &ts->found);
+  return NULL;
+}
+
+// reach the directories the entries of frontier directories [from, to)
+// name, the ones not reached before go to found
+static void walkTreeLevel(struct treewalk *tw, uint from, uint to, struct blocklist *found) {
+  struct checkstate *cs = tw->cs;
+  uint f, k, next = tw->level + 1;
+
+  for (f = from; f < to; f++) {
+    uint d = tw->frontier[f];
+    for (k = tw->first[d]; k < tw->first[d + 1]; k++) {
+      const struct dirindexent *de = &cs->index.ents[tw->order[k]];
+      uint c = de->child, seen = TREE_UNSEEN, p;
+      if ((de->flags & (DE_DOT | DE_DOTDOT)) || !bitsetTest(cs->isInodeDir, c))
+        continue;
+      if (__atomic_compare_exchange_n(&tw->depth[c], &seen, next, false, __ATOMIC_RELAXED,
+                                      __ATOMIC_RELAXED))
+        blocklistAdd(found, c);
+      else if (seen != next) // reached on an earlier level
+        continue;
+      // keep the lowest parent of the level
+      p = __atomic_load_n(&tw->parent[c], __ATOMIC_RELAXED);
+      while (d < p && !__atomic_compare_exchange_n(&tw->parent[c], &p, d, true, __ATOMIC_RELAXED,
+                                                   __ATOMIC_RELAXED))
+        ;
+    }
+  }
+}
+
+// append a name of at most DIRSIZ bytes to path, bytes outside printable
+// ASCII and the backslash escaped; returns the bytes appended
+static uint appendTreeName(char *path, const char *name) {
+  static const char hex[] = "0123456789abcdef";
+  uint i, n = 0;
+
+  for (i = 0; i < DIRSIZ && name[i]; i++) {
+    uchar c = name[i];
+    if (c <= 0x20 || c >= 0x7f || c == '\\') {
+      path[n++] = '\\';
+      path[n++] = 'x';
+      path[n++] = hex[c >> 4];
+      path[n++] = hex[c & 15];
+    } else
+      path[n++] = c;
+  }
+  return n;
+}
+
+/*
+Write the path of every entry the tree reaches, one tab-separated line per
+entry: the inode, then its path from the root. Files with more than one
+link get a line for each. The names come from the directory blocks, read
+once more, a directory at a time; the paths from a depth first walk of the
+tree, which keeps the path of the directory it is in.
+*/
+static void dumpTree(struct checkstate *cs, struct treewalk *tw, const char *path) {
+  char (*names)[DIRSIZ] = malloc((cs->index.count + 1) * DIRSIZ);
+  uint *stack = malloc(((size_t)tw->levels + 1) * sizeof(uint));
+  uint *cursor = malloc(((size_t)tw->levels + 1) * sizeof(uint));
+  size_t *length = malloc(((size_t)tw->levels + 1) * sizeof(size_t));
+  char *buf = malloc(((size_t)tw->levels + 1) * (4 * DIRSIZ + 1) + 1);
+  bitword *entered = bitsetAlloc(tw->ninodes);
+  struct dinode inodes[IPB];
+  struct dirent dirents[DPB];
+  uint ind[NINDIRECT], d, k, sp;
+  size_t n;
+  FILE *f = fopen(path, "w");
+
+  if (f == NULL) {
+    perror(path);
+    exit(1);
+  }
+  if (names == NULL || stack == NULL || cursor == NULL || length == NULL || buf == NULL) {
+    perror("malloc");
+    exit(1);
+  }
+
+  // the name of every entry, from the blocks of its directory
+  for (d = 0; d < tw->ninodes; d++) {
+    const struct dinode *dip;
+    const struct dirent *de = NULL;
+    uint fileBlock = UINT32_MAX;
+    if (tw->first[d] == tw->first[d + 1])
+      continue;
+    dip = (const struct dinode *) sourceBlocks(cs->src, IBLOCK(d), 1, inodes) + d % IPB;
+    for (k = tw->first[d]; k < tw->first[d + 1]; k++) {
+      uint slot = cs->index.ents[tw->order[k]].slot;
+      if (slot / DPB != fileBlock) {
+        fileBlock = slot / DPB;
+        de = sourceBlocks(cs->src, fileBlockAddress(cs->src, dip, fileBlock, ind), 1, dirents);
+      }
+      memcpy(names[tw->order[k]], de[slot % DPB].name, DIRSIZ);
+    }
+  }
+
+  fprintf(f, "inode\tpath\n%u\t/\n", ROOTINO);
+  stack[0] = ROOTINO;
+  cursor[0] = tw->first[ROOTINO];
+  length[0] = 0;
+  bitsetSet(entered, ROOTINO);
+  sp = 1;
+  while (sp > 0) {
+    const struct dirindexent *de;
+    d = stack[sp - 1];
+    if (cursor[sp - 1] == tw->first[d + 1]) {
+      sp--;
+      continue;
+    }
+    k = tw->order[cursor[sp - 1]++];
+    de = &cs->index.ents[k];
+    if (de->flags & (DE_DOT | DE_DOTDOT))
+      continue;
+    n = length[sp - 1];
+    buf[n++] = '/';
+    n += appendTreeName(buf + n, names[k]);
+    fprintf(f, "%u\t%.*s\n", de->child, (int)n, buf);
+    // go down the edges of the tree, once
+    if (bitsetTest(cs->isInodeDir, de->child) && tw->parent[de->child] == d &&
+        tw->depth[de->child] == sp && !bitsetTestAndSet(entered, de->child)) {
+      stack[sp] = de->child;
+      cursor[sp] = tw->first[de->child];
+      length[sp] = n;
+      sp++;
+    }
+  }
+
+  fclose(f);
+  free(names);
+  free(stack);
+  free(cursor);
+  free(length);
+  free(buf);
+  free(entered);
+}
+
+#include "repair.c"
+#include "diff.c"
+#include "quick.c"
+
+const struct geometry GEOMETRY = {
+  .blockSize = BSIZE,
+  .ndirect = NDIRECT,
+  .checkImage = checkImage,
+  .quickCheck = quickCheck,
+  .checkMemory = checkMemory,
+  .probeDirs = probeDirs,
+  .checkLayout = checkLayout,
+  .replayLog = replayLog,
+  .repairImage = repairImage,
+  .diffImages = diffImages,
+};
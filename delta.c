@@ -0,0 +1,143 @@
+// Snapshot delta
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "types.h"
+#include "fs.h"
+#include "report.h"
+#include "delta.h"
+
+static const char *superFields[] = { "size", "nblocks", "ninodes", "nlog" };
+
+static const char *changeNames[NCHANGE] = {
+  "super", "created", "removed", "type", "links", "size", "device", "block",
+  "entryAdded", "entryRemoved", "allocated", "freed"
+};
+
+// append one change
+void deltaAdd(struct delta *dl, const struct change *c) {
+  if (dl->count == dl->capacity) {
+    size_t capacity = dl->capacity ? dl->capacity * 2 : 64;
+    struct change *changes = realloc(dl->changes, capacity * sizeof(struct change));
+    if (changes == NULL) {
+      perror("delta");
+      exit(1);
+    }
+    dl->changes = changes;
+    dl->capacity = capacity;
+  }
+  dl->changes[dl->count++] = *c;
+}
+
+static const char *typeName(long type) {
+  static const char *names[] = { "free", "dir", "file", "device" };
+  return type >= 0 && type <= 3 ? names[type] : "bad";
+}
+
+// one line per change, then a summary line
+void deltaPrintText(FILE *f, const struct delta *dl) {
+  size_t i;
+
+  for (i = 0; i < dl->count; i++) {
+    const struct change *c = &dl->changes[i];
+    switch (c->kind) {
+    case CHANGE_SUPER:
+      fprintf(f, "super block: %s %ld -> %ld\n", superFields[c->index], c->oldValue,
+              c->newValue);
+      break;
+    case CHANGE_CREATED:
+      fprintf(f, "inode %ld: created, %s\n", c->inum, typeName(c->newValue));
+      break;
+    case CHANGE_REMOVED:
+      fprintf(f, "inode %ld: removed, %s\n", c->inum, typeName(c->oldValue));
+      break;
+    case CHANGE_TYPE:
+      fprintf(f, "inode %ld: type %s -> %s\n", c->inum, typeName(c->oldValue),
+              typeName(c->newValue));
+      break;
+    case CHANGE_DEVICE:
+      fprintf(f, "inode %ld: device %ld,%ld -> %ld,%ld\n", c->inum, c->oldValue >> 16,
+              c->oldValue & 0xffff, c->newValue >> 16, c->newValue & 0xffff);
+      break;
+    case CHANGE_LINKS:
+    case CHANGE_SIZE:
+      fprintf(f, "inode %ld: %s %ld -> %ld\n", c->inum, changeNames[c->kind], c->oldValue,
+              c->newValue);
+      break;
+    case CHANGE_BLOCK:
+      fprintf(f, "inode %ld: block %ld ", c->inum, c->index);
+      if (c->oldValue == 0)
+        fprintf(f, "none -> %ld\n", c->newValue);
+      else if (c->newValue == 0)
+        fprintf(f, "%ld -> none\n", c->oldValue);
+      else
+        fprintf(f, "%ld -> %ld\n", c->oldValue, c->newValue);
+      break;
+    case CHANGE_ENTRY_ADDED:
+    case CHANGE_ENTRY_REMOVED:
+      fprintf(f, "directory %ld: entry %ld \"%s\" %s, inode %ld\n", c->inum, c->index, c->name,
+              c->kind == CHANGE_ENTRY_ADDED ? "added" : "removed", c->newValue);
+      break;
+    case CHANGE_ALLOCATED:
+    case CHANGE_FREED:
+      if (c->newValue == 1)
+        fprintf(f, "block %ld %s\n", c->index, changeNames[c->kind]);
+      else
+        fprintf(f, "blocks %ld-%ld %s\n", c->index, c->index + c->newValue - 1,
+                changeNames[c->kind]);
+      break;
+    }
+  }
+  fprintf(f, "%zu change%s\n", dl->count, dl->count == 1 ? "" : "s");
+}
+
+void deltaPrintJson(FILE *f, const char *before, const char *after, const struct delta *dl) {
+  size_t i;
+
+  fprintf(f, "{\"before\": ");
+  printJsonString(f, before);
+  fprintf(f, ", \"after\": ");
+  printJsonString(f, after);
+  fprintf(f, ", \"changeCount\": %zu, \"changes\": [", dl->count);
+  for (i = 0; i < dl->count; i++) {
+    const struct change *c = &dl->changes[i];
+    fprintf(f, "%s\n  {\"change\": \"%s\", ", i ? "," : "", changeNames[c->kind]);
+    switch (c->kind) {
+    case CHANGE_SUPER:
+      fprintf(f, "\"field\": \"%s\", \"old\": %ld, \"new\": %ld}", superFields[c->index],
+              c->oldValue, c->newValue);
+      break;
+    case CHANGE_CREATED:
+      fprintf(f, "\"inode\": %ld, \"type\": %ld}", c->inum, c->newValue);
+      break;
+    case CHANGE_REMOVED:
+      fprintf(f, "\"inode\": %ld, \"type\": %ld}", c->inum, c->oldValue);
+      break;
+    case CHANGE_BLOCK:
+      fprintf(f, "\"inode\": %ld, \"block\": %ld, \"old\": %ld, \"new\": %ld}", c->inum,
+              c->index, c->oldValue, c->newValue);
+      break;
+    case CHANGE_ENTRY_ADDED:
+    case CHANGE_ENTRY_REMOVED:
+      fprintf(f, "\"directory\": %ld, \"entry\": %ld, \"name\": ", c->inum, c->index);
+      printJsonString(f, c->name);
+      fprintf(f, ", \"inode\": %ld}", c->newValue);
+      break;
+    case CHANGE_ALLOCATED:
+    case CHANGE_FREED:
+      fprintf(f, "\"block\": %ld, \"count\": %ld}", c->index, c->newValue);
+      break;
+    default:
+      fprintf(f, "\"inode\": %ld, \"old\": %ld, \"new\": %ld}", c->inum, c->oldValue,
+              c->newValue);
+    }
+  }
+  fprintf(f, "%s]}\n", dl->count ? "\n" : "");
+}
+
+void deltaFree(struct delta *dl) {
+  free(dl->changes);
+  dl->changes = NULL;
+  dl->count = dl->capacity = 0;
+}
@@ -0,0 +1,51 @@
+#ifndef _DELTA_H_
+#define _DELTA_H_
+
+// What changed in the metadata of an image since an earlier snapshot of
+// it, for --diff, and how it is printed.
+// Include types.h and fs.h first.
+
+#include <stdio.h>
+#include <stddef.h>
+
+// kinds of change
+enum {
+  CHANGE_SUPER,               // field index of the super block, old and new value
+  CHANGE_CREATED,             // inode now in use, new type
+  CHANGE_REMOVED,             // inode now free, old type
+  CHANGE_TYPE,                // type of an inode in use in both
+  CHANGE_LINKS,               // link count
+  CHANGE_SIZE,                // size in bytes
+  CHANGE_DEVICE,              // major and minor number, as major << 16 | minor
+  CHANGE_BLOCK,               // block index of a file, old and new address, 0 for none
+  CHANGE_ENTRY_ADDED,         // entry index of a directory, new value the inode it names
+  CHANGE_ENTRY_REMOVED,       // the same, of the entry that was there
+  CHANGE_ALLOCATED,           // blocks [index, index + new value) marked in use in the bitmap
+  CHANGE_FREED,               // blocks marked free
+  NCHANGE
+};
+
+// one change
+struct change {
+  int kind;
+  long inum;                  // inode or directory changed, NOVALUE for the super block
+                              // and the bitmap
+  long index;                 // field, block of the file, entry or first block
+  long oldValue;
+  long newValue;
+  char name[DIRSIZ + 1];      // name of an entry
+};
+
+// growable list of changes, in inode order
+struct delta {
+  struct change *changes;
+  size_t count;
+  size_t capacity;
+};
+
+void deltaAdd(struct delta *dl, const struct change *c);
+void deltaPrintText(FILE *f, const struct delta *dl);
+void deltaPrintJson(FILE *f, const char *before, const char *after, const struct delta *dl);
+void deltaFree(struct delta *dl);
+
+#endif // _DELTA_H_
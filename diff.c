@@ -0,0 +1,354 @@
+// Metadata diff of two images, for one geometry
+//
+// Included by checker.c, so that the diff sees the geometry and the address
+// layout of the checker. Both images are compared with memcmp, a chunk of
+// blocks at a time through the mappings when there are some, and only the
+// inodes whose records or blocks differ are decoded.
+#ifndef GEOMETRY
+#error "diff.c is compiled through the geom*.c files"
+#endif
+
+// blocks compared at a time
+#define DIFF_CHUNK 64
+
+// the two images, before and after
+struct diffstate {
+  struct blocksource *src[2];
+  struct superblock *sb[2];
+  struct delta *delta;
+  bitword *changed;          // blocks that differ between the two
+  uint nblocks;              // blocks of the larger image
+};
+
+static const struct dinode freeInode;
+static const struct dirent freeEntry;
+
+static void diffImages(struct blocksource *before, struct superblock *sbBefore,
+                       struct blocksource *after, struct superblock *sbAfter, struct delta *delta);
+static void diffInodes(struct diffstate *ds);
+static void diffBlocks(struct diffstate *ds, char *buf[2]);
+static bool diffTouched(struct diffstate *ds, const struct dinode *dip);
+static bool touchedBelow(struct diffstate *ds, uint block, uint height, bool dir);
+static const void *diffTable(struct diffstate *ds, int side, uint first, uint n, void *buf);
+static void diffInode(struct diffstate *ds, uint inum, const struct dinode *x,
+                      const struct dinode *y);
+static void diffIndirect(struct diffstate *ds, uint inum, uint height, uint fileBlock,
+                         uint blockX, uint blockY);
+static void diffDirectory(struct diffstate *ds, uint inum, const struct dinode *x,
+                          const struct dinode *y);
+static void diffBitmap(struct diffstate *ds);
+static void noteChange(struct diffstate *ds, int kind, long inum, long index, long oldValue,
+                       long newValue);
+static void noteEntry(struct diffstate *ds, int kind, uint inum, uint slot,
+                      const struct dirent *de);
+
+/*
+What changed from the image before to the image after, in the same
+geometry: fields of the super block, inodes created, removed or changed,
+the file blocks they map, the entries of directories, then the blocks
+marked in use or free, as runs. Every block of both images costs a
+memcmp; past that, only the inodes whose records differ, or whose indirect
+or directory blocks do, are decoded. A free inode past the end of the
+shorter inode table compares as a free inode.
+*/
+static void diffImages(struct blocksource *before, struct superblock *sbBefore,
+                       struct blocksource *after, struct superblock *sbAfter, struct delta *delta) {
+  struct diffstate ds = { { before, after }, { sbBefore, sbAfter }, delta, NULL,
+                          before->nblocks > after->nblocks ? before->nblocks : after->nblocks };
+  const uint *x = (const uint *) sbBefore, *y = (const uint *) sbAfter;
+  uint f;
+
+  for (f = 0; f < sizeof(struct superblock) / sizeof(uint); f++)
+    if (x[f] != y[f])
+      noteChange(&ds, CHANGE_SUPER, NOVALUE, f, x[f], y[f]);
+  diffInodes(&ds);
+  diffBitmap(&ds);
+}
+
+// find the blocks that differ, then compare the inode tables a chunk of
+// blocks at a time and walk the inodes that differ or own a block that does
+static void diffInodes(struct diffstate *ds) {
+  uint ninodes = ds->sb[0]->ninodes > ds->sb[1]->ninodes ? ds->sb[0]->ninodes
+                                                          : ds->sb[1]->ninodes;
+  uint tableBlocks = (ninodes + IPB - 1) / IPB, u, n, i;
+  const struct dinode *p[2];
+  char *buf[2];
+  int s;
+
+  buf[0] = malloc((size_t)DIFF_CHUNK * BLOCK_SIZE);
+  buf[1] = malloc((size_t)DIFF_CHUNK * BLOCK_SIZE);
+  if (buf[0] == NULL || buf[1] == NULL) {
+    perror("diff");
+    exit(1);
+  }
+  ds->changed = bitsetAlloc(ds->nblocks);
+  diffBlocks(ds, buf);
+  for (u = 0; u < tableBlocks; u += n) {
+    n = tableBlocks - u < DIFF_CHUNK ? tableBlocks - u : DIFF_CHUNK;
+    for (s = 0; s < 2; s++)
+      p[s] = diffTable(ds, s, u, n, buf[s]);
+    bool same = memcmp(p[0], p[1], (size_t)n * BLOCK_SIZE) == 0;
+    for (i = 0; i < n * IPB && u * IPB + i < ninodes; i++) {
+      uint inum = u * IPB + i;
+      const struct dinode *x = inum < ds->sb[0]->ninodes ? &p[0][i] : &freeInode;
+      const struct dinode *y = inum < ds->sb[1]->ninodes ? &p[1][i] : &freeInode;
+      if (!same && memcmp(x, y, sizeof(struct dinode)) != 0)
+        diffInode(ds, inum, x, y);
+      else if (x->type != 0 && diffTouched(ds, x))
+        diffInode(ds, inum, x, y);
+    }
+  }
+  free(ds->changed);
+  free(buf[0]);
+  free(buf[1]);
+}
+
+// mark the blocks that differ between the two images, skipping chunks that
+// are the same; a block past the end of one image reads as zeros there
+static void diffBlocks(struct diffstate *ds, char *buf[2]) {
+  uint b, n, k;
+
+  for (b = 0; b < ds->nblocks; b += n) {
+    n = ds->nblocks - b < DIFF_CHUNK ? ds->nblocks - b : DIFF_CHUNK;
+    const char *x = sourceBlocks(ds->src[0], b, n, buf[0]);
+    const char *y = sourceBlocks(ds->src[1], b, n, buf[1]);
+    if (memcmp(x, y, (size_t)n * BLOCK_SIZE) == 0)
+      continue;
+    for (k = 0; k < n; k++)
+      if (memcmp(x + (size_t)k * BLOCK_SIZE, y + (size_t)k * BLOCK_SIZE, BLOCK_SIZE) != 0)
+        bitsetSet(ds->changed, b + k);
+  }
+}
+
+/*
+Whether a block an inode that is the same in both images owns differs:
+one of its indirect blocks, or of its data blocks for a directory. Its
+addresses are the same in both, and so are those in the blocks that did
+not change, so only the indirect blocks that lead to blocks that matter
+are read, from the image before.
+*/
+static bool diffTouched(struct diffstate *ds, const struct dinode *dip) {
+  bool dir = dip->type == 1;
+  uint j;
+
+  for (j = 0; j < NADDRS; j++) {
+    uint block = dip->addrs[j];
+    if (block == 0)
+      continue;
+    if (j < NDIRECT ? dir && block < ds->nblocks && bitsetTest(ds->changed, block)
+                    : touchedBelow(ds, block, slotHeight(j), dir))
+      return true;
+  }
+  return false;
+}
+
+// whether an indirect block of the given height, or a block below it that
+// matters, differs
+static bool touchedBelow(struct diffstate *ds, uint block, uint height, bool dir) {
+  uint buf[NINDIRECT], i;
+  const uint *addrs;
+
+  if (block >= ds->nblocks)
+    return false;
+  if (bitsetTest(ds->changed, block))
+    return true;
+  if (height == 1 && !dir)
+    return false;
+  addrs = sourceBlocks(ds->src[0], block, 1, buf);
+  for (i = 0; i < NINDIRECT; i++) {
+    uint a = addrs[i];
+    if (a == 0)
+      continue;
+    if (height == 1 ? a < ds->nblocks && bitsetTest(ds->changed, a)
+                    : touchedBelow(ds, a, height - 1, dir))
+      return true;
+  }
+  return false;
+}
+
+// inode table blocks [first, first + n) of one image, zeros past its table
+static const void *diffTable(struct diffstate *ds, int side, uint first, uint n, void *buf) {
+  uint have = (ds->sb[side]->ninodes + IPB - 1) / IPB;
+  const void *p;
+
+  have = have > first ? have - first : 0;
+  if (have >= n)
+    return sourceBlocks(ds->src[side], IBLOCK(first * IPB), n, buf);
+  if (have > 0 && (p = sourceBlocks(ds->src[side], IBLOCK(first * IPB), have, buf)) != buf)
+    memcpy(buf, p, (size_t)have * BLOCK_SIZE);
+  memset((char *) buf + (size_t)have * BLOCK_SIZE, 0, (size_t)(n - have) * BLOCK_SIZE);
+  return buf;
+}
+
+// what changed in one inode and below it, from x to y
+static void diffInode(struct diffstate *ds, uint inum, const struct dinode *x,
+                      const struct dinode *y) {
+  uint j;
+
+  if (x->type != y->type) {
+    if (x->type == 0)
+      noteChange(ds, CHANGE_CREATED, inum, NOVALUE, 0, y->type);
+    else if (y->type == 0)
+      noteChange(ds, CHANGE_REMOVED, inum, NOVALUE, x->type, 0);
+    else
+      noteChange(ds, CHANGE_TYPE, inum, NOVALUE, x->type, y->type);
+  }
+  if (x->nlink != y->nlink)
+    noteChange(ds, CHANGE_LINKS, inum, NOVALUE, x->nlink, y->nlink);
+  if (x->size != y->size)
+    noteChange(ds, CHANGE_SIZE, inum, NOVALUE, x->size, y->size);
+  if (x->major != y->major || x->minor != y->minor)
+    noteChange(ds, CHANGE_DEVICE, inum, NOVALUE,
+               (long)(ushort)x->major << 16 | (ushort)x->minor,
+               (long)(ushort)y->major << 16 | (ushort)y->minor);
+
+  for (j = 0; j < NDIRECT; j++)
+    if (x->addrs[j] != y->addrs[j])
+      noteChange(ds, CHANGE_BLOCK, inum, j, x->addrs[j], y->addrs[j]);
+  for (; j < NADDRS; j++)
+    if (x->addrs[j] != 0 || y->addrs[j] != 0)
+      diffIndirect(ds, inum, slotHeight(j), slotFileBlock(j), x->addrs[j], y->addrs[j]);
+  if (x->type == 1 || y->type == 1)
+    diffDirectory(ds, inum, x, y);
+}
+
+// the file blocks an indirect block of the given height maps, from the one
+// at blockX to the one at blockY, 0 for none
+static void diffIndirect(struct diffstate *ds, uint inum, uint height, uint fileBlock,
+                         uint blockX, uint blockY) {
+  uint bufX[NINDIRECT], bufY[NINDIRECT], span = 1, i;
+  const uint *x = bufX, *y = bufY;
+
+  if (blockX == 0)
+    memset(bufX, 0, BLOCK_SIZE);
+  else
+    x = sourceBlocks(ds->src[0], blockX, 1, bufX);
+  if (blockY == 0)
+    memset(bufY, 0, BLOCK_SIZE);
+  else
+    y = sourceBlocks(ds->src[1], blockY, 1, bufY);
+  if (height == 1) {
+    if (memcmp(x, y, BLOCK_SIZE) != 0)
+      for (i = 0; i < NINDIRECT; i++)
+        if (x[i] != y[i])
+          noteChange(ds, CHANGE_BLOCK, inum, fileBlock + i, x[i], y[i]);
+    return;
+  }
+  // blocks below one that is the same may still differ
+  for (i = 1; i < height; i++)
+    span *= NINDIRECT;
+  for (i = 0; i < NINDIRECT; i++)
+    if (x[i] != 0 || y[i] != 0)
+      diffIndirect(ds, inum, height - 1, fileBlock + i * span, x[i], y[i]);
+}
+
+// the entries of a directory, in the blocks its size covers, a block at a
+// time; an entry that differs was removed, added, or both
+static void diffDirectory(struct diffstate *ds, uint inum, const struct dinode *x,
+                          const struct dinode *y) {
+  uint count[2] = { x->type == 1 ? x->size / sizeof(struct dirent) : 0,
+                    y->type == 1 ? y->size / sizeof(struct dirent) : 0 };
+  uint most = count[0] > count[1] ? count[0] : count[1], blocks = (most + DPB - 1) / DPB, k, j, e;
+  struct dirent buf[2][DPB];
+  uint ind[NINDIRECT];
+  const struct dirent *de[2];
+  int s;
+
+  if (blocks > MAXFILE)
+    blocks = MAXFILE;
+  for (k = 0; k < blocks; k++) {
+    for (s = 0; s < 2; s++) {
+      uint block = k * DPB < count[s] ? fileBlockAddress(ds->src[s], s ? y : x, k, ind) : 0;
+      if (block == 0) {
+        memset(buf[s], 0, BLOCK_SIZE);
+        de[s] = buf[s];
+      } else
+        de[s] = sourceBlocks(ds->src[s], block, 1, buf[s]);
+    }
+    if (count[0] == count[1] && memcmp(de[0], de[1], BLOCK_SIZE) == 0)
+      continue;
+    for (j = 0; j < DPB && (e = k * DPB + j) < most; j++) {
+      const struct dirent *a = e < count[0] ? &de[0][j] : &freeEntry;
+      const struct dirent *b = e < count[1] ? &de[1][j] : &freeEntry;
+      if (memcmp(a, b, sizeof(struct dirent)) == 0)
+        continue;
+      if (a->inum != 0)
+        noteEntry(ds, CHANGE_ENTRY_REMOVED, inum, e, a);
+      if (b->inum != 0)
+        noteEntry(ds, CHANGE_ENTRY_ADDED, inum, e, b);
+    }
+  }
+}
+
+/*
+The bitmaps, as runs of blocks marked in use or free. Bit b is in byte b / 8
+of both, wherever they start, so equal stretches are skipped a word at a
+time and only the words that differ are looked at bit by bit. Blocks past
+the end of the smaller image compare as free.
+*/
+static void diffBitmap(struct diffstate *ds) {
+  uint nbits[2], bytes[2], common, most, b, run = 0;
+  const uchar *map[2];
+  uchar *buf[2];
+  int s, kind = -1;
+
+  for (s = 0; s < 2; s++) {
+    nbits[s] = ds->sb[s]->size;
+    bytes[s] = (nbits[s] + BPB - 1) / BPB * BLOCK_SIZE;
+    buf[s] = malloc(bytes[s] + 1);
+    if (buf[s] == NULL) {
+      perror("diff");
+      exit(1);
+    }
+    map[s] = sourceBlocks(ds->src[s], BBLOCK(0, ds->sb[s]->ninodes), bytes[s] / BLOCK_SIZE, buf[s]);
+  }
+  common = (nbits[0] < nbits[1] ? nbits[0] : nbits[1]) / WORDBITS;
+  most = nbits[0] > nbits[1] ? nbits[0] : nbits[1];
+  for (b = 0; b < most; b++) {
+    int bit[2], k = -1;
+    uint w = b / WORDBITS;
+    if (b % WORDBITS == 0 && w < common) {
+      bitword x, y;
+      memcpy(&x, map[0] + (size_t)w * sizeof(bitword), sizeof(bitword));
+      memcpy(&y, map[1] + (size_t)w * sizeof(bitword), sizeof(bitword));
+      if (x == y) {
+        if (run > 0)
+          noteChange(ds, kind, NOVALUE, b - run, NOVALUE, run);
+        run = 0;
+        b += WORDBITS - 1;
+        continue;
+      }
+    }
+    for (s = 0; s < 2; s++)
+      bit[s] = b < nbits[s] && (map[s][b / 8] >> (b % 8) & 1);
+    if (bit[0] != bit[1])
+      k = bit[1] ? CHANGE_ALLOCATED : CHANGE_FREED;
+    if (run > 0 && k != kind) {
+      noteChange(ds, kind, NOVALUE, b - run, NOVALUE, run);
+      run = 0;
+    }
+    if (k != -1) {
+      kind = k;
+      run++;
+    }
+  }
+  if (run > 0)
+    noteChange(ds, kind, NOVALUE, most - run, NOVALUE, run);
+  free(buf[0]);
+  free(buf[1]);
+}
+
+static void noteChange(struct diffstate *ds, int kind, long inum, long index, long oldValue,
+                       long newValue) {
+  struct change c = { .kind = kind, .inum = inum, .index = index, .oldValue = oldValue,
+                      .newValue = newValue };
+  deltaAdd(ds->delta, &c);
+}
+
+static void noteEntry(struct diffstate *ds, int kind, uint inum, uint slot,
+                      const struct dirent *de) {
+  struct change c = { .kind = kind, .inum = inum, .index = slot, .oldValue = NOVALUE,
+                      .newValue = de->inum };
+  memcpy(c.name, de->name, DIRSIZ);
+  deltaAdd(ds->delta, &c);
+}
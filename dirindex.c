@@ -0,0 +1,95 @@
+// Directory index
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "types.h"
+#include "fs.h"
+#include "dirindex.h"
+
+static void dirindexReserve(struct dirindex *ix, size_t n) {
+  size_t capacity = ix->capacity ? ix->capacity : 256;
+  struct dirindexent *ents;
+
+  if (n <= ix->capacity)
+    return;
+  while (capacity < n)
+    capacity *= 2;
+  ents = scratchRealloc(ix->scratch, ix->ents, ix->capacity * sizeof(struct dirindexent),
+                        capacity * sizeof(struct dirindexent));
+  ix->ents = ents;
+  ix->capacity = capacity;
+}
+
+// FNV-1a over the name, which ends at the first NUL or after DIRSIZ bytes
+static uint hashName(const char *name) {
+  uint h = 2166136261u;
+  int i;
+
+  for (i = 0; i < DIRSIZ && name[i]; i++)
+    h = (h ^ (uchar)name[i]) * 16777619u;
+  return h;
+}
+
+// append dirent de, found at slot of directory parent, with the flags the
+// caller found its name to have
+void dirindexAdd(struct dirindex *ix, uint parent, uint slot, const struct dirent *de,
+                 ushort flags) {
+  struct dirindexent *e;
+
+  dirindexReserve(ix, ix->count + 1);
+  e = &ix->ents[ix->count++];
+  e->parent = parent;
+  e->slot = slot;
+  e->nameHash = hashName(de->name);
+  e->child = de->inum;
+  e->flags = flags;
+}
+
+// copy n entries to the end of ix
+void dirindexAppend(struct dirindex *ix, const struct dirindexent *ents, size_t n) {
+  if (n > 0) {
+    dirindexReserve(ix, ix->count + n);
+    memcpy(ix->ents + ix->count, ents, n * sizeof(struct dirindexent));
+    ix->count += n;
+  }
+}
+
+// move all entries of other to the end of ix
+void dirindexMerge(struct dirindex *ix, struct dirindex *other) {
+  dirindexAppend(ix, other->ents, other->count);
+  dirindexFree(other);
+}
+
+static int compareEntries(const void *a, const void *b) {
+  const struct dirindexent *x = a, *y = b;
+
+  if (x->parent != y->parent)
+    return x->parent < y->parent ? -1 : 1;
+  return (x->slot > y->slot) - (x->slot < y->slot);
+}
+
+// order by directory, then slot, so the order does not depend on the
+// order the threads scanned the directories in
+void dirindexSort(struct dirindex *ix) {
+  if (ix->count > 1)
+    qsort(ix->ents, ix->count, sizeof(struct dirindexent), compareEntries);
+}
+
+// one tab-separated line per entry, after a header line
+void dirindexDump(FILE *f, const struct dirindex *ix) {
+  size_t i;
+
+  fprintf(f, "parent\tslot\tchild\thash\tkind\n");
+  for (i = 0; i < ix->count; i++) {
+    const struct dirindexent *e = &ix->ents[i];
+    fprintf(f, "%u\t%u\t%u\t%08x\t%s\n", e->parent, e->slot, e->child, e->nameHash,
+            e->flags & DE_DOT ? "." : e->flags & DE_DOTDOT ? ".." : "-");
+  }
+}
+
+void dirindexFree(struct dirindex *ix) {
+  scratchFree(ix->scratch, ix->ents);
+  ix->ents = NULL;
+  ix->count = ix->capacity = 0;
+}
@@ -0,0 +1,42 @@
+#ifndef _DIRINDEX_H_
+#define _DIRINDEX_H_
+
+// Directory index: one compact record for every used entry of every
+// directory, built while the directory blocks are decoded. The namespace
+// rules are answered from the index instead of from the blocks.
+// Include types.h and fs.h first.
+
+#include <stdio.h>
+#include <stddef.h>
+
+#include "scratch.h"
+
+#define DE_DOT     0x1  // entry is "."
+#define DE_DOTDOT  0x2  // entry is ".."
+
+// one directory entry
+struct dirindexent {
+  uint parent;          // directory holding the entry
+  uint slot;            // index of the entry in the directory
+  uint nameHash;        // FNV-1a hash of the name
+  ushort child;         // inode the entry refers to
+  ushort flags;         // DE_DOT, DE_DOTDOT
+};
+
+// growable flat array of entries
+struct dirindex {
+  struct dirindexent *ents;
+  size_t count;
+  size_t capacity;
+  struct scratch *scratch;    // arena ents come from, NULL for the heap
+};
+
+void dirindexAdd(struct dirindex *ix, uint parent, uint slot, const struct dirent *de,
+                 ushort flags);
+void dirindexAppend(struct dirindex *ix, const struct dirindexent *ents, size_t n);
+void dirindexMerge(struct dirindex *ix, struct dirindex *other);
+void dirindexSort(struct dirindex *ix);
+void dirindexDump(FILE *f, const struct dirindex *ix);
+void dirindexFree(struct dirindex *ix);
+
+#endif // _DIRINDEX_H_
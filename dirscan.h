@@ -0,0 +1,114 @@
+#ifndef _DIRSCAN_H_
+#define _DIRSCAN_H_
+
+// Directory block scanner. Classifies every entry of a directory block at
+// once, a bit per entry: whether it is in use (its inode is not 0), and
+// whether it is named "." or "..", the only names the rules look at. An
+// entry is 16 bytes, the inode number in the first two, so a vector of
+// 64 bytes holds four entries whole; comparing it bytewise with zero and
+// with the pattern 0 0 '.' '.' 0 answers all three questions for the four
+// entries in two compares, and a few shifts of the two byte masks turn the
+// answers into a bit per entry.
+// Include types.h, fs.h and bitset.h first.
+
+#include <string.h>
+
+#define DIRSCAN_ENTRIES (BSIZE / sizeof(struct dirent))
+#define DIRSCAN_WORDS BITSET_WORDS(DIRSCAN_ENTRIES)
+
+// entries of a directory block, bit e for entry e
+struct dirscan {
+  bitword used[DIRSCAN_WORDS];    // inode not 0
+  bitword dot[DIRSCAN_WORDS];     // named "."
+  bitword dotdot[DIRSCAN_WORDS];  // named ".."
+};
+
+typedef void (*dirscanfn)(const struct dirent *de, struct dirscan *s);
+
+// the first byte of each of four entries in a 64-bit byte mask
+#define DIRSCAN_LANES 0x0001000100010001ull
+
+// Bits e to e + 3 of s from the byte masks of four entries: zero has bit
+// 16i + b set if byte b of entry e + i is 0, pattern if it matches the
+// pattern. The bit of each entry is moved from 16i to i.
+static inline void dirscanGroup(struct dirscan *s, uint e, uint64_t zero, uint64_t pattern) {
+  uint64_t unused = zero & zero >> 1 & DIRSCAN_LANES;
+  uint64_t dot = pattern >> 2 & zero >> 3 & DIRSCAN_LANES;
+  uint64_t dotdot = pattern >> 2 & pattern >> 3 & pattern >> 4 & DIRSCAN_LANES;
+
+  unused |= unused >> 15;
+  unused |= unused >> 30;
+  dot |= dot >> 15;
+  dot |= dot >> 30;
+  dotdot |= dotdot >> 15;
+  dotdot |= dotdot >> 30;
+  s->used[e / WORDBITS] |= (~unused & 0xf) << e % WORDBITS;
+  s->dot[e / WORDBITS] |= (dot & 0xf) << e % WORDBITS;
+  s->dotdot[e / WORDBITS] |= (dotdot & 0xf) << e % WORDBITS;
+}
+
+static inline void dirscanScalar(const struct dirent *de, struct dirscan *s) {
+  uint e;
+
+  memset(s, 0, sizeof(*s));
+  for (e = 0; e < DIRSCAN_ENTRIES; e++) {
+    bitword bit = (bitword)1 << e % WORDBITS;
+    if (de[e].inum != 0)
+      s->used[e / WORDBITS] |= bit;
+    if (de[e].name[0] == '.' && de[e].name[1] == '\0')
+      s->dot[e / WORDBITS] |= bit;
+    else if (de[e].name[0] == '.' && de[e].name[1] == '.' && de[e].name[2] == '\0')
+      s->dotdot[e / WORDBITS] |= bit;
+  }
+}
+
+#ifdef BITSET_X86
+// two entries per compare
+__attribute__((target("avx2")))
+static inline void dirscanAvx2(const struct dirent *de, struct dirscan *s) {
+  const __m256i dots = _mm256_setr_epi8(0, 0, '.', '.', 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+                                        0, 0, '.', '.', 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+  const __m256i zeros = _mm256_setzero_si256();
+  uint e;
+
+  memset(s, 0, sizeof(*s));
+  for (e = 0; e < DIRSCAN_ENTRIES; e += 4) {
+    __m256i lo = _mm256_loadu_si256((const __m256i *) (de + e));
+    __m256i hi = _mm256_loadu_si256((const __m256i *) (de + e + 2));
+    uint64_t zero = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, zeros)) |
+                    (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(hi, zeros)) << 32;
+    uint64_t pattern = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, dots)) |
+                       (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(hi, dots)) << 32;
+    dirscanGroup(s, e, zero, pattern);
+  }
+}
+
+// four entries per compare, straight into a 64-bit mask
+__attribute__((target("avx512bw")))
+static inline void dirscanAvx512(const struct dirent *de, struct dirscan *s) {
+  const __m512i dots = _mm512_broadcast_i32x4(_mm_setr_epi8(0, 0, '.', '.', 0, 0, 0, 0,
+                                                            0, 0, 0, 0, 0, 0, 0, 0));
+  const __m512i zeros = _mm512_setzero_si512();
+  uint e;
+
+  memset(s, 0, sizeof(*s));
+  for (e = 0; e < DIRSCAN_ENTRIES; e += 4) {
+    __m512i v = _mm512_loadu_si512((const void *) (de + e));
+    dirscanGroup(s, e, _mm512_cmpeq_epi8_mask(v, zeros), _mm512_cmpeq_epi8_mask(v, dots));
+  }
+}
+#endif
+
+// widest scanner the CPU supports
+static inline dirscanfn dirscanKernel(void) {
+#ifdef BITSET_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512bw"))
+    return dirscanAvx512;
+  if (__builtin_cpu_supports("avx2"))
+    return dirscanAvx2;
+#endif
+  return dirscanScalar;
+}
+
+#endif // _DIRSCAN_H_
@@ -9,775 +9,528 @@
 #include <fcntl.h>
 #include <assert.h>
 #include <stdbool.h>
+#include <endian.h>
+#include <pthread.h>
+#include <getopt.h>
 
 #include "types.h"
 #include "fs.h"
+#include "check.h"
+#include "serve.h"
 
-#define BLOCK_SIZE (BSIZE)
+// inodes --quick samples unless told otherwise
+#define QUICK_SAMPLES 4096
+
+// one image of a batch
+struct batchimage {
+  char *path;
+  int status;                 // what checkImage returned
+  const char *failure;        // why the image could not be checked, or NULL
+  struct report report;
+  bool done;                  // checked, result not printed yet
+};
+
+// images checked by a pool of workers, everything below lock is guarded by it
+struct batch {
+  struct batchimage *images;
+  size_t count;
+  size_t capacity;
+  struct checkopts *opts;
+  uint64_t memCap;            // bytes of heap all running checks may use, 0 for no cap
+  FILE *json;                 // JSON report, or NULL
+  pthread_mutex_t lock;
+  pthread_cond_t memFreed;    // a check finished and gave its memory back
+  size_t next;                // next image to hand out
+  size_t printed;             // images printed so far, in list order
+  int running;                // checks in progress
+  uint64_t memInUse;          // heap of the checks in progress
+};
 
 // function declarations
-void validateRule1(char *addr, struct superblock *sb);
-void validateRule2(char *addr, struct superblock *sb);
-void validateRule3(char *addr, struct superblock *sb);
-void validateRule4(char *addr, struct superblock *sb);
-void validateRule5(char *addr, struct superblock *sb);
-void validateRule6(char *addr, struct superblock *sb);
-void validateRule7_8(char *addr, struct superblock *sb);
-void validateRule9(char *addr, struct superblock *sb);
-void validateRule10(char *addr, struct superblock *sb);
-void validateRule11_12(char *addr, struct superblock *sb);
+int checkFile(const char *path, struct checkopts *opts, const char *jsonPath);
+int diffFiles(const char *before, const char *after, struct checkopts *opts, const char *jsonPath);
+int checkBatch(struct batch *b, int nworkers, const char *jsonPath);
+void *batchWorker(void *arg);
+void batchPrint(struct batch *b);
+void batchAdd(struct batch *b, const char *path);
+void batchRead(struct batch *b, const char *file);
 
 // main function
 int main(int argc, char *argv[]) {
-  int r, fsfd;
-  char *addr;
-  struct superblock *sb;
-  struct stat st;
-  
+  int r, opt, nworkers = 0;
+  char *jsonPath = NULL, *manifest = NULL, *statsFormat = NULL, *socketPath = NULL;
+  uint64_t memCap = 0;
+  struct checkopts opts = { .nthreads = 1 };
+  struct batch b = { 0 };
+  struct checkstats stats;
+  bool diff = false;
+  static const struct option longOpts[] = {
+    { "stats", optional_argument, NULL, 's' },
+    { "repair", no_argument, NULL, 'r' },
+    { "diff", no_argument, NULL, 'd' },
+    { "serve", required_argument, NULL, 'u' },
+    { "quick", optional_argument, NULL, 'q' },
+    { "quick-ms", required_argument, NULL, 't' },
+    { "quick-mb", required_argument, NULL, 'b' },
+    { 0 }
+  };
+
+  while ((opt = getopt_long(argc, argv, "aD:Fg:j:J:L:m:M:pP:ST:", longOpts, NULL)) != -1) {
+    switch (opt) {
+    case 'a': // keep going after the first error
+      opts.collectAll = true;
+      break;
+    case 'D': // dump the directory index
+      opts.indexPath = optarg;
+      break;
+    case 'F': // print BLAKE3 digests of the image and its regions
+      opts.fingerprint = true;
+      break;
+    case 'g': // geometry of the images, BSIZE or BSIZE:NDIRECT
+      opts.geometry = parseGeometry(optarg);
+      if (opts.geometry == NULL) {
+        fprintf(stderr, "no checker for geometry %s\n", optarg);
+        exit(1);
+      }
+      break;
+    case 'J': // also write the report as JSON, - for stdout
+      jsonPath = optarg;
+      break;
+    case 'j': // number of threads scanning the inode table
+      opts.nthreads = atoi(optarg);
+      if (opts.nthreads < 1) {
+        fprintf(stderr, "bad thread count\n");
+        exit(1);
+      }
+      break;
+    case 'L': // read more image paths from a file, - for stdin
+      manifest = optarg;
+      break;
+    case 'm': // memory cap of a batch, in megabytes
+      memCap = strtoull(optarg, NULL, 10) << 20;
+      break;
+    case 'M': // re-check against a manifest of the last clean check
+      opts.manifestPath = optarg;
+      break;
+    case 'p': // fetch scattered blocks in address order before the scan
+      opts.prefetch = true;
+      break;
+    case 'P': // number of images checked at the same time
+      nworkers = atoi(optarg);
+      if (nworkers < 1) {
+        fprintf(stderr, "bad worker count\n");
+        exit(1);
+      }
+      break;
+    case 'r': // fix the image in place, then check it
+      opts.repair = true;
+      break;
+    case 'd': // what changed between two snapshots of an image
+      diff = true;
+      break;
+    case 'u': // check the images clients ask about on a Unix socket
+      socketPath = optarg;
+      break;
+    case 'q': // check a sample of the inodes only
+      opts.quickSamples = optarg ? strtoul(optarg, NULL, 10) : QUICK_SAMPLES;
+      if (opts.quickSamples < 1) {
+        fprintf(stderr, "bad sample size\n");
+        exit(1);
+      }
+      break;
+    case 't': // time the sample may take, in milliseconds
+      opts.quickMillis = strtoul(optarg, NULL, 10);
+      break;
+    case 'b': // bytes of the image the sample may read, in megabytes
+      opts.quickBytes = strtoull(optarg, NULL, 10) << 20;
+      break;
+    case 'S': // read the image with pread, without mapping it
+      opts.stream = true;
+      break;
+    case 'T': // write the path of every entry of the tree
+      opts.treePath = optarg;
+      break;
+    case 's': // time and count the work of every phase, text or json
+      statsFormat = optarg ? optarg : "text";
+      if (strcmp(statsFormat, "text") != 0 && strcmp(statsFormat, "json") != 0) {
+        fprintf(stderr, "bad stats format\n");
+        exit(1);
+      }
+#ifndef FCHECK_STATS
+      fprintf(stderr, "built without FCHECK_STATS, no --stats\n");
+      exit(1);
+#endif
+      break;
+    default:
+      optind = argc; // print usage
+      manifest = socketPath = NULL;
+    }
+  }
+
   // print proper usage of the program if no argument is passed
-  if(argc < 2) {
-    fprintf(stderr, "Usage: sample fs.img ...\n");
+  if(optind >= argc && manifest == NULL && socketPath == NULL) {
+    fprintf(stderr, "Usage: fcheck [-aFpS] [-g bsize[:ndirect]] [-j threads] [-J report.json]\n"
+                    "              [-D index.tsv] [-T paths.tsv] [-M manifest] [--stats[=text|json]]\n"
+                    "              [--repair] fs.img\n"
+                    "       fcheck --quick[=inodes] [--quick-ms=MS] [--quick-mb=MB] [-aS]\n"
+                    "              [-g bsize[:ndirect]] [-J report.json] fs.img\n"
+                    "       fcheck [-aFpS] [-g bsize[:ndirect]] [-j threads] [-J report.json]\n"
+                    "              [-P workers] [-m MB] [-L manifest] fs.img ...\n"
+                    "       fcheck --diff [-S] [-g bsize[:ndirect]] [-J delta.json]\n"
+                    "              before.img after.img\n"
+                    "       fcheck --serve=socket [-aFpS] [-g bsize[:ndirect]] [-j threads]\n"
+                    "              [-P workers] [-m MB]\n");
     exit(1);
   }
 
-  // open the image file
-  fsfd = open(argv[1], O_RDONLY);
-  if(fsfd < 0) {
-    fprintf(stderr, "image not found\n");
+  if ((opts.quickMillis != 0 || opts.quickBytes != 0) && opts.quickSamples == 0) {
+    fprintf(stderr, "--quick-ms and --quick-mb go with --quick\n");
     exit(1);
   }
-  
-  // use fstat to get the file size
-  r = fstat(fsfd, &st);
-  if (r != 0) {
-		perror("stat");
-		exit(1);
-	}
-
-  // memory map image file
-  addr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fsfd, 0);
-  if (addr == MAP_FAILED) {
-    perror("mmap failed");
+  if (opts.quickSamples != 0 &&
+      (diff || socketPath != NULL || manifest != NULL || optind != argc - 1 ||
+       opts.indexPath != NULL || opts.treePath != NULL || opts.manifestPath != NULL ||
+       opts.fingerprint || statsFormat != NULL || opts.repair)) {
+    fprintf(stderr, "--quick takes a single image, and no -D, -T, -M, -F, --stats or --repair\n");
     exit(1);
   }
 
-  // read the super block
-  sb = (struct superblock *) (addr + 1 * BLOCK_SIZE);
-
-  // validate rules 1 through 12
-  validateRule1(addr, sb);
-  validateRule2(addr, sb);
-  validateRule3(addr, sb);
-  validateRule4(addr, sb);
-  validateRule5(addr, sb);
-  validateRule6(addr, sb);
-  validateRule7_8(addr, sb);
-  validateRule9(addr, sb);
-  validateRule10(addr, sb);
-  validateRule11_12(addr, sb);
-
-  exit(0);
-}
-
-/*
-Rule 1:
-  Not one of the valid types (T_FILE, T_DIR, T_DEV). 
-  print ERROR: bad inode.
-*/
-void validateRule1(char *addr, struct superblock *sb) {
-  int i;
-  struct dinode *rInodeP = (struct dinode *) (addr + IBLOCK((uint)0)*BLOCK_SIZE);
-  
-  // iterate through all inodes
-  for (i = 1; i < sb->ninodes; i++, rInodeP++) {
-    if (rInodeP->type == 0) // inode not in use
-      continue;
-    if (rInodeP->type == 1 || rInodeP->type == 2 || rInodeP->type == 3) // in use inodes
-      continue;
-    else {
-      /*
-      Rule 1:
-        Not one of the valid types (T_FILE, T_DIR, T_DEV). 
-        print ERROR: bad inode.
-      */
-      fprintf(stderr, "ERROR: bad inode.\n");
+  if (diff) {
+    if (manifest != NULL || optind != argc - 2 || socketPath != NULL || opts.collectAll ||
+        opts.prefetch || opts.fingerprint || opts.nthreads != 1 || nworkers != 0 || memCap != 0 ||
+        opts.indexPath != NULL || opts.treePath != NULL || opts.manifestPath != NULL ||
+        statsFormat != NULL || opts.repair) {
+      fprintf(stderr, "--diff takes two images, and only -S, -g and -J\n");
+      exit(2);
+    }
+    exit(diffFiles(argv[optind], argv[optind + 1], &opts, jsonPath));
+  }
+  if (nworkers == 0)
+    nworkers = sysconf(_SC_NPROCESSORS_ONLN);
+  if (socketPath != NULL) {
+    if (manifest != NULL || optind != argc || jsonPath != NULL || opts.indexPath != NULL ||
+        opts.treePath != NULL || opts.manifestPath != NULL || statsFormat != NULL || opts.repair) {
+      fprintf(stderr, "--serve takes no image, nor -J, -D, -T, -M, --stats or --repair\n");
       exit(1);
     }
+    exit(serveChecks(socketPath, &opts, nworkers, memCap));
   }
-}
-
-/*
-Rule 2:
-  If the direct block is used and is invalid, print 
-  ERROR: bad direct address in inode.
-*/
-void validateRule2(char *addr, struct superblock *sb) {
-  int i;
-  struct dinode *rInodeP = (struct dinode *) (addr + IBLOCK((uint)0)*BLOCK_SIZE);
-  
-  // get the final block used for bitmap
-  // valid data blocks should be in the range (lastBitmapBlock, sb->ninodes)
-  uint lastBitmapBlock = BBLOCK(IBLOCK(sb->ninodes - 1), sb->ninodes);
-
-  // iterate through all inodes
-  for (i = 1; i < sb->ninodes; i++, rInodeP++) {
-    if (rInodeP->type == 0) // not in use
-      continue;
-    if (rInodeP->type == 1 || rInodeP->type == 2 || rInodeP->type == 3) { // in use inodes
-      if (rInodeP->size == 0)
-        continue;
-      // check direct blocks
-      for (i = 0; i < NDIRECT; i++) {
-        if (rInodeP->addrs[i] == 0) // unallocated
-          continue;
-        // within valid range
-        if (rInodeP->addrs[i] > lastBitmapBlock && rInodeP->addrs[i] < sb->nblocks)
-          continue;
-        /*
-        Rule 2:
-          If the direct block is used and is invalid, print 
-          ERROR: bad direct address in inode.
-        */
-        fprintf(stderr, "ERROR: bad direct address in inode.\n");
-        exit(1);
-      }
-      // check indirect blocks
-      uint indAddr = rInodeP->addrs[NDIRECT];
-      if (indAddr == 0) // unallocated
-        continue;
-      else if (indAddr <= lastBitmapBlock || indAddr >= sb->nblocks) {
-        /*
-        Rule 2:
-          if the indirect block is in use and is invalid, print 
-          ERROR: bad indirect address in inode.
-        */
-        fprintf(stderr, "ERROR: bad indirect address in inode.\n");
-        exit(1);
-      } else {
-        uint *indTemp = (uint *) (addr + indAddr * BLOCK_SIZE);
-        for (i = 0; i < NINDIRECT; i++, indTemp++) {
-          if ((*indTemp) == 0) // not allocated
-            continue;
-          // within valid range
-          if (((*indTemp) > lastBitmapBlock) && ((*indTemp) < sb->nblocks))
-            continue;
-          /*
-          Rule 2:
-            if the indirect block is in use and is invalid, print 
-            ERROR: bad indirect address in inode.
-          */
-          fprintf(stderr, "ERROR: bad indirect address in inode.\n");
-          exit(1);
-        }
-      }
+  if (opts.manifestPath != NULL && opts.collectAll) {
+    fprintf(stderr, "-M does not combine with -a\n");
+    exit(1);
+  }
+  if (manifest == NULL && optind == argc - 1) {
+    if (statsFormat != NULL) {
+      statsOpen(&stats);
+      opts.stats = &stats;
+    }
+    r = checkFile(argv[optind], &opts, jsonPath);
+    if (statsFormat != NULL) {
+      if (strcmp(statsFormat, "json") == 0)
+        statsPrintJson(stderr, argv[optind], &stats);
+      else
+        statsPrintText(stderr, &stats);
+      statsClose(&stats);
     }
+    exit(r);
   }
+
+  // more than one image
+  if (opts.indexPath != NULL || opts.treePath != NULL || opts.manifestPath != NULL ||
+      statsFormat != NULL || opts.repair) {
+    fprintf(stderr, "-D, -T, -M, --stats and --repair take a single image\n");
+    exit(1);
+  }
+  for (; optind < argc; optind++)
+    batchAdd(&b, argv[optind]);
+  if (manifest != NULL)
+    batchRead(&b, manifest);
+  b.opts = &opts;
+  b.memCap = memCap;
+  exit(checkBatch(&b, nworkers, jsonPath));
 }
 
-/*
-Rule 3:
-  Root directory exists, its inode number is 1, and the parent of the root 
-  directory is itself. If not, print ERROR: root directory does not exist.
-*/
-void validateRule3(char *addr, struct superblock *sb) {
-  int i, direntCount;
-  // flags to validate rules
-  bool parentItself = false, rootDir = false, rootDirInum = false;
-  struct dirent *de;
-  
-  struct dinode *rInodeP = (struct dinode *) (addr + IBLOCK((uint)0)*BLOCK_SIZE);
-  rInodeP++; // go to root inode
-  direntCount = rInodeP->size/sizeof(struct dirent);
-
-  // check root inode
-  if (rInodeP->addrs != 0) {
-    de = (struct dirent *) (addr + (rInodeP->addrs[0])*BLOCK_SIZE);
-    if (de != 0) {
-      rootDir = true;
-      if (de->inum == 1)
-        rootDirInum = true;
-      // iterate through directory entries of the root inode
-      for (i = 0; i < direntCount; i++,de++) {
-        // ensure inode number of dirent .. is 1
-        if (strcmp(de->name,"..") == 0 && de->inum == 1) {
-          parentItself = true;
-          break;
-        }
-      }
+// check a single image, errors go to stderr
+int checkFile(const char *path, struct checkopts *opts, const char *jsonPath) {
+  int r;
+  const char *failure;
+  struct blocksource src;
+  struct superblock sb;
+  struct report rp = { 0 };
+  const struct geometry *geo;
+
+  if ((failure = openImage(path, opts, &src, &sb, &geo)) != NULL) {
+    fprintf(stderr, "%s\n", failure);
+    return 1;
+  }
+
+  if (opts->repair) {
+    struct report fixes = { 0 };
+    r = geo->repairImage(&src, &sb, &fixes);
+    if (r >= 0)
+      reportPrintRepairs(stderr, &fixes, r);
+    reportFree(&fixes);
+    if (r < 0) {
+      sourceClose(&src);
+      return 1;
     }
   }
-  if (!rootDir || !rootDirInum || !parentItself) {
-    /*
-    Rule 3:
-      Root directory exists, its inode number is 1, and the parent of the root 
-      directory is itself. If not, print ERROR: root directory does not exist.
-    */
-    fprintf(stderr, "ERROR: root directory does not exist.\n");
-    exit(1);
+
+  // validate rules 1 through 12 in one pass over the image, or over a sample of it
+  if (opts->quickSamples != 0)
+    r = geo->quickCheck(&src, &sb, opts, &rp);
+  else
+    r = geo->checkImage(&src, &sb, opts, &rp);
+
+  if (opts->collectAll)
+    reportPrintText(stderr, &rp);
+  else if (rp.count > 0)
+    fprintf(stderr, "%s\n", rp.diags[0].error);
+  if (src.readErrors > 0) {
+    fprintf(stderr, "read error\n");
+    r = 1;
   }
+  if (rp.digests.done)
+    digestsPrintText(stdout, path, &rp.digests);
+  if (rp.sample.done)
+    reportPrintSample(stdout, &rp);
+  if (jsonPath != NULL) {
+    FILE *f = strcmp(jsonPath, "-") == 0 ? stdout : fopen(jsonPath, "w");
+    if (f == NULL) {
+      perror(jsonPath);
+      exit(1);
+    }
+    reportPrintJson(f, path, &rp);
+    if (f != stdout)
+      fclose(f);
+  }
+  reportFree(&rp);
+  sourceClose(&src);
+  return r;
 }
 
 /*
-Rule 4:
-  Each directory contains . and .. entries, and the . entry points to 
-  the directory itself. If not, print ERROR: directory not properly formatted.
+Print what changed in the metadata from one image to another of the same
+geometry, to stdout, and as JSON with -J; with -J - the text goes to
+stderr instead. Returns 0 if nothing changed, 1 if something did, 2 if
+the images could not be compared.
 */
-void validateRule4(char *addr, struct superblock *sb) {
-  int i, j, k, direntCount;
-  bool currEntry, parentEntry, currPToItself;
-  struct dirent *de;
-  
-  struct dinode *rInodeP = (struct dinode *) (addr + IBLOCK((uint)0)*BLOCK_SIZE);
-  direntCount = rInodeP[ROOTINO].size/sizeof(struct dirent);
-
-  // iterate through all inodes
-  for (i = 1; i < sb->ninodes; i++, rInodeP++) {
-    if (rInodeP->addrs == 0) // unallocated
-      continue;
-    if (rInodeP->type == 0) // not in use
-      continue;
-    if (rInodeP->type == 1) { // directory inode
-      if (rInodeP->addrs != 0) {
-        currEntry = false;
-        parentEntry = false;
-        currPToItself = false;
-        // check direct blocks
-        for (j = 0; j < NDIRECT; j++) {
-          if (rInodeP->addrs[j] == 0) // unallocated
-            continue;
-          de = (struct dirent *) (addr + (rInodeP->addrs[j])*BLOCK_SIZE);
-          if (de != 0) {
-            // iterate through dirents of the inode
-            for (k = 0; k < direntCount; k++,de++) {
-              if (de == 0 || de->inum == 0)
-                continue;
-              if (strcmp(de->name,".") == 0) {
-                currEntry = true;
-                // dirent . should have rInodeP's inode number (i-1)
-                if (de->inum == i - 1)
-                  currPToItself = true;
-              }
-              if (strcmp(de->name,"..") == 0)
-                parentEntry = true;
-              if (currEntry && parentEntry && currPToItself)
-                break;
-            }
-          }
-          if (currEntry && parentEntry && currPToItself)
-            break;
-        }
-        // check indirect blocks
-        uint indAddr = rInodeP->addrs[NDIRECT];
-        if (indAddr == 0) { // unallocated
-          if (!currEntry || !parentEntry || !currPToItself) {
-            /*
-            Rule 4:
-              Each directory contains . and .. entries, and the . entry points to 
-              the directory itself. If not, print ERROR: directory not properly formatted.
-            */
-            fprintf(stderr, "ERROR: directory not properly formatted.\n");
-            exit(1);
-          } else
-            continue;
-        }
-        uint *indTemp = (uint *) (addr + indAddr * BLOCK_SIZE);
-        for (j = 0; j < NINDIRECT; j++, indTemp++) {
-          if ((*indTemp) == 0) // not allocated
-            continue;
-          de = (struct dirent *) (addr + (*indTemp)*BLOCK_SIZE);
-          if (de != 0) {
-            // iterate through dirents of the inode
-            for (k = 0; k < direntCount; k++,de++) {
-              if (de == 0 || de->inum == 0)
-                continue;
-              if (strcmp(de->name,".") == 0) {
-                currEntry = true;
-                // dirent . should have rInodeP's inode number (i-1)
-                if (de->inum == i - 1)
-                  currPToItself = true;
-              }
-              if (strcmp(de->name,"..") == 0)
-                parentEntry = true;
-              if (currEntry && parentEntry && currPToItself)
-                break;
-            }
-          }
-          if (currEntry && parentEntry && currPToItself)
-            break;
-        }
-        if (!currEntry || !parentEntry || !currPToItself) {
-          /*
-          Rule 4:
-            Each directory contains . and .. entries, and the . entry points to 
-            the directory itself. If not, print ERROR: directory not properly formatted.
-          */
-          fprintf(stderr, "ERROR: directory not properly formatted.\n");
-          exit(1);
-        }
-      }
+int diffFiles(const char *before, const char *after, struct checkopts *opts, const char *jsonPath) {
+  const char *path[2] = { before, after }, *failure = NULL;
+  struct blocksource src[2];
+  struct superblock sb[2];
+  const struct geometry *geo[2];
+  struct delta delta = { 0 };
+  int s, r;
+
+  for (s = 0; s < 2; s++) {
+    if ((failure = openImage(path[s], opts, &src[s], &sb[s], &geo[s])) != NULL) {
+      fprintf(stderr, "%s: %s\n", path[s], failure);
+      if (s == 1)
+        sourceClose(&src[0]);
+      return 2;
     }
   }
-}
+  if (geo[0] != geo[1]) {
+    fprintf(stderr, "images of different geometries\n");
+    sourceClose(&src[0]);
+    sourceClose(&src[1]);
+    return 2;
+  }
 
-/*
-Rule 5:
-  For in-use inodes, each block address in use is also marked in use in the 
-  bitmap. If not, print ERROR: address used by inode but marked free in bitmap.
-*/
-void validateRule5(char *addr, struct superblock *sb) {
-  int i, j;
-  uint inodeBlockCount = (sb->ninodes/IPB) + 1;
-  uint lastBitmapBlock = BBLOCK(IBLOCK(sb->ninodes - 1), sb->ninodes);
-  struct dinode *rInodeP = (struct dinode *) (addr + IBLOCK((uint)0)*BLOCK_SIZE);
-  // root inode's bitmap block address
-  char* bitmapBlock = (char*) ((char *)rInodeP + inodeBlockCount * BLOCK_SIZE);
-  char bitMask[8] = {0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80};
-
-  // iterate through all inodes
-  for (i = 1; i < sb->ninodes; i++, rInodeP++) {
-    if (rInodeP->addrs == 0) // unallocated
-      continue;
-    if (rInodeP->type == 0) // not in use
-      continue;
-    if (rInodeP->type == 1 || rInodeP->type == 2 || rInodeP->type == 3) { // in use inode
-      // check direct blocks
-      for (j = 0; j < NDIRECT; j++) {
-        if (rInodeP->addrs[j] == 0) // unallocated
-          continue;
-        // within valid range
-        if (rInodeP->addrs[j] <= lastBitmapBlock || rInodeP->addrs[j] >= sb->nblocks)
-          continue;
-        // bitwise addition that returns bitmapBlock status of rInodeP->addrs[j] block
-        uint isPresentBitmap = *(bitmapBlock+ (rInodeP->addrs[j])/8) & bitMask[(rInodeP->addrs[j])%8];
-        // If bitmap is set as free, throw error
-        if (!isPresentBitmap) {
-          /*
-          Rule 5:
-            For in-use inodes, each block address in use is also marked in use in the 
-            bitmap. If not, print ERROR: address used by inode but marked free in bitmap.
-          */
-          fprintf(stderr, "ERROR: address used by inode but marked free in bitmap.\n");
-          exit(1);
-        }
-      }
-      // check indirect blocks
-      uint indAddr = rInodeP->addrs[NDIRECT];
-      if (indAddr == 0) // unallocated
-        continue;
-      else {
-        uint *indTemp = (uint *) (addr + indAddr * BLOCK_SIZE);
-        for (j = 0; j < NINDIRECT; j++, indTemp++) {
-          if ((*indTemp) == 0) // not allocated
-            continue;
-          // bitwise addition that returns bitmapBlock status of (*indTemp) block
-          uint isPresentBitmap = *(bitmapBlock+ (*indTemp)/8) & bitMask[(*indTemp)%8];
-          // If bitmap is set as free, throw error
-          if (!isPresentBitmap) {
-            /*
-            Rule 5:
-              For in-use inodes, each block address in use is also marked in use in the 
-              bitmap. If not, print ERROR: address used by inode but marked free in bitmap.
-            */
-            fprintf(stderr, "ERROR: address used by inode but marked free in bitmap.\n");
-            exit(1);
-          }
-        }
-      }
+  geo[0]->diffImages(&src[0], &sb[0], &src[1], &sb[1], &delta);
+  r = delta.count > 0;
+  if (src[0].readErrors > 0 || src[1].readErrors > 0) {
+    fprintf(stderr, "read error\n");
+    r = 2;
+  }
+  // with -J - the standard output is the JSON alone
+  deltaPrintText(jsonPath != NULL && strcmp(jsonPath, "-") == 0 ? stderr : stdout, &delta);
+  if (jsonPath != NULL) {
+    FILE *f = strcmp(jsonPath, "-") == 0 ? stdout : fopen(jsonPath, "w");
+    if (f == NULL) {
+      perror(jsonPath);
+      exit(2);
     }
+    deltaPrintJson(f, before, after, &delta);
+    if (f != stdout)
+      fclose(f);
   }
+  deltaFree(&delta);
+  sourceClose(&src[0]);
+  sourceClose(&src[1]);
+  return r;
 }
 
 /*
-Rule 6:
-  For blocks marked in-use in bitmap, the block should actually be in-use in an 
-  inode or indirect block somewhere. If not, print ERROR: bitmap marks block 
-  in use but it is not in use.
+Check a batch of images on a pool of worker threads. Workers take the next
+image in list order; an image only starts once its heap fits under the
+memory cap next to the images being checked, except when nothing else is
+running. Results go to stdout in list order as soon as every image before
+them is done, followed by a summary. Returns 1 unless every image is clean.
 */
-void validateRule6(char *addr, struct superblock *sb) {
-  int i, j;
-  uint inodeBlockCount = (sb->ninodes/IPB) + 1;
-  uint firstDataBlock = BBLOCK(IBLOCK(sb->ninodes - 1), sb->ninodes) + 1;
-  char bitMask[8] = {0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80};
-
-  struct dinode *rInodeP = (struct dinode *) (addr + IBLOCK((uint)0)*BLOCK_SIZE);
-  // root inode's bitmap block address
-  char* bitmapBlock = (char*) ((char *)rInodeP + inodeBlockCount * BLOCK_SIZE);
-  
-  uint isBlockUsed[sb->nblocks]; // keep track of used datablocks
-  memset(isBlockUsed, 0, sb->nblocks * sizeof(uint)); // set all values to zero
-
-  // First iterate through all inodes, mark used datablocks in isBlockUsed
-  for (i = 0; i < sb->ninodes; i++, rInodeP++) {
-    if (rInodeP->type == 0) // not in use
-      continue;
-    if (rInodeP->type == 1 || rInodeP->type == 2 || rInodeP->type == 3) { // in use inode
-      // check direct blocks
-      for (j = 0; j < NDIRECT; j++) {
-        if (rInodeP->addrs[j] == 0) // unallocated
-          continue;
-        // mark datablock as used
-        isBlockUsed[rInodeP->addrs[j] - firstDataBlock] = 1;
-      }
-      // check indirect blocks
-      uint indAddr = rInodeP->addrs[NDIRECT];
-      if (indAddr == 0) // unallocated
-        continue;
-      // mark datablock as used
-      isBlockUsed[indAddr - firstDataBlock] = 1;
-      uint *indTemp = (uint *) (addr + indAddr * BLOCK_SIZE);
-      for (j = 0; j < NINDIRECT; j++, indTemp++) {
-        if ((*indTemp) == 0) // not allocated
-          continue;
-        // mark datablock as used
-        isBlockUsed[(*indTemp) - firstDataBlock] = 1;
-      }
+int checkBatch(struct batch *b, int nworkers, const char *jsonPath) {
+  int t;
+  size_t i, clean = 0, failed = 0, unreadable = 0;
+  pthread_t *threads;
+
+  if (jsonPath != NULL) {
+    b->json = strcmp(jsonPath, "-") == 0 ? stdout : fopen(jsonPath, "w");
+    if (b->json == NULL) {
+      perror(jsonPath);
+      exit(1);
     }
+    fprintf(b->json, "[");
+  }
+  if ((size_t)nworkers > b->count)
+    nworkers = b->count ? b->count : 1;
+  threads = calloc(nworkers, sizeof(pthread_t));
+  if (threads == NULL) {
+    perror("calloc");
+    exit(1);
   }
-  // Now iterate through datablocks to find any possible discrepancies with bitmapBlock data
-  for (i = 0; i < sb->nblocks; i++) {
-    uint isPresentBitmap = *(bitmapBlock+ (firstDataBlock + i)/8) & bitMask[(firstDataBlock + i)%8];
-    // if datablock is not used, but marked in bitmap as used
-    if (isBlockUsed[i] == 0 && isPresentBitmap) {
-      /*
-      Rule 6:
-        For blocks marked in-use in bitmap, the block should actually be in-use in an 
-        inode or indirect block somewhere. If not, print ERROR: bitmap marks block 
-        in use but it is not in use.
-      */
-      fprintf(stderr, "ERROR: bitmap marks block in use but it is not in use.\n");
+  pthread_mutex_init(&b->lock, NULL);
+  pthread_cond_init(&b->memFreed, NULL);
+  for (t = 1; t < nworkers; t++) {
+    if (pthread_create(&threads[t], NULL, batchWorker, b) != 0) {
+      perror("pthread_create");
       exit(1);
     }
   }
+  batchWorker(b);
+  for (t = 1; t < nworkers; t++)
+    pthread_join(threads[t], NULL);
+
+  for (i = 0; i < b->count; i++) {
+    if (b->images[i].failure != NULL)
+      unreadable++;
+    else if (b->images[i].status != 0)
+      failed++;
+    else
+      clean++;
+  }
+  printf("%zu image%s: %zu clean, %zu with errors, %zu not checked\n",
+         b->count, b->count == 1 ? "" : "s", clean, failed, unreadable);
+  if (b->json != NULL) {
+    fprintf(b->json, "%s]\n", b->count ? "\n" : "");
+    if (b->json != stdout)
+      fclose(b->json);
+  }
+
+  free(threads);
+  pthread_mutex_destroy(&b->lock);
+  pthread_cond_destroy(&b->memFreed);
+  for (i = 0; i < b->count; i++)
+    free(b->images[i].path);
+  free(b->images);
+  return failed + unreadable > 0;
 }
 
-/*
-Rule 7:
-  For in-use inodes, each direct address in use is only used once. If not, 
-  print ERROR: direct address used more than once.
+// check images of the batch until none are left
+void *batchWorker(void *arg) {
+  struct batch *b = arg;
+  struct batchimage *img;
+  struct blocksource src;
+  struct superblock sb;
+  const struct geometry *geo;
+  uint64_t need;
 
-Rule 8:
-  For in-use inodes, each indirect address in use is only used once. If not, 
-  print ERROR: indirect address used more than once.
-*/
-void validateRule7_8(char *addr, struct superblock *sb) {
-  int i, j;
-  uint firstDataBlock = BBLOCK(IBLOCK(sb->ninodes - 1), sb->ninodes) + 1;
-  struct dinode *rInodeP = (struct dinode *) (addr + IBLOCK((uint)0)*BLOCK_SIZE);
-
-  uint isBlockUsed[sb->nblocks]; // keep track of used datablocks
-  memset(isBlockUsed, 0, sb->nblocks * sizeof(uint)); // set all values to zero
-  
-  // Iterate through all inodes, mark used datablocks in isBlockUsed[]
-  for (i = 0; i < sb->ninodes; i++, rInodeP++) {
-    if (rInodeP->type == 0) // not in use
-      continue;
-    if (rInodeP->type == 1 || rInodeP->type == 2 || rInodeP->type == 3) { // in use inode
-      // check direct blocks
-      for (j = 0; j < NDIRECT; j++) {
-        if (rInodeP->addrs[j] == 0) // unallocated
-          continue;
-        // mark data block as used
-        if (isBlockUsed[rInodeP->addrs[j] - firstDataBlock] == 1) { // already used
-          /*
-          Rule 7:
-            For in-use inodes, each direct address in use is only used once. If not, 
-            print ERROR: direct address used more than once.
-          */
-          fprintf(stderr, "ERROR: direct address used more than once.\n");
-          exit(1);
-        } else
-          isBlockUsed[rInodeP->addrs[j] - firstDataBlock] = 1;
-      }
-      // check indirect blocks
-      uint indAddr = rInodeP->addrs[NDIRECT];
-      if (indAddr == 0) // unallocated
-        continue;
-      // mark data block as used
-      if (isBlockUsed[indAddr - firstDataBlock] == 1) { // already used
-        /*
-        Rule 8:
-          For in-use inodes, each indirect address in use is only used once. If not, 
-          print ERROR: indirect address used more than once.
-        */
-        fprintf(stderr, "ERROR: indirect address used more than once.\n");
-        exit(1);
-      } else
-        isBlockUsed[indAddr - firstDataBlock] = 1;
-      uint *indTemp = (uint *) (addr + indAddr * BLOCK_SIZE);
-      for (j = 0; j < NINDIRECT; j++, indTemp++) {
-        if ((*indTemp) == 0) // not allocated
-          continue;
-        // mark data block as used
-        if (isBlockUsed[(*indTemp) - firstDataBlock] == 1) { // already used
-          /*
-          Rule 8:
-            For in-use inodes, each indirect address in use is only used once. If not, 
-            print ERROR: indirect address used more than once.
-          */
-          fprintf(stderr, "ERROR: indirect address used more than once.\n");
-          exit(1);
-        } else
-          isBlockUsed[(*indTemp) - firstDataBlock] = 1;
-      }
+  pthread_mutex_lock(&b->lock);
+  while (b->next < b->count) {
+    img = &b->images[b->next++];
+    pthread_mutex_unlock(&b->lock);
+
+    img->failure = openImage(img->path, b->opts, &src, &sb, &geo);
+    if (img->failure == NULL) {
+      need = geo->checkMemory(&sb, b->opts);
+
+      // wait for room under the cap
+      pthread_mutex_lock(&b->lock);
+      while (b->memCap != 0 && b->running > 0 && b->memInUse + need > b->memCap)
+        pthread_cond_wait(&b->memFreed, &b->lock);
+      b->running++;
+      b->memInUse += need;
+      pthread_mutex_unlock(&b->lock);
+
+      img->status = geo->checkImage(&src, &sb, b->opts, &img->report);
+      if (src.readErrors > 0)
+        img->failure = "read error";
+      sourceClose(&src);
+
+      pthread_mutex_lock(&b->lock);
+      b->running--;
+      b->memInUse -= need;
+      pthread_cond_broadcast(&b->memFreed);
+      pthread_mutex_unlock(&b->lock);
     }
+
+    pthread_mutex_lock(&b->lock);
+    img->done = true;
+    batchPrint(b);
   }
+  pthread_mutex_unlock(&b->lock);
+  return NULL;
 }
 
-/*
-Rule 9:
-  For all inodes marked in use, each must be referred to in at least one 
-  directory. If not, print ERROR: inode marked use but not found in a directory.
-*/
-void validateRule9(char *addr, struct superblock *sb) {
-  int i, j, k, direntCount;
-  struct dirent *de;
-  struct dinode *rInodeP = (struct dinode *) (addr + IBLOCK((uint)0)*BLOCK_SIZE);
-  direntCount = rInodeP[ROOTINO].size/sizeof(struct dirent);
-
-  uint isInodeInDir[sb->ninodes]; // tracks every inode found in directories
-  memset(isInodeInDir, 0, sb->ninodes * sizeof(uint)); // set all values to zero
-  
-  // Iterate through all directory inodes
-  for (i = 0; i < sb->ninodes; i++, rInodeP++) {
-    if (rInodeP->addrs == 0) // unallocated
-      continue;
-    if (rInodeP->type == 0) // not in use
-      continue;
-    if (rInodeP->type == 1) { // directory
-      if (rInodeP->addrs != 0) {
-        // check direct blocks
-        for (j = 0; j < NDIRECT; j++) {
-          if (rInodeP->addrs[j] == 0) // unallocated
-            continue;
-          de = (struct dirent *) (addr + (rInodeP->addrs[j])*BLOCK_SIZE);
-          if (de != 0) {
-            // iterate through dirents of the inode
-            for (k = 0; k < direntCount; k++,de++) {
-              if (de == 0 || de->inum == 0)
-                continue;
-              isInodeInDir[de->inum]++; // increment reference count for this inode
-            }
-          }
-        }
-        // check indirect blocks
-        uint indAddr = rInodeP->addrs[NDIRECT];
-        if (indAddr == 0) // unallocated
-          continue;
-        uint *indTemp = (uint *) (addr + indAddr * BLOCK_SIZE);
-        for (j = 0; j < NINDIRECT; j++, indTemp++) {
-          if ((*indTemp) == 0) // not allocated
-            continue;
-          de = (struct dirent *) (addr + (*indTemp)*BLOCK_SIZE);
-          if (de != 0) {
-            // iterate through dirents of the inode
-            for (k = 0; k < direntCount; k++,de++) {
-              if (de == 0 || de->inum == 0)
-                continue;
-              isInodeInDir[de->inum]++; // increment reference count for this inode
-            }
-          }
-        }
-      }
-    }
-  }
-  // Iterate through all inodes, check isInodeInDir[i] to see if it is referenced
-  rInodeP = (struct dinode *) (addr + IBLOCK((uint)0)*BLOCK_SIZE);
-  for (i = 0; i < sb->ninodes; i++, rInodeP++) {
-    if (rInodeP->type == 0) // not in use
-      continue;
-    if (rInodeP->type == 1 || rInodeP->type == 2 || rInodeP->type == 3) { // in use inode
-      if (isInodeInDir[i] == 0) { // used inode, but not found in a directory
-        /*
-        Rule 9:
-          For all inodes marked in use, each must be referred to in at least one 
-          directory. If not, print ERROR: inode marked use but not found in a directory.
-        */
-        fprintf(stderr, "ERROR: inode marked use but not found in a directory.\n");
-        exit(1);
-      }
+// print the results of the images that are done and follow printed ones,
+// called with the batch lock held
+void batchPrint(struct batch *b) {
+  struct batchimage *img;
+
+  for (; b->printed < b->count && b->images[b->printed].done; b->printed++) {
+    img = &b->images[b->printed];
+    reportPrintResult(stdout, img->path, img->failure, &img->report, b->opts->collectAll);
+    if (b->json != NULL) {
+      fprintf(b->json, "%s\n", b->printed ? "," : "");
+      if (img->failure != NULL)
+        reportPrintJsonFailure(b->json, img->path, img->failure);
+      else
+        reportPrintJson(b->json, img->path, &img->report);
     }
+    reportFree(&img->report);
   }
+  fflush(stdout);
 }
 
-/*
-Rule 10:
-  For each inode number that is referred to in a valid directory, it is 
-  actually marked in use. If not, print ERROR: inode referred to in 
-  directory but marked free.
-*/
-void validateRule10(char *addr, struct superblock *sb) {
-  int i, j, k, direntCount;
-  struct dirent *de;
-  struct dinode *rInodeP = (struct dinode *) (addr + IBLOCK((uint)0)*BLOCK_SIZE);
-  direntCount = rInodeP[ROOTINO].size/sizeof(struct dirent);
-  
-  uint isInodeInUse[sb->ninodes]; // tracks every inode in use
-  memset(isInodeInUse, 0, sb->ninodes * sizeof(uint)); // set all values to zero
-  
-  // Iterate through all inodes, set isInodeInUse[i] for every inode in use
-  for (i = 0; i < sb->ninodes; i++, rInodeP++) {
-    if (rInodeP->type == 0) // not in use
-      continue;
-    if (rInodeP->type == 1 || rInodeP->type == 2 || rInodeP->type == 3) // in use inode
-      isInodeInUse[i]++; // increment isInodeInUse for this inode
-  }
-  // Iterate through all directory inodes
-  rInodeP = (struct dinode *) (addr + IBLOCK((uint)0)*BLOCK_SIZE);
-  for (i = 0; i < sb->ninodes; i++, rInodeP++) {
-    if (rInodeP->addrs == 0) // unallocated
-      continue;
-    if (rInodeP->type == 0) // not in use
-      continue;
-    if (rInodeP->type == 1) { // directory
-      if (rInodeP->addrs != 0) {
-        // check direct blocks
-        for (j = 0; j < NDIRECT; j++) {
-          if (rInodeP->addrs[j] == 0) // unallocated
-            continue;
-          de = (struct dirent *) (addr + (rInodeP->addrs[j])*BLOCK_SIZE);
-          if (de != 0) {
-            // iterate through dirents of the inode
-            for (k = 0; k < direntCount; k++,de++) {
-              if (de == 0 || de->inum == 0)
-                continue;
-              if (isInodeInUse[de->inum] == 0) { // if inode is not used but found in directory
-                /*
-                Rule 10:
-                  For each inode number that is referred to in a valid directory, it is 
-                  actually marked in use. If not, print ERROR: inode referred to in 
-                  directory but marked free.
-                */
-                fprintf(stderr, "ERROR: inode referred to in directory but marked free.\n");
-                exit(1);
-              }
-            }
-          }
-        }
-        // check indirect blocks
-        uint indAddr = rInodeP->addrs[NDIRECT];
-        if (indAddr == 0) // unallocated
-          continue;
-        uint *indTemp = (uint *) (addr + indAddr * BLOCK_SIZE);
-        for (j = 0; j < NINDIRECT; j++, indTemp++) {
-          if ((*indTemp) == 0) // not allocated
-            continue;
-          de = (struct dirent *) (addr + (*indTemp)*BLOCK_SIZE);
-          if (de != 0) {
-            // iterate through dirents of the inode
-            for (k = 0; k < direntCount; k++,de++) {
-              if (de == 0 || de->inum == 0)
-                continue;
-              if (isInodeInUse[de->inum] == 0) { // if inode is not used but found in directory
-                /*
-                Rule 10:
-                  For each inode number that is referred to in a valid directory, it is 
-                  actually marked in use. If not, print ERROR: inode referred to in 
-                  directory but marked free.
-                */
-                fprintf(stderr, "ERROR: inode referred to in directory but marked free.\n");
-                exit(1);
-              }
-            }
-          }
-        }
-      }
+// append an image path to the batch
+void batchAdd(struct batch *b, const char *path) {
+  if (b->count == b->capacity) {
+    size_t capacity = b->capacity ? b->capacity * 2 : 64;
+    struct batchimage *images = realloc(b->images, capacity * sizeof(struct batchimage));
+    if (images == NULL) {
+      perror("batch");
+      exit(1);
     }
+    b->images = images;
+    b->capacity = capacity;
+  }
+  memset(&b->images[b->count], 0, sizeof(struct batchimage));
+  b->images[b->count].path = strdup(path);
+  if (b->images[b->count].path == NULL) {
+    perror("batch");
+    exit(1);
   }
+  b->count++;
 }
 
-/*
-Rule 11:
-  Reference counts (number of links) for regular files match the number of 
-  times file is referred to in directories (i.e., hard links work correctly). 
-  If not, print ERROR: bad reference count for file.
-
-Rule 12:
-  No extra links allowed for directories (each directory only appears in one 
-  other directory). If not, print ERROR: directory appears more than once 
-  in file system.
-*/
-void validateRule11_12(char *addr, struct superblock *sb) {
-  int i, j, k, direntCount;
-  struct dirent *de;
-  struct dinode *rInodeP = (struct dinode *) (addr + IBLOCK((uint)0)*BLOCK_SIZE);
-  direntCount = rInodeP[ROOTINO].size/sizeof(struct dirent);
-
-  uint inodeRefCount[sb->ninodes]; // keeps track of inode reference count 
-  memset(inodeRefCount, 0, sb->ninodes * sizeof(uint)); // set all values to zero
-
-  // Iterate through all directory inodes
-  for (i = 0; i < sb->ninodes; i++, rInodeP++) {
-    if (rInodeP->addrs == 0) // unallocated
-      continue;
-    if (rInodeP->type == 0) // not in use
-      continue;
-    if (rInodeP->type == 1) { // directory
-      if (rInodeP->addrs != 0) {
-        // check direct blocks
-        for (j = 0; j < NDIRECT; j++) {
-          if (rInodeP->addrs[j] == 0) // unallocated
-            continue;
-          de = (struct dirent *) (addr + (rInodeP->addrs[j])*BLOCK_SIZE);
-          if (de != 0) {
-            // iterate through dirents of the inode
-            for (k = 0; k < direntCount; k++,de++) {
-              if (de == 0 || de->inum == 0 || 
-                  strcmp(de->name,".") == 0 || strcmp(de->name,"..") == 0)
-                continue;
-              inodeRefCount[de->inum]++; // keep track of reference count
-            }
-          }
-        }
-        // check indirect blocks
-        uint indAddr = rInodeP->addrs[NDIRECT];
-        if (indAddr == 0) // unallocated
-          continue;
-        uint *indTemp = (uint *) (addr + indAddr * BLOCK_SIZE);
-        for (j = 0; j < NINDIRECT; j++, indTemp++) {
-          if ((*indTemp) == 0) // not allocated
-            continue;
-          de = (struct dirent *) (addr + (*indTemp)*BLOCK_SIZE);
-          if (de != 0) {
-            // iterate through dirents of the inode
-            for (k = 0; k < direntCount; k++,de++) {
-              if (de == 0 || de->inum == 0 ||
-                  strcmp(de->name,".") == 0 || strcmp(de->name,"..") == 0)
-                continue;
-              inodeRefCount[de->inum]++; // keep track of reference count
-            }
-          }
-        }
-      }
-    }
+// append the paths listed in file, one per line, - for stdin
+void batchRead(struct batch *b, const char *file) {
+  FILE *f = strcmp(file, "-") == 0 ? stdin : fopen(file, "r");
+  char *line = NULL;
+  size_t cap = 0;
+  ssize_t n;
+
+  if (f == NULL) {
+    perror(file);
+    exit(1);
   }
-  // Iterate through all inodes
-  rInodeP = (struct dinode *) (addr + IBLOCK((uint)0)*BLOCK_SIZE);
-  for (i = 0; i < sb->ninodes; i++, rInodeP++) {
-    if (rInodeP->type == 0) // not in use
-      continue;
-    if (rInodeP->type == 2) { // in use file inode
-      if (inodeRefCount[i] != rInodeP->nlink) {
-        /*
-        Rule 11:
-          Reference counts (number of links) for regular files match the number of 
-          times file is referred to in directories (i.e., hard links work correctly). 
-          If not, print ERROR: bad reference count for file.
-        */
-        fprintf(stderr, "ERROR: bad reference count for file.\n");
-        exit(1);
-      }
-    }
-    if (rInodeP->type == 1) { // in use directory inode
-      if (inodeRefCount[i] > 1) { // if directory is referenced more than once
-        /*
-        Rule 12:
-          No extra links allowed for directories (each directory only appears in one 
-          other directory). If not, print ERROR: directory appears more than once 
-          in file system.
-        */
-        fprintf(stderr, "ERROR: directory appears more than once in file system.\n");
-        exit(1);
-      }
-    }
+  while ((n = getline(&line, &cap, f)) != -1) {
+    while (n > 0 && (line[n - 1] == '\n' || line[n - 1] == '\r'))
+      line[--n] = '\0';
+    if (n > 0)
+      batchAdd(b, line);
   }
-}
\ No newline at end of file
+  free(line);
+  if (f != stdin)
+    fclose(f);
+}
@@ -0,0 +1,118 @@
+// Image fingerprints
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "types.h"
+#include "fs.h"
+#include "fingerprint.h"
+
+#define PIECE_CHUNKS (FP_PIECE_BYTES / BLAKE3_CHUNK_LEN)
+
+const char *regionNames[NREGION] = { "super", "inodes", "bitmap", "data" };
+
+// pieces hashed as subtrees in a region of n blocks: all but the last
+static uint subtreePieces(struct fingerprint *fp, uint n) {
+  return n == 0 ? 0 : (n - 1) / fp->pieceBlocks;
+}
+
+// blockSize is a power of two of at most FP_PIECE_BYTES
+void fingerprintInit(struct fingerprint *fp, const uint start[NREGION + 1], uint blockSize) {
+  int r;
+
+  memset(fp, 0, sizeof(*fp));
+  memcpy(fp->start, start, sizeof(fp->start));
+  fp->pieceBlocks = FP_PIECE_BYTES / blockSize;
+  for (r = 0; r < NREGION; r++)
+    fp->pieceStart[r + 1] = fp->pieceStart[r] + subtreePieces(fp, start[r + 1] - start[r]);
+  fp->cvs = malloc(((size_t)fp->pieceStart[NREGION] + 1) * sizeof(*fp->cvs));
+  if (fp->cvs == NULL) {
+    perror("fingerprint");
+    exit(1);
+  }
+}
+
+// Hash the next piece nobody has taken, any thread. buf holds a piece,
+// scratch a chaining value per chunk of it. Returns false when none are left.
+bool fingerprintWork(struct fingerprint *fp, struct blocksource *src, void *buf,
+                     uint32_t *scratch) {
+  uint k = __atomic_fetch_add(&fp->next, 1, __ATOMIC_RELAXED), p;
+  int r = 0;
+  const void *data;
+
+  if (k >= fp->pieceStart[NREGION])
+    return false;
+  while (k >= fp->pieceStart[r + 1])
+    r++;
+  p = k - fp->pieceStart[r];
+  // the kernel can fetch the next piece while this one is hashed
+  sourceWillNeed(src, fp->start[r] + (p + 1) * fp->pieceBlocks, fp->pieceBlocks);
+  data = sourceBlocks(src, fp->start[r] + p * fp->pieceBlocks, fp->pieceBlocks, buf);
+  blake3Subtree(data, PIECE_CHUNKS, (uint64_t)p * PIECE_CHUNKS, scratch, fp->cvs[k]);
+  return true;
+}
+
+// join the pieces of every region once all are hashed, and hash the
+// last piece of each
+void fingerprintFinish(struct fingerprint *fp, struct blocksource *src, void *buf,
+                       struct digests *dg) {
+  struct blake3 h;
+  uint k, last, n;
+  int r;
+
+  for (r = 0; r < NREGION; r++) {
+    blake3Init(&h);
+    for (k = fp->pieceStart[r]; k < fp->pieceStart[r + 1]; k++)
+      blake3PushSubtree(&h, fp->cvs[k], PIECE_CHUNKS);
+    last = fp->start[r] + (fp->pieceStart[r + 1] - fp->pieceStart[r]) * fp->pieceBlocks;
+    n = fp->start[r + 1] - last;
+    if (n > 0)
+      blake3Update(&h, sourceBlocks(src, last, n, buf), (size_t)n * src->blockSize);
+    blake3Final(&h, dg->region[r]);
+  }
+  blake3Init(&h);
+  blake3Update(&h, dg->region, sizeof(dg->region));
+  blake3Final(&h, dg->image);
+  dg->done = true;
+}
+
+void fingerprintFree(struct fingerprint *fp) {
+  free(fp->cvs);
+  fp->cvs = NULL;
+}
+
+static void printHex(FILE *f, const uint8_t *d) {
+  int i;
+
+  for (i = 0; i < BLAKE3_OUT_LEN; i++)
+    fprintf(f, "%02x", d[i]);
+}
+
+// one line per digest, the image first
+void digestsPrintText(FILE *f, const char *image, const struct digests *dg) {
+  int r;
+
+  fprintf(f, "%s: image  ", image);
+  printHex(f, dg->image);
+  fprintf(f, "\n");
+  for (r = 0; r < NREGION; r++) {
+    fprintf(f, "%s: %-6s ", image, regionNames[r]);
+    printHex(f, dg->region[r]);
+    fprintf(f, "\n");
+  }
+}
+
+// the digests as the members of a JSON object
+void digestsPrintJson(FILE *f, const struct digests *dg) {
+  int r;
+
+  fprintf(f, "{\"image\": \"");
+  printHex(f, dg->image);
+  fprintf(f, "\"");
+  for (r = 0; r < NREGION; r++) {
+    fprintf(f, ", \"%s\": \"", regionNames[r]);
+    printHex(f, dg->region[r]);
+    fprintf(f, "\"");
+  }
+  fprintf(f, "}");
+}
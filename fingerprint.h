@@ -0,0 +1,57 @@
+#ifndef _FINGERPRINT_H_
+#define _FINGERPRINT_H_
+
+// Image fingerprints, for -F: the BLAKE3 digest of every region of the
+// image and a digest of the whole image made from them. Regions are cut
+// into pieces of FP_PIECE_BYTES bytes that the scanning threads hash as
+// independent subtrees once the inode table is done, so the image is read
+// once for the check and the fingerprint.
+// Include types.h and fs.h first.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "blake3.h"
+#include "blocksource.h"
+
+#define FP_PIECE_BYTES (1 << 20)  // bytes of a piece, a power of two of chunks
+
+// regions of the image, in block order
+enum {
+  REGION_SUPER,               // boot block and super block
+  REGION_INODES,              // inode table
+  REGION_BITMAP,              // free bitmap
+  REGION_DATA,                // data blocks and anything after them
+  NREGION
+};
+
+struct digests {
+  bool done;                               // digests were computed
+  uint8_t image[BLAKE3_OUT_LEN];           // BLAKE3 of the region digests, in order
+  uint8_t region[NREGION][BLAKE3_OUT_LEN]; // BLAKE3 of the bytes of every region
+};
+
+// pieces being hashed. The last piece of every region is hashed by
+// fingerprintFinish, which is what lets it be partial and lets the digest
+// be the root of the tree.
+struct fingerprint {
+  uint start[NREGION + 1];      // region r is blocks [start[r], start[r + 1])
+  uint pieceBlocks;             // blocks in a piece
+  uint pieceStart[NREGION + 1]; // first piece of every region, among all pieces
+  uint32_t (*cvs)[8];           // chaining value of every piece
+  uint next;                    // next piece to hand out
+};
+
+extern const char *regionNames[NREGION];
+
+void fingerprintInit(struct fingerprint *fp, const uint start[NREGION + 1], uint blockSize);
+bool fingerprintWork(struct fingerprint *fp, struct blocksource *src, void *buf,
+                     uint32_t *scratch);
+void fingerprintFinish(struct fingerprint *fp, struct blocksource *src, void *buf,
+                       struct digests *dg);
+void fingerprintFree(struct fingerprint *fp);
+void digestsPrintText(FILE *f, const char *image, const struct digests *dg);
+void digestsPrintJson(FILE *f, const struct digests *dg);
+
+#endif // _FINGERPRINT_H_
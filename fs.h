@@ -7,20 +7,38 @@
 // Block 0 is unused.
 // Block 1 is super block.
 // Inodes start at block 2.
+// The log, if any, is the last nlog blocks.
+
+// The geometry can be set before including this file, see check.h.
 
 #define ROOTINO 1  // root i-number
+#ifndef BSIZE
 #define BSIZE 512  // block size
+#endif
 
 // File system super block
 struct superblock {
   uint size;         // Size of file system image (blocks)
   uint nblocks;      // Number of data blocks
   uint ninodes;      // Number of inodes.
+  uint nlog;         // Number of log blocks
 };
 
+#ifndef NDIRECT
 #define NDIRECT 12
+#endif
+// forks that grow MAXFILE add doubly and triply indirect addresses after
+// the indirect one
+#ifndef NDINDIRECT
+#define NDINDIRECT 0
+#endif
+#ifndef NTINDIRECT
+#define NTINDIRECT 0
+#endif
+#define NADDRS (NDIRECT + 1 + NDINDIRECT + NTINDIRECT)
 #define NINDIRECT (BSIZE / sizeof(uint))
-#define MAXFILE (NDIRECT + NINDIRECT)
+#define MAXFILE (NDIRECT + NINDIRECT + NDINDIRECT * NINDIRECT * NINDIRECT + \
+                 NTINDIRECT * NINDIRECT * NINDIRECT * NINDIRECT)
 
 // On-disk inode structure
 struct dinode {
@@ -29,7 +47,7 @@ struct dinode {
   short minor;          // Minor device number (T_DEV only)
   short nlink;          // Number of links to inode in file system
   uint size;            // Size of file (bytes)
-  uint addrs[NDIRECT+1];   // Data block addresses
+  uint addrs[NADDRS];   // Data block addresses
 };
 
 // Inodes per block.
@@ -44,6 +62,13 @@ struct dinode {
 // Block containing bit for block b
 #define BBLOCK(b, ninodes) (b/BPB + (ninodes)/IPB + 3)
 
+// Contents of the header block of the log, the first log block; the
+// committed blocks follow it, in the order of sector.
+struct logheader {
+  int n;             // committed blocks, 0 once installed
+  int sector[];      // home block of each
+};
+
 // Directory is a file containing a sequence of dirent structures.
 #define DIRSIZ 14
 
@@ -0,0 +1,59 @@
+// Fuzz target: every input is an image, checked through libfcheck
+//
+// Built with libFuzzer, which supplies main:
+//   clang -g -O1 -fsanitize=fuzzer,address,undefined fuzz.c <library sources> -pthread
+// Without it, -DFUZZ_MAIN adds a main that checks the files it is given
+// once each, to replay a crash or a corpus under any compiler.
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "libfcheck.h"
+
+// heap a fuzzed super block may ask for, so that a large ninodes or size
+// is refused up front instead of allocated
+#define FUZZ_MEMORY (64 << 20)
+
+// the errors are only there to be produced
+static void ignoreError(void *arg, const struct fcheckerror *error) {
+  (void) arg;
+  (void) error;
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+  // one context for the whole run, as a long-lived caller keeps it
+  static struct fcheck *fc;
+
+  if (fc == NULL) {
+    struct fcheckoptions o = { .all = true, .memory = FUZZ_MEMORY };
+    fc = fcheckNew(&o);
+  }
+  fcheckImage(fc, data, size, ignoreError, NULL);
+  return 0;
+}
+
+#ifdef FUZZ_MAIN
+int main(int argc, char *argv[]) {
+  int i;
+
+  for (i = 1; i < argc; i++) {
+    FILE *f = fopen(argv[i], "rb");
+    uint8_t *buf;
+    long size;
+    if (f == NULL || fseek(f, 0, SEEK_END) != 0 || (size = ftell(f)) < 0) {
+      perror(argv[i]);
+      return 1;
+    }
+    rewind(f);
+    if ((buf = malloc(size + 1)) == NULL || fread(buf, 1, size, f) != (size_t)size) {
+      perror(argv[i]);
+      return 1;
+    }
+    fclose(f);
+    LLVMFuzzerTestOneInput(buf, size);
+    free(buf);
+  }
+  return 0;
+}
+#endif
@@ -0,0 +1,7 @@
+// Checker for 1 KB blocks, 11 direct addresses and a doubly indirect one per
+// inode, the large-file layout of xv6
+#define BSIZE 1024
+#define NDIRECT 11
+#define NDINDIRECT 1
+#define GEOMETRY geom1024x11d
+#include "checker.c"
@@ -0,0 +1,5 @@
+// Checker for 1 KB blocks and 12 direct addresses per inode
+#define BSIZE 1024
+#define NDIRECT 12
+#define GEOMETRY geom1024x12
+#include "checker.c"
@@ -0,0 +1,5 @@
+// Checker for 1 KB blocks and 28 direct addresses per inode
+#define BSIZE 1024
+#define NDIRECT 28
+#define GEOMETRY geom1024x28
+#include "checker.c"
@@ -0,0 +1,8 @@
+// Checker for 4 KB blocks, 10 direct addresses and a doubly and a triply
+// indirect one per inode
+#define BSIZE 4096
+#define NDIRECT 10
+#define NDINDIRECT 1
+#define NTINDIRECT 1
+#define GEOMETRY geom4096x10t
+#include "checker.c"
@@ -0,0 +1,5 @@
+// Checker for 4 KB blocks and 12 direct addresses per inode
+#define BSIZE 4096
+#define NDIRECT 12
+#define GEOMETRY geom4096x12
+#include "checker.c"
@@ -0,0 +1,5 @@
+// Checker for 4 KB blocks and 28 direct addresses per inode
+#define BSIZE 4096
+#define NDIRECT 28
+#define GEOMETRY geom4096x28
+#include "checker.c"
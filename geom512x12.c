@@ -0,0 +1,5 @@
+// Checker for the stock xv6 geometry: 512 byte blocks and 12 direct addresses
+#define BSIZE 512
+#define NDIRECT 12
+#define GEOMETRY geom512x12
+#include "checker.c"
@@ -0,0 +1,107 @@
+// Opening images: the geometry of an image, its super block and its log
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "types.h"
+#include "fs.h"
+#include "check.h"
+
+// geometries a checker is built for, the stock one first
+static const struct geometry *geometries[] = {
+  &geom512x12, &geom1024x12, &geom1024x11d, &geom1024x28, &geom4096x12, &geom4096x10t,
+  &geom4096x28
+};
+#define NGEOMETRY (sizeof(geometries) / sizeof(geometries[0]))
+
+// open the image at path, pick its geometry, read its super block and
+// replay its log, returns why the image could not be opened or NULL
+const char *openImage(const char *path, struct checkopts *opts, struct blocksource *src,
+                      struct superblock *sb, const struct geometry **geo) {
+  const char *failure;
+
+  if ((failure = sourceOpen(src, path, opts->stream, opts->repair)) != NULL)
+    return failure;
+  if ((failure = loadImage(src, opts, sb, geo)) != NULL)
+    sourceClose(src);
+  return failure;
+}
+
+// pick the geometry of an open image, read and vet its super block and
+// replay its log, returns why the image cannot be checked or NULL
+const char *loadImage(struct blocksource *src, struct checkopts *opts, struct superblock *sb,
+                      const struct geometry **geo) {
+  const char *failure;
+
+  if (opts->geometry != NULL) {
+    *geo = opts->geometry;
+    readSuperBlock(src, *geo, sb);
+  } else
+    *geo = findGeometry(src, sb);
+  if ((failure = (*geo)->checkLayout(src, sb)) != NULL)
+    return failure;
+  return (*geo)->replayLog(src, sb);
+}
+
+/*
+Pick the checker for the geometry of an image. The super block does not
+record the block size, so each geometry reads it where it would be, in
+block 1. Of the geometries whose super block gives the size of the image,
+the one in which the most directories decode wins, then the one in which
+the most inodes have the addresses their size needs, the first one on a
+tie; if none does, the stock one.
+*/
+const struct geometry *findGeometry(struct blocksource *src, struct superblock *sb) {
+  const struct geometry *best = geometries[0];
+  size_t i;
+  long n, most = -1;
+
+  for (i = 0; i < NGEOMETRY; i++) {
+    readSuperBlock(src, geometries[i], sb);
+    if (sb->size != src->nblocks)
+      continue;
+    n = geometries[i]->probeDirs(src, sb);
+    if (n > most) {
+      most = n;
+      best = geometries[i];
+    }
+  }
+  readSuperBlock(src, best, sb);
+  return best;
+}
+
+// the geometry named by arg, BSIZE or BSIZE:NDIRECT, or NULL if no checker
+// is built for it
+const struct geometry *parseGeometry(const char *arg) {
+  char *end;
+  unsigned long bsize = strtoul(arg, &end, 10), ndirect = 0;
+
+  if (*end == ':')
+    ndirect = strtoul(end + 1, &end, 10);
+  if (*end != '\0' || bsize > UINT32_MAX || ndirect > UINT32_MAX)
+    return NULL;
+  return lookupGeometry(bsize, ndirect);
+}
+
+// the first geometry of blockSize with ndirect direct addresses, any number
+// if 0, or NULL if no checker is built for it
+const struct geometry *lookupGeometry(uint blockSize, uint ndirect) {
+  size_t i;
+
+  for (i = 0; i < NGEOMETRY; i++)
+    if (geometries[i]->blockSize == blockSize && (ndirect == 0 || geometries[i]->ndirect == ndirect))
+      return geometries[i];
+  return NULL;
+}
+
+// read the super block of geometry g, and count the blocks of the image in it
+void readSuperBlock(struct blocksource *src, const struct geometry *g, struct superblock *sb) {
+  char buf[BSIZE];
+
+  // block 1 of g, in blocks of the smallest geometry
+  sourceSetBlockSize(src, BSIZE);
+  memcpy(sb, sourceBlocks(src, g->blockSize / BSIZE, 1, buf), sizeof(*sb));
+  sourceSetBlockSize(src, g->blockSize);
+}
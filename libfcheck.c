@@ -0,0 +1,93 @@
+// The checker as a library
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "types.h"
+#include "fs.h"
+#include "check.h"
+#include "scratch.h"
+#include "libfcheck.h"
+
+struct fcheck {
+  struct checkopts opts;
+  struct scratch scratch;     // buffers of the last check, for the next one
+  struct report report;       // errors of the image being checked
+  size_t memory;              // heap an image may need, 0 for no limit
+  const char *failure;        // why the last image could not be checked, or NULL
+};
+
+struct fcheck *fcheckNew(const struct fcheckoptions *options) {
+  struct fcheck *fc;
+  const struct geometry *geo = NULL;
+
+  if (options->blockSize != 0 && (geo = lookupGeometry(options->blockSize, options->ndirect)) == NULL)
+    return NULL;
+  if ((fc = calloc(1, sizeof(*fc))) == NULL) {
+    perror("fcheck");
+    exit(1);
+  }
+  fc->opts.nthreads = options->threads > 0 ? options->threads : 1;
+  fc->opts.collectAll = options->all;
+  fc->opts.rules = options->rules;
+  fc->opts.geometry = geo;
+  fc->opts.scratch = &fc->scratch;
+  fc->memory = options->memory;
+  fc->report.scratch = &fc->scratch;
+  return fc;
+}
+
+int fcheckImage(struct fcheck *fc, const void *image, size_t size, fcheckcallback cb, void *arg) {
+  struct blocksource src;
+  struct superblock sb;
+  const struct geometry *geo;
+  struct fcheckerror e;
+  size_t i;
+  int status;
+
+  // nothing of the last check is in use any more
+  scratchReset(&fc->scratch);
+  if ((fc->failure = sourceOpenBuffer(&src, image, size)) != NULL)
+    return -1;
+  if ((fc->failure = loadImage(&src, &fc->opts, &sb, &geo)) != NULL) {
+    sourceClose(&src);
+    return -1;
+  }
+  // the super block says how large the state of the check is
+  if (fc->memory != 0 && geo->checkMemory(&sb, &fc->opts) > fc->memory) {
+    fc->failure = "image needs too much memory";
+    sourceClose(&src);
+    return -1;
+  }
+  status = geo->checkImage(&src, &sb, &fc->opts, &fc->report);
+  sourceClose(&src);
+
+  for (i = 0; cb != NULL && i < fc->report.count; i++) {
+    const struct diagnostic *d = &fc->report.diags[i];
+    e.rule = d->rule;
+    e.inode = d->inum;
+    e.block = d->block;
+    e.directory = d->dirInum;
+    e.entry = d->slot;
+    e.name = d->name;
+    e.owner = d->ownerUse != NULL ? d->owner : -1;
+    e.ownerUse = d->ownerUse;
+    e.message = d->error;
+    cb(arg, &e);
+  }
+  reportFree(&fc->report);
+  return status;
+}
+
+const char *fcheckFailure(const struct fcheck *fc) {
+  return fc->failure;
+}
+
+void fcheckFree(struct fcheck *fc) {
+  if (fc == NULL)
+    return;
+  reportFree(&fc->report);
+  scratchRelease(&fc->scratch);
+  free(fc);
+}
@@ -0,0 +1,54 @@
+#ifndef _LIBFCHECK_H_
+#define _LIBFCHECK_H_
+
+// The checker as a library, for programs that check images they already
+// hold in memory. A context checks any number of images, one at a time,
+// straight from the caller's buffer, and keeps the buffers of a check for
+// the next one: once it has checked an image of a size, checking another
+// one no larger allocates nothing, and the buffers stay that large until
+// the context is freed. Every error goes to a callback. A context is used
+// by one thread at a time; the threads of a check are its own. Needs no
+// other header of fcheck.
+
+#include <stddef.h>
+#include <stdbool.h>
+
+// how a context checks, all zero for every rule, the first error, one
+// thread, the geometry of every image detected and no memory limit
+struct fcheckoptions {
+  unsigned rules;             // bit r set to check rule r, 0 for every rule
+  bool all;                   // report every error instead of the first one
+  int threads;                // threads checking an image, 0 for one
+  unsigned blockSize;         // geometry of every image, 0 to detect it
+  unsigned ndirect;           // and its direct addresses, 0 for any
+  size_t memory;              // refuse images needing more heap, 0 for no limit
+};
+
+// an error, valid until the callback returns; fields that do not apply are -1
+struct fcheckerror {
+  int rule;                   // rule number, 1 to 14
+  long inode;                 // inode the error is about
+  long block;                 // block address the error is about
+  long directory;             // directory holding the offending entry
+  long entry;                 // index of the entry in that directory
+  const char *name;           // name of the entry, "" if none
+  long owner;                 // rules 7 and 8 with all: inode that used the block first
+  const char *ownerUse;       // and how, "direct" or "indirect", NULL if no owner
+  const char *message;        // what fcheck prints, "ERROR: ..."
+};
+
+typedef void (*fcheckcallback)(void *arg, const struct fcheckerror *error);
+
+struct fcheck;
+
+// a context, NULL if no checker is built for the geometry asked for
+struct fcheck *fcheckNew(const struct fcheckoptions *options);
+// check the image of size bytes at image, which must not change meanwhile,
+// and pass its errors to cb with arg, sorted as fcheck -a prints them;
+// returns 1 if the image has errors, 0 if not, -1 if it cannot be checked
+int fcheckImage(struct fcheck *fc, const void *image, size_t size, fcheckcallback cb, void *arg);
+// why the last image could not be checked, or NULL
+const char *fcheckFailure(const struct fcheck *fc);
+void fcheckFree(struct fcheck *fc);
+
+#endif // _LIBFCHECK_H_
@@ -0,0 +1,284 @@
+// Incremental check manifest
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "types.h"
+#include "fs.h"
+#include "manifest.h"
+
+#define ALIGN8(n) (((n) + 7) & ~(size_t)7)
+
+#define PRIME1 0x9e3779b185ebca87ULL
+#define PRIME2 0xc2b2ae3d27d4eb4fULL
+#define PRIME3 0x165667b19e3779f9ULL
+
+static inline uint64_t rotl(uint64_t x, int r) {
+  return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t mix(uint64_t h, uint64_t v) {
+  return rotl(h + v * PRIME2, 31) * PRIME1;
+}
+
+// 64-bit hash of n bytes, n a multiple of 8. Four independent lanes keep
+// the multipliers busy; it detects changes, it does not resist forgery.
+uint64_t manifestHash(const void *p, size_t n) {
+  const uint64_t *w = p;
+  uint64_t a = PRIME1 + PRIME2, b = PRIME2, c = 0, d = -PRIME1, h;
+  size_t i, nwords = n / 8;
+
+  for (i = 0; i + 4 <= nwords; i += 4) {
+    a = mix(a, w[i]);
+    b = mix(b, w[i + 1]);
+    c = mix(c, w[i + 2]);
+    d = mix(d, w[i + 3]);
+  }
+  h = rotl(a, 1) + rotl(b, 7) + rotl(c, 12) + rotl(d, 18) + n;
+  for (; i < nwords; i++)
+    h = rotl(h ^ mix(0, w[i]), 27) * PRIME1 + PRIME3;
+  h ^= h >> 33;
+  h *= PRIME2;
+  h ^= h >> 29;
+  h *= PRIME3;
+  return h ^ (h >> 32);
+}
+
+static void *grow(void *p, size_t *capacity, size_t need, size_t size) {
+  size_t c = *capacity ? *capacity : 256;
+
+  if (need <= *capacity)
+    return p;
+  while (c < need)
+    c *= 2;
+  p = realloc(p, c * size);
+  if (p == NULL) {
+    perror("manifest");
+    exit(1);
+  }
+  *capacity = c;
+  return p;
+}
+
+// nblocks blocks from block were read for unit, their contents hash to hash
+void unitlogDep(struct unitlog *l, uint unit, uint block, uint nblocks, uint64_t hash) {
+  struct mdep *d;
+
+  l->deps = grow(l->deps, &l->depCapacity, l->ndeps + 1, sizeof(struct mdep));
+  d = &l->deps[l->ndeps++];
+  d->unit = unit;
+  d->block = block;
+  d->nblocks = nblocks;
+  d->pad = 0;
+  d->hash = hash;
+}
+
+// unit marked block in the sets of kind
+void unitlogOwn(struct unitlog *l, uint unit, uint block, uint kind) {
+  struct mown *o;
+
+  l->owned = grow(l->owned, &l->ownCapacity, l->nowned + 1, sizeof(struct mown));
+  o = &l->owned[l->nowned++];
+  o->unit = unit;
+  o->block = block;
+  o->kind = kind;
+}
+
+// copy records to the end of l
+void unitlogAppend(struct unitlog *l, const struct mdep *deps, size_t ndeps,
+                   const struct mown *owned, size_t nowned) {
+  if (ndeps > 0) {
+    l->deps = grow(l->deps, &l->depCapacity, l->ndeps + ndeps, sizeof(struct mdep));
+    memcpy(l->deps + l->ndeps, deps, ndeps * sizeof(struct mdep));
+    l->ndeps += ndeps;
+  }
+  if (nowned > 0) {
+    l->owned = grow(l->owned, &l->ownCapacity, l->nowned + nowned, sizeof(struct mown));
+    memcpy(l->owned + l->nowned, owned, nowned * sizeof(struct mown));
+    l->nowned += nowned;
+  }
+}
+
+static int compareDeps(const void *a, const void *b) {
+  const struct mdep *x = a, *y = b;
+
+  if (x->unit != y->unit)
+    return x->unit < y->unit ? -1 : 1;
+  return (x->block > y->block) - (x->block < y->block);
+}
+
+static int compareOwned(const void *a, const void *b) {
+  const struct mown *x = a, *y = b;
+
+  if (x->unit != y->unit)
+    return x->unit < y->unit ? -1 : 1;
+  return (x->block > y->block) - (x->block < y->block);
+}
+
+// order by unit, then block, and fold the kinds of a block into one record
+void unitlogSort(struct unitlog *l) {
+  size_t i, n = 0;
+
+  if (l->ndeps > 1) // an empty log has no array to sort
+    qsort(l->deps, l->ndeps, sizeof(struct mdep), compareDeps);
+  if (l->nowned > 1)
+    qsort(l->owned, l->nowned, sizeof(struct mown), compareOwned);
+  for (i = 0; i < l->nowned; i++) {
+    if (n > 0 && l->owned[n - 1].unit == l->owned[i].unit &&
+        l->owned[n - 1].block == l->owned[i].block)
+      l->owned[n - 1].kind |= l->owned[i].kind;
+    else
+      l->owned[n++] = l->owned[i];
+  }
+  l->nowned = n;
+}
+
+void unitlogFree(struct unitlog *l) {
+  free(l->deps);
+  free(l->owned);
+  memset(l, 0, sizeof(*l));
+}
+
+// offsets of the sections after the header, the last one is the file size
+static void layout(const struct manifestheader *h, size_t off[8]) {
+  off[0] = sizeof(struct manifestheader);                                // unitHash
+  off[1] = off[0] + (size_t)h->nunits * sizeof(uint64_t);                 // depStart
+  off[2] = off[1] + ((size_t)h->nunits + 1) * sizeof(uint64_t);           // deps
+  off[3] = off[2] + h->ndeps * sizeof(struct mdep);                       // ownStart
+  off[4] = off[3] + ((size_t)h->nunits + 1) * sizeof(uint64_t);           // owned
+  off[5] = ALIGN8(off[4] + h->nowned * sizeof(struct mown));              // used
+  off[6] = off[5] + 2 * h->nwords * sizeof(bitword);                      // index
+  off[7] = off[6] + h->nindex * sizeof(struct dirindexent);
+}
+
+// every start array runs from 0 to the record count without going back
+static int startsValid(const uint64_t *start, uint nunits, uint64_t count) {
+  uint u;
+
+  if (start[0] != 0 || start[nunits] != count)
+    return 0;
+  for (u = 0; u < nunits; u++)
+    if (start[u] > start[u + 1])
+      return 0;
+  return 1;
+}
+
+/*
+Map the manifest at path. Returns -1 if there is none or it is not one
+this build wrote, 0 otherwise. Whether it describes the image is up to the
+caller.
+*/
+int manifestOpen(struct manifest *m, const char *path) {
+  int fd;
+  struct stat st;
+  size_t off[8];
+  char *p;
+
+  memset(m, 0, sizeof(*m));
+  if ((fd = open(path, O_RDONLY)) < 0)
+    return -1;
+  if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(struct manifestheader)) {
+    close(fd);
+    return -1;
+  }
+  p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (p == MAP_FAILED)
+    return -1;
+  m->map = p;
+  m->mapSize = st.st_size;
+  memcpy(&m->h, p, sizeof(m->h));
+  if (memcmp(m->h.magic, MANIFEST_MAGIC, sizeof(MANIFEST_MAGIC)) != 0)
+    goto bad;
+  layout(&m->h, off);
+  if (off[7] != m->mapSize)
+    goto bad;
+  m->unitHash = (const uint64_t *)(p + off[0]);
+  m->depStart = (const uint64_t *)(p + off[1]);
+  m->deps = (const struct mdep *)(p + off[2]);
+  m->ownStart = (const uint64_t *)(p + off[3]);
+  m->owned = (const struct mown *)(p + off[4]);
+  m->used = (const bitword *)(p + off[5]);
+  m->referenced = m->used + m->h.nwords;
+  m->index = (const struct dirindexent *)(p + off[6]);
+  if (!startsValid(m->depStart, m->h.nunits, m->h.ndeps) ||
+      !startsValid(m->ownStart, m->h.nunits, m->h.nowned))
+    goto bad;
+  return 0;
+
+bad:
+  manifestClose(m);
+  return -1;
+}
+
+static int writeStarts(FILE *f, uint nunits, const void *recs, size_t n, size_t size) {
+  uint u;
+  size_t i = 0;
+  uint64_t start;
+
+  // records are sorted by unit, which is their first field
+  for (u = 0; u <= nunits; u++) {
+    while (i < n && *(const uint *)((const char *)recs + i * size) < u)
+      i++;
+    start = i;
+    if (fwrite(&start, sizeof(start), 1, f) != 1)
+      return -1;
+  }
+  return 0;
+}
+
+/*
+Write a manifest to path, through a temporary file renamed over it, so a
+reader never sees half of one. The log must be sorted. Returns -1 and
+leaves any older manifest in place if it cannot be written.
+*/
+int manifestWrite(const char *path, struct manifestheader *h, const uint64_t *unitHash,
+                  const struct unitlog *l, const bitword *used, const bitword *referenced,
+                  const struct dirindex *ix) {
+  static const char zeros[8];
+  size_t off[8];
+  char *tmp;
+  FILE *f;
+  int ok;
+
+  memcpy(h->magic, MANIFEST_MAGIC, sizeof(MANIFEST_MAGIC));
+  h->ndeps = l->ndeps;
+  h->nowned = l->nowned;
+  h->nindex = ix->count;
+  layout(h, off);
+
+  tmp = malloc(strlen(path) + 5);
+  if (tmp == NULL)
+    return -1;
+  sprintf(tmp, "%s.tmp", path);
+  if ((f = fopen(tmp, "w")) == NULL) {
+    free(tmp);
+    return -1;
+  }
+  ok = fwrite(h, sizeof(*h), 1, f) == 1 &&
+       fwrite(unitHash, sizeof(uint64_t), h->nunits, f) == h->nunits &&
+       writeStarts(f, h->nunits, l->deps, l->ndeps, sizeof(struct mdep)) == 0 &&
+       fwrite(l->deps, sizeof(struct mdep), l->ndeps, f) == l->ndeps &&
+       writeStarts(f, h->nunits, l->owned, l->nowned, sizeof(struct mown)) == 0 &&
+       fwrite(l->owned, sizeof(struct mown), l->nowned, f) == l->nowned &&
+       fwrite(zeros, 1, off[5] - off[4] - l->nowned * sizeof(struct mown), f) ==
+         off[5] - off[4] - l->nowned * sizeof(struct mown) &&
+       fwrite(used, sizeof(bitword), h->nwords, f) == h->nwords &&
+       fwrite(referenced, sizeof(bitword), h->nwords, f) == h->nwords &&
+       fwrite(ix->ents, sizeof(struct dirindexent), ix->count, f) == ix->count;
+  ok = fclose(f) == 0 && ok && rename(tmp, path) == 0;
+  if (!ok)
+    unlink(tmp);
+  free(tmp);
+  return ok ? 0 : -1;
+}
+
+void manifestClose(struct manifest *m) {
+  if (m->map != NULL)
+    munmap(m->map, m->mapSize);
+  memset(m, 0, sizeof(*m));
+}
@@ -0,0 +1,93 @@
+#ifndef _MANIFEST_H_
+#define _MANIFEST_H_
+
+// Sidecar manifest of a clean image, for -M. It keeps a hash of every block
+// the check reads, grouped by the inode table block (unit) whose inodes led
+// to it, next to the state the check derived: the blocks every unit marked
+// used or referenced, both block sets, and the directory index. A later
+// check only re-derives the units whose blocks changed. The file is in host
+// byte order; it is a cache, not an interchange format.
+// Include types.h and fs.h first.
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "bitset.h"
+#include "dirindex.h"
+
+#define MANIFEST_MAGIC "FCKMAN3"
+
+#define MOWN_USED        0x1  // marked in the block set of rules 6, 7, 8
+#define MOWN_REFERENCED  0x2  // marked in the block set of rule 5
+
+// blocks read while visiting the inodes of a unit, and the hash of them
+struct mdep {
+  uint unit;
+  uint block;
+  uint nblocks;         // 1, an indirect or a directory block
+  uint pad;
+  uint64_t hash;
+};
+
+// a block the inodes of a unit marked
+struct mown {
+  uint unit;
+  uint block;
+  uint kind;            // MOWN_USED, MOWN_REFERENCED
+};
+
+// what the check of the image looked like, compared before anything is reused
+struct manifestheader {
+  char magic[8];
+  uint size;            // super block
+  uint nblocks;
+  uint ninodes;
+  uint imageBlocks;
+  uint blockSize;       // geometry the check ran with
+  uint ndirect;
+  uint nunits;          // inode table blocks
+  uint64_t nwords;      // words in each block set
+  uint64_t ndeps;
+  uint64_t nowned;
+  uint64_t nindex;
+};
+
+// growable lists of blocks read and marked, per unit
+struct unitlog {
+  struct mdep *deps;
+  size_t ndeps;
+  size_t depCapacity;
+  struct mown *owned;
+  size_t nowned;
+  size_t ownCapacity;
+};
+
+// a manifest read back, the arrays point into the mapped file
+struct manifest {
+  struct manifestheader h;
+  const uint64_t *unitHash;   // hash of every inode table block
+  const uint64_t *depStart;   // deps of unit u are [depStart[u], depStart[u + 1])
+  const struct mdep *deps;    // by unit, then block
+  const uint64_t *ownStart;   // likewise for owned
+  const struct mown *owned;
+  const bitword *used;        // block set of rules 6, 7, 8
+  const bitword *referenced;  // block set of rule 5
+  const struct dirindexent *index;
+  void *map;
+  size_t mapSize;
+};
+
+uint64_t manifestHash(const void *p, size_t n);
+void unitlogDep(struct unitlog *l, uint unit, uint block, uint nblocks, uint64_t hash);
+void unitlogOwn(struct unitlog *l, uint unit, uint block, uint kind);
+void unitlogAppend(struct unitlog *l, const struct mdep *deps, size_t ndeps,
+                   const struct mown *owned, size_t nowned);
+void unitlogSort(struct unitlog *l);
+void unitlogFree(struct unitlog *l);
+int manifestOpen(struct manifest *m, const char *path);
+int manifestWrite(const char *path, struct manifestheader *h, const uint64_t *unitHash,
+                  const struct unitlog *l, const bitword *used, const bitword *referenced,
+                  const struct dirindex *ix);
+void manifestClose(struct manifest *m);
+
+#endif // _MANIFEST_H_
@@ -0,0 +1,478 @@
+// Synthetic xv6 image generator
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "types.h"
+#include "fs.h"
+
+#define T_DIR  1
+#define T_FILE 2
+
+#define DPB (BSIZE / sizeof(struct dirent)) // dirents per block
+
+// largest file, in blocks, whose size in bytes fits the inode
+#define MAXBLOCKS (MAXFILE < UINT32_MAX / BSIZE ? MAXFILE : UINT32_MAX / BSIZE)
+
+// one entry of a directory being built
+struct entry {
+  uint inum;
+  uint link;                  // number of the hard link, 0 for the first name
+};
+
+// an inode being built
+struct geninode {
+  short type;
+  short nlink;
+  uint nblocks;               // data blocks of a file
+  struct entry *ents;         // children of a directory, after . and ..
+  uint count;
+  uint capacity;
+};
+
+// how the file sizes are drawn, in blocks
+struct sizedist {
+  char kind;                  // 'f'ixed, 'u'niform or 'e'xponential (geometric)
+  double a, b;
+};
+
+// the image being written
+struct image {
+  int fd;
+  uint size;                  // blocks in the image
+  uint ninodes;
+  uint firstDataBlock;
+  uint nblocks;               // data blocks
+  uint allocated;             // data blocks handed out so far
+  uint64_t stride, offset;    // spread of the allocation over the data blocks
+  struct dinode *inodes;      // inode table
+  uchar *bitmap;
+  uint bitmapBlocks;
+};
+
+static uint64_t rngState = 88172645463325252ull;
+
+// xorshift64, so the same seed gives the same image everywhere
+static uint64_t rnd(void) {
+  rngState ^= rngState << 13;
+  rngState ^= rngState >> 7;
+  rngState ^= rngState << 17;
+  return rngState;
+}
+
+// uniform in [0, 1)
+static double rndUnit(void) {
+  return (rnd() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static uint64_t gcd(uint64_t a, uint64_t b) {
+  while (b) {
+    uint64_t t = a % b;
+    a = b;
+    b = t;
+  }
+  return a;
+}
+
+static void usage(void) {
+  fprintf(stderr,
+          "Usage: mkimage [-i inodes] [-b blocks] [-d fanout] [-s sizes] [-l linkratio]\n"
+          "               [-c rule] [-r seed] [-L logblocks] [-A] out.img\n"
+          "  sizes is fixed:N, uniform:MIN:MAX or exp:MEAN, in blocks per file\n");
+  exit(1);
+}
+
+static void parseSizes(const char *s, struct sizedist *d) {
+  if (sscanf(s, "fixed:%lf", &d->a) == 1)
+    d->kind = 'f';
+  else if (sscanf(s, "uniform:%lf:%lf", &d->a, &d->b) == 2 && d->a <= d->b)
+    d->kind = 'u';
+  else if (sscanf(s, "exp:%lf", &d->a) == 1)
+    d->kind = 'e';
+  else
+    usage();
+}
+
+// data blocks of the next file
+static uint drawSize(const struct sizedist *d) {
+  double n = 0;
+
+  if (d->kind == 'f')
+    n = d->a;
+  else if (d->kind == 'u')
+    n = d->a + (uint64_t)(rndUnit() * (d->b - d->a + 1));
+  else // geometric, the discrete exponential, with mean a
+    while (n < MAXBLOCKS && rndUnit() >= 1 / (d->a + 1))
+      n++;
+  return n > MAXBLOCKS ? MAXBLOCKS : n < 0 ? 0 : n;
+}
+
+static void addEntry(struct geninode *dir, uint inum, uint link) {
+  if (dir->count == dir->capacity) {
+    dir->capacity = dir->capacity ? dir->capacity * 2 : 8;
+    dir->ents = realloc(dir->ents, dir->capacity * sizeof(struct entry));
+    if (dir->ents == NULL) {
+      perror("mkimage");
+      exit(1);
+    }
+  }
+  dir->ents[dir->count].inum = inum;
+  dir->ents[dir->count].link = link;
+  dir->count++;
+}
+
+// next free data block, spread over the data area when stride is not 1
+static uint allocBlock(struct image *im) {
+  uint b;
+
+  if (im->allocated == im->nblocks) {
+    fprintf(stderr, "not enough blocks, raise -b\n");
+    exit(1);
+  }
+  b = im->firstDataBlock + (im->stride * im->allocated + im->offset) % im->nblocks;
+  im->allocated++;
+  im->bitmap[b / 8] |= 1 << (b % 8);
+  return b;
+}
+
+static void writeBlock(struct image *im, uint b, const void *data) {
+  if (pwrite(im->fd, data, BSIZE, (off_t)b * BSIZE) != BSIZE) {
+    perror("write");
+    exit(1);
+  }
+}
+
+// allocate an indirect block of the given height for the next *left data
+// blocks of a file, and the blocks below it, and write it
+static uint layoutIndirect(struct image *im, uint height, uint *left) {
+  uint i, b = allocBlock(im), ind[NINDIRECT];
+
+  memset(ind, 0, sizeof(ind));
+  for (i = 0; i < NINDIRECT && *left > 0; i++) {
+    if (height > 1)
+      ind[i] = layoutIndirect(im, height - 1, left);
+    else {
+      ind[i] = allocBlock(im);
+      (*left)--;
+    }
+  }
+  writeBlock(im, b, ind);
+  return b;
+}
+
+// give inode inum its blocks and write its directory or indirect blocks, the
+// . and .. entries of a directory name dot and parent
+static void layoutInode(struct image *im, const struct geninode *all, uint inum, uint dot,
+                        uint parent) {
+  const struct geninode *gi = &all[inum];
+  struct dinode *dip = &im->inodes[inum];
+  uint i, j, nblocks, left, ind[NINDIRECT];
+  struct dirent de[DPB];
+
+  dip->type = gi->type;
+  dip->nlink = gi->nlink;
+  if (gi->type == T_FILE) {
+    nblocks = left = gi->nblocks;
+    for (i = 0; left > 0 && i < NDIRECT; i++, left--)
+      dip->addrs[i] = allocBlock(im);
+    // then the indirect, doubly and triply indirect addresses, in that order
+    for (i = NDIRECT; left > 0 && i < NADDRS; i++)
+      dip->addrs[i] = layoutIndirect(im, i == NDIRECT ? 1 : i <= NDIRECT + NDINDIRECT ? 2 : 3,
+                                     &left);
+    dip->size = nblocks * BSIZE;
+    return;
+  }
+
+  // directory: . and .. then the children, whole blocks
+  nblocks = (gi->count + 2 + DPB - 1) / DPB;
+  dip->size = nblocks * BSIZE;
+  for (i = 0; i < nblocks; i++) {
+    memset(de, 0, sizeof(de));
+    for (j = 0; j < DPB; j++) {
+      uint k = i * DPB + j;
+      if (k == 0) {
+        de[j].inum = dot;
+        strcpy(de[j].name, ".");
+      } else if (k == 1) {
+        de[j].inum = parent;
+        strcpy(de[j].name, "..");
+      } else if (k - 2 < gi->count) {
+        struct entry *e = &gi->ents[k - 2];
+        de[j].inum = e->inum;
+        if (e->link)
+          snprintf(de[j].name, DIRSIZ, "l%u", e->link);
+        else
+          snprintf(de[j].name, DIRSIZ, "%c%u", all[e->inum].type == T_DIR ? 'd' : 'f',
+                   e->inum);
+      }
+    }
+    if (i < NDIRECT)
+      dip->addrs[i] = allocBlock(im);
+    else {
+      if (i == NDIRECT) {
+        memset(ind, 0, sizeof(ind));
+        dip->addrs[NDIRECT] = allocBlock(im);
+      }
+      ind[i - NDIRECT] = allocBlock(im);
+    }
+    writeBlock(im, i < NDIRECT ? dip->addrs[i] : ind[i - NDIRECT], de);
+  }
+  if (nblocks > NDIRECT)
+    writeBlock(im, dip->addrs[NDIRECT], ind);
+}
+
+// first file inode with at least minBlocks blocks, other than skip
+static uint findFile(struct image *im, uint minBlocks, uint skip) {
+  uint i;
+
+  for (i = ROOTINO + 1; i < im->ninodes; i++)
+    if (i != skip && im->inodes[i].type == T_FILE && im->inodes[i].size >= minBlocks * BSIZE)
+      return i;
+  fprintf(stderr, "no file large enough to inject the violation\n");
+  exit(1);
+}
+
+// break rule on the laid out image, rules about directories were handled
+// while building the tree
+static void injectBlocks(struct image *im, int rule) {
+  uint a, b, i, ind[NINDIRECT];
+  struct dinode *dip;
+
+  switch (rule) {
+  case 1: // bad inode type
+    im->inodes[findFile(im, 0, 0)].type = 7;
+    break;
+  case 2: // direct address past the end of the image
+    im->inodes[findFile(im, 1, 0)].addrs[0] = im->size + 1;
+    break;
+  case 5: // used block marked free
+    b = im->inodes[findFile(im, 1, 0)].addrs[0];
+    im->bitmap[b / 8] &= ~(1 << (b % 8));
+    break;
+  case 6: // free block marked used
+    if (im->allocated == im->nblocks) {
+      fprintf(stderr, "no free block to inject the violation, raise -b\n");
+      exit(1);
+    }
+    b = im->firstDataBlock + (im->stride * im->allocated + im->offset) % im->nblocks;
+    im->bitmap[b / 8] |= 1 << (b % 8);
+    break;
+  case 7: // direct block shared by two files
+    a = findFile(im, 1, 0);
+    dip = &im->inodes[findFile(im, 1, a)];
+    im->bitmap[dip->addrs[0] / 8] &= ~(1 << (dip->addrs[0] % 8));
+    dip->addrs[0] = im->inodes[a].addrs[0];
+    break;
+  case 8: // indirect block shared by two files
+    a = findFile(im, NDIRECT + 1, 0);
+    dip = &im->inodes[findFile(im, NDIRECT + 1, a)];
+    if (pread(im->fd, ind, BSIZE, (off_t)dip->addrs[NDIRECT] * BSIZE) != BSIZE) {
+      perror("read");
+      exit(1);
+    }
+    for (i = 0; i < NINDIRECT; i++)
+      if (ind[i])
+        im->bitmap[ind[i] / 8] &= ~(1 << (ind[i] % 8));
+    im->bitmap[dip->addrs[NDIRECT] / 8] &= ~(1 << (dip->addrs[NDIRECT] % 8));
+    dip->addrs[NDIRECT] = im->inodes[a].addrs[NDIRECT];
+    break;
+  case 9: // in-use inode in no directory, the spare inode
+    im->inodes[im->ninodes - 1].type = T_FILE;
+    im->inodes[im->ninodes - 1].nlink = 1;
+    break;
+  case 11: // link count off by one
+    im->inodes[findFile(im, 0, 0)].nlink++;
+    break;
+  }
+}
+
+int main(int argc, char *argv[]) {
+  int opt, rule = 0;
+  bool aged = false;
+  uint ninodes = 1024, size = 8192, fanout = 16, nlog = 0;
+  uint i, inum, head, ndirs, nfiles = 0, nlinks = 0, linkSeq = 0;
+  double linkRatio = 0;
+  struct sizedist sizes = { 'e', 4, 0 };
+  struct geninode *gi;
+  struct superblock sb;
+  struct image im;
+  uint *queue, *parents, *dot, *files, victim;
+  uint block[BSIZE / sizeof(uint)];
+  struct logheader *lh = (struct logheader *) block;
+
+  while ((opt = getopt(argc, argv, "i:b:d:s:l:c:r:L:A")) != -1) {
+    switch (opt) {
+    case 'i': ninodes = strtoul(optarg, NULL, 0); break;
+    case 'b': size = strtoul(optarg, NULL, 0); break;
+    case 'd': fanout = strtoul(optarg, NULL, 0); break;
+    case 's': parseSizes(optarg, &sizes); break;
+    case 'l': linkRatio = atof(optarg); break;
+    case 'c': rule = atoi(optarg); break;
+    case 'r': rngState ^= strtoull(optarg, NULL, 0) * 0x9e3779b97f4a7c15ull; break;
+    case 'L': nlog = strtoul(optarg, NULL, 0); break;
+    case 'A': aged = true; break;
+    default: usage();
+    }
+  }
+  if (optind != argc - 1 || ninodes < 4 || fanout < 2 || rule < 0 || rule > 12)
+    usage();
+  if (ninodes > 65536) {
+    fprintf(stderr, "at most 65536 inodes, dirents hold 16 bit inode numbers\n");
+    exit(1);
+  }
+  // directories only take direct and indirect blocks
+  if (fanout > (NDIRECT + NINDIRECT) * DPB - 2)
+    fanout = (NDIRECT + NINDIRECT) * DPB - 2;
+
+  /*
+  Build the tree breadth first: every directory takes fanout children
+  before the next one is filled. One child in fanout is a directory, so
+  there is always room for more. The last inode is left free, rules 9 and
+  10 use it.
+  */
+  gi = calloc(ninodes, sizeof(struct geninode));
+  queue = calloc(ninodes, sizeof(uint));
+  parents = calloc(ninodes, sizeof(uint));
+  dot = calloc(ninodes, sizeof(uint));
+  files = calloc(ninodes, sizeof(uint));
+  if (gi == NULL || queue == NULL || parents == NULL || dot == NULL || files == NULL) {
+    perror("mkimage");
+    exit(1);
+  }
+  gi[ROOTINO].type = T_DIR;
+  gi[ROOTINO].nlink = 1;
+  parents[ROOTINO] = ROOTINO;
+  dot[ROOTINO] = ROOTINO;
+  queue[0] = ROOTINO;
+  ndirs = 1;
+  head = 0;
+  for (inum = ROOTINO + 1; inum < ninodes - 1; ) {
+    uint dir = queue[head];
+    uint room = fanout - gi[dir].count;
+    if (room == 0) {
+      head++;
+      continue;
+    }
+    bool last = head == ndirs - 1 && room == 1; // last free slot of the tree
+    if (nfiles > 0 && !last && rndUnit() < linkRatio) {
+      // another name for an existing file
+      uint f = files[rnd() % nfiles];
+      addEntry(&gi[dir], f, ++linkSeq);
+      gi[f].nlink++;
+      nlinks++;
+      continue;
+    }
+    // the last directory with room must not fill up with files
+    if (rnd() % fanout == 0 || last) {
+      gi[inum].type = T_DIR;
+      parents[inum] = dir;
+      dot[inum] = inum;
+      queue[ndirs++] = inum;
+    } else {
+      gi[inum].type = T_FILE;
+      gi[inum].nblocks = drawSize(&sizes);
+      files[nfiles++] = inum;
+    }
+    gi[inum].nlink = 1;
+    addEntry(&gi[dir], inum, 0);
+    inum++;
+  }
+
+  // violations that are about directory entries, on the last directory made
+  victim = queue[ndirs - 1];
+  if ((rule == 4 || rule == 12) && victim == ROOTINO) {
+    fprintf(stderr, "no directory besides the root, raise -i\n");
+    exit(1);
+  }
+  if (rule == 3) // root . is not inode 1
+    dot[ROOTINO] = ROOTINO + 1;
+  if (rule == 4) // . of a directory names its parent
+    dot[victim] = parents[victim];
+  if (rule == 10) // entry for the spare, free, inode
+    addEntry(&gi[victim], ninodes - 1, 0);
+  if (rule == 12) // second name for a directory
+    addEntry(&gi[victim], victim, ++linkSeq);
+
+  // lay out the image: inodes, bitmap, then data, the mkfs layout
+  memset(&im, 0, sizeof(im));
+  im.size = size;
+  im.ninodes = ninodes;
+  im.bitmapBlocks = size / BPB + 1;
+  im.firstDataBlock = BBLOCK(0, ninodes) + im.bitmapBlocks;
+  if (im.firstDataBlock + nlog >= size) {
+    fprintf(stderr, "not enough blocks, raise -b\n");
+    exit(1);
+  }
+  // the log holds the bitmap and its header
+  if (nlog > 0 && (nlog < im.bitmapBlocks + 1 || im.bitmapBlocks >= NINDIRECT)) {
+    fprintf(stderr, "the bitmap does not fit in the log, raise -L\n");
+    exit(1);
+  }
+  im.nblocks = size - im.firstDataBlock - nlog;
+  im.stride = 1;
+  if (aged) {
+    // a stride coprime to the data block count visits every block once,
+    // in an order that scatters neighbouring files over the whole area
+    do
+      im.stride = rnd() % im.nblocks;
+    while (im.nblocks > 1 && (im.stride == 0 || gcd(im.stride, im.nblocks) != 1));
+    im.offset = rnd() % im.nblocks;
+  }
+  im.inodes = calloc((ninodes / IPB + 1) * IPB, sizeof(struct dinode));
+  im.bitmap = calloc(im.bitmapBlocks, BSIZE);
+  if (im.inodes == NULL || im.bitmap == NULL) {
+    perror("mkimage");
+    exit(1);
+  }
+  for (i = 0; i < im.firstDataBlock; i++)
+    im.bitmap[i / 8] |= 1 << (i % 8);
+
+  im.fd = open(argv[optind], O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (im.fd < 0 || ftruncate(im.fd, (off_t)size * BSIZE) != 0) {
+    perror(argv[optind]);
+    exit(1);
+  }
+  for (inum = ROOTINO; inum < ninodes; inum++) {
+    if (gi[inum].type == 0)
+      continue;
+    layoutInode(&im, gi, inum, dot[inum], parents[inum]);
+  }
+  for (inum = ROOTINO; inum < ninodes; inum++)
+    free(gi[inum].ents);
+  injectBlocks(&im, rule);
+
+  // super block, inode table and bitmap
+  memset(block, 0, sizeof(block));
+  sb.size = size;
+  sb.nblocks = im.nblocks;
+  sb.ninodes = ninodes;
+  sb.nlog = nlog;
+  memcpy(block, &sb, sizeof(sb));
+  writeBlock(&im, 1, block);
+  for (i = 0; i <= ninodes / IPB; i++)
+    writeBlock(&im, IBLOCK(i * IPB), &im.inodes[i * IPB]);
+  if (nlog == 0) {
+    for (i = 0; i < im.bitmapBlocks; i++)
+      writeBlock(&im, BBLOCK(0, ninodes) + i, im.bitmap + i * BSIZE);
+  } else {
+    // as if xv6 stopped after committing the bitmap, before installing it:
+    // the bitmap is only in the log, its home blocks are still zero
+    for (i = 0; i < im.bitmapBlocks; i++)
+      writeBlock(&im, size - nlog + 1 + i, im.bitmap + i * BSIZE);
+    memset(block, 0, sizeof(block));
+    lh->n = im.bitmapBlocks;
+    for (i = 0; i < im.bitmapBlocks; i++)
+      lh->sector[i] = BBLOCK(0, ninodes) + i;
+    writeBlock(&im, size - nlog, block);
+  }
+  close(im.fd);
+
+  printf("%s: %u blocks, %u inodes, %u directories, %u files, %u extra links, "
+         "%u data blocks used\n", argv[optind], size, ninodes, ndirs, nfiles, nlinks,
+         im.allocated);
+  return 0;
+}
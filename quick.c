@@ -0,0 +1,354 @@
+// Quick check of an image by sampling, for one geometry
+//
+// Included by checker.c, so that it walks the blocks of an inode and reads
+// directory blocks the way the full check does. Instead of the whole inode
+// table it checks the root and a sample of the inodes, reading only their
+// inode table blocks and the indirect, directory, bitmap and inode blocks
+// they lead to, against what one inode can tell of rules 1, 2, 4, 5, 10
+// and 11. The super block was vetted when the image was loaded.
+#ifndef GEOMETRY
+#error "quick.c is compiled through the geom*.c files"
+#endif
+
+// confidence of the bound on the inodes the sample left out
+#define QUICK_CONFIDENCE 0.95
+
+// the block of the inode table or of the bitmap read last, for the lookups
+// that follow it
+struct quickcache {
+  uint block;             // its address, 0 for none
+  const void *data;
+  uint buf[NINDIRECT];    // a block, when not used in place
+};
+
+// a quick check in progress
+struct quickstate {
+  struct checkstate *cs;
+  struct checkshard *sh;        // the errors
+  struct samplesummary *sum;    // what the check covered
+  uint64_t rng;                 // xorshift64* state
+  uint64_t startNs;
+  uint64_t maxNs;               // budget, 0 for no limit
+  uint64_t maxBytes;
+  bool bounded;                 // the budget applies, not to the root
+  struct quickcache table;      // inodes sampled
+  struct quickcache children;   // inodes the entries of a directory name
+  struct quickcache bitmap;
+  uint indBuf[WALK_HEIGHT][NINDIRECT]; // indirect blocks being walked, when not used in place
+  struct dirent dirBuf[DPB];    // directory block being checked, likewise
+};
+
+// what the blocks of a directory showed
+struct quickdir {
+  bool dot;         // a "." entry refers to the directory
+  bool dotdot;      // there is a ".." entry
+  bool rootFirst;   // the root: its first entry is the root
+  bool rootParent;  // and its first block has a ".." entry for the root
+};
+
+static int quickCheck(struct blocksource *src, struct superblock *sb, struct checkopts *opts,
+                      struct report *rp);
+static bool quickInode(struct quickstate *q, uint inum, struct quickdir *qd);
+static bool quickDirBlock(struct quickstate *q, uint inum, uint size, uint fileBlock, uint block,
+                          struct quickdir *qd);
+static void quickBitmap(struct quickstate *q, uint inum, uint block);
+static const void *quickCached(struct quickstate *q, struct quickcache *c, uint block);
+static const void *quickRead(struct quickstate *q, uint block, void *buf);
+static bool quickSpent(struct quickstate *q);
+static bool quickFailed(struct quickstate *q);
+static uint quickRandom(struct quickstate *q, uint64_t n);
+static uint64_t quickNow(void);
+static double quickBound(uint64_t n, double confidence);
+
+/*
+Check the root in full and opts->quickSamples inodes picked at random,
+stopping at the first error unless every error is wanted, and once the
+budget of opts->quickMillis or opts->quickBytes is spent.
+
+The sample is taken in rounds of 1, 2, 4, ... inodes, and a round of s
+inodes cuts the inode table into s strata of equal size and takes one
+inode of each, in ascending order, so a round is one forward sweep over
+the table and any number of whole rounds covers all of it evenly. A
+budget spent halfway through a round only loses that round for the bound.
+A sample as large as the inode table checks every inode once instead.
+
+Of the rules, this sees rule 1 and 2 of every sampled inode; rule 5 for
+its addresses, in the bitmap block that holds their bit; rule 4 for a
+directory, over all of its blocks; rule 10 for the entries of those
+blocks, in the inode they name, or rule 1 if its type is not valid; and
+rule 11 only where an entry names a file whose link count is 0. Rule 3
+is checked on the root.
+
+The errors go to rp, as for a full check, and what was covered to
+rp->sample. Returns 1 if the image has errors, 0 if the sample found none.
+*/
+static int quickCheck(struct blocksource *src, struct superblock *sb, struct checkopts *opts,
+                      struct report *rp) {
+  struct checkstate cs;
+  struct checkshard sh;
+  struct quickstate *q;
+  struct quickdir qd = { 0 };
+  uint64_t all = sb->ninodes, n = opts->quickSamples, done, round, size, i, counted = 0;
+
+  memset(&cs, 0, sizeof(cs));
+  cs.src = src;
+  cs.sb = sb;
+  cs.imageBlocks = src->nblocks;
+  cs.collectAll = opts->collectAll;
+  cs.scratch = opts->scratch;
+  cs.rules = opts->rules;
+  cs.firstDataBlock = BBLOCK(0, sb->ninodes) + sb->size/BPB + 1;
+  cs.dataBlockEnd = cs.firstDataBlock + sb->nblocks;
+  cs.scanDirents = dirscanKernel();
+  memset(&sh, 0, sizeof(sh));
+  sh.cs = &cs;
+  sh.report.scratch = cs.scratch;
+
+  q = scratchCalloc(cs.scratch, sizeof(struct quickstate));
+  q->cs = &cs;
+  q->sh = &sh;
+  q->sum = &rp->sample;
+  q->startNs = quickNow();
+  q->maxNs = (uint64_t)opts->quickMillis * 1000000;
+  q->maxBytes = opts->quickBytes;
+  q->rng = (q->startNs ^ (uint64_t)getpid() << 32) | 1;
+  rp->sample = (struct samplesummary){ .done = true, .inodes = all,
+                                       .confidence = QUICK_CONFIDENCE };
+
+  /*
+  Rule 3:
+    Root directory exists, its inode number is 1, and the parent of the root
+    directory is itself. If not, print ERROR: root directory does not exist.
+
+  The root is checked whatever the budget, and as a sampled inode too.
+  */
+  if (all > ROOTINO)
+    quickInode(q, ROOTINO, &qd);
+  if (!qd.rootFirst || !qd.rootParent)
+    reportError(&sh, PHASE_RULE3, 3, ROOTINO, NOVALUE, "ERROR: root directory does not exist.");
+
+  q->bounded = true;
+  if (n >= all)
+    n = all;
+  for (done = 0, round = n == all ? all : 1; done < n; done += size, round *= 2) {
+    size = round < n - done ? round : n - done;
+    for (i = 0; i < size; i++) {
+      uint64_t lo = i * all / size, hi = (i + 1) * all / size;
+      if (quickFailed(q) || quickSpent(q))
+        break;
+      memset(&qd, 0, sizeof(qd));
+      if (!quickInode(q, lo + quickRandom(q, hi - lo), &qd))
+        break;
+      rp->sample.sampled++;
+    }
+    if (i < size)
+      break;
+    counted += size;
+  }
+  rp->sample.bound = n == all && counted == all ? 0 : quickBound(counted, QUICK_CONFIDENCE);
+  rp->sample.millis = (quickNow() - q->startNs) / 1000000;
+
+  finishCheck(&cs, &sh, opts, rp);
+  // an inode sampled twice, or also named by an entry, is reported once
+  for (i = 1, done = rp->count > 0; i < rp->count; i++) {
+    const struct diagnostic *d = &rp->diags[i], *last = &rp->diags[done - 1];
+    if (d->rule != last->rule || d->inum != last->inum || d->block != last->block ||
+        d->dirInum != last->dirInum || d->slot != last->slot)
+      rp->diags[done++] = *d;
+  }
+  rp->count = done;
+  scratchFree(cs.scratch, q);
+  return rp->count > 0;
+}
+
+// Check one inode: its type, its addresses and their bits in the bitmap,
+// and the blocks of a directory. Returns false if the budget ran out
+// before the inode was done.
+static bool quickInode(struct quickstate *q, uint inum, struct quickdir *qd) {
+  struct checkstate *cs = q->cs;
+  const struct dinode *inodes = quickCached(q, &q->table, IBLOCK(inum));
+  struct dinode di = inodes[inum % IPB];
+  struct blockwalk w;
+  struct blockref ref;
+
+  if (di.type == 0) // inode not in use
+    return true;
+  if (di.type != 1 && di.type != 2 && di.type != 3) {
+    reportError(q->sh, PHASE_RULE1, 1, inum, NOVALUE, "ERROR: bad inode.");
+    return true;
+  }
+
+  walkInode(&w, &di);
+  while (walkNext(&w, &ref)) {
+    uint block = ref.block;
+    bool invalid = block < cs->firstDataBlock || block >= cs->dataBlockEnd;
+    bool direct = ref.inInode && ref.height == 0;
+
+    if (di.size != 0 && invalid)
+      reportError(q->sh, PHASE_RULE2, 2, inum, block,
+                  direct ? "ERROR: bad direct address in inode."
+                         : "ERROR: bad indirect address in inode.");
+    // the addresses rule 5 looks at, as visitInode marks them
+    if (direct ? !invalid : !ref.inInode && block < cs->dataBlockEnd)
+      quickBitmap(q, inum, block);
+    if (ref.height == 0) {
+      if (di.type == 1 && !quickDirBlock(q, inum, di.size, ref.fileBlock, block, qd))
+        return false;
+    } else if (!invalid) { // a bad indirect address is not followed
+      if (quickSpent(q))
+        return false;
+      walkDescend(&w, &ref, quickRead(q, block, q->indBuf[w.depth]));
+    }
+  }
+  if (di.type == 1 && (!qd->dot || !qd->dotdot))
+    reportError(q->sh, PHASE_RULE4, 4, inum, NOVALUE, "ERROR: directory not properly formatted.");
+  return true;
+}
+
+// Check the entries in use of block fileBlock of directory inum, of size
+// bytes, and note what rules 3 and 4 need. Every entry costs a lookup of
+// the inode it names, in the inode table block read last if it is there.
+// Returns false if the budget ran out before the block was read.
+static bool quickDirBlock(struct quickstate *q, uint inum, uint size, uint fileBlock, uint block,
+                          struct quickdir *qd) {
+  struct checkstate *cs = q->cs;
+  uint n = dirBlockEntries(size, fileBlock), w, k;
+  const struct dirent *de;
+  const struct dinode *child;
+  struct dirscan scan;
+
+  if (n == 0 || block >= cs->imageBlocks) // not in the image, caught by rule 2
+    return true;
+  if (quickSpent(q))
+    return false;
+  de = quickRead(q, block, q->dirBuf);
+  q->sum->dirBlocks++;
+  cs->scanDirents(de, &scan);
+  for (w = 0; w * WORDBITS < n; w++) {
+    bitword used = scan.used[w];
+    if (n - w * WORDBITS < WORDBITS)
+      used &= ((bitword)1 << (n - w * WORDBITS)) - 1;
+    for (; used; used &= used - 1) {
+      uint bit = __builtin_ctzll(used), slot;
+      bool dot = scan.dot[w] >> bit & 1, dotdot = scan.dotdot[w] >> bit & 1;
+      k = w * WORDBITS + bit;
+      slot = fileBlock * DPB + k;
+      if (dot && de[k].inum == inum)
+        qd->dot = true;
+      if (dotdot)
+        qd->dotdot = true;
+      if (inum == ROOTINO && de[k].inum == ROOTINO) {
+        if (slot == 0)
+          qd->rootFirst = true;
+        if (dotdot && slot < DPB)
+          qd->rootParent = true;
+      }
+      if (de[k].inum >= cs->sb->ninodes) {
+        reportDirentError(q->sh, PHASE_RULE10, 10, inum, slot, &de[k],
+                          "ERROR: inode referred to in directory but marked free.");
+        continue;
+      }
+      child = (const struct dinode *) quickCached(q, &q->children, IBLOCK(de[k].inum)) +
+              de[k].inum % IPB;
+      if (child->type == 0)
+        reportDirentError(q->sh, PHASE_RULE10, 10, inum, slot, &de[k],
+                          "ERROR: inode referred to in directory but marked free.");
+      else if (child->type != 1 && child->type != 2 && child->type != 3)
+        reportError(q->sh, PHASE_RULE1, 1, de[k].inum, NOVALUE, "ERROR: bad inode.");
+      else if (child->type == 2 && child->nlink < 1 && !dot && !dotdot)
+        reportError(q->sh, PHASE_RULE11_12, 11, de[k].inum, NOVALUE,
+                    "ERROR: bad reference count for file.");
+    }
+  }
+  return true;
+}
+
+// rule 5 for one address, in the bitmap block that holds its bit
+static void quickBitmap(struct quickstate *q, uint inum, uint block) {
+  const char *bits = quickCached(q, &q->bitmap, BBLOCK(block, q->cs->sb->ninodes));
+
+  if (!(bits[block % BPB / 8] & (1 << (block % 8))))
+    reportError(q->sh, PHASE_RULE5, 5, inum, block,
+                "ERROR: address used by inode but marked free in bitmap.");
+}
+
+// block through the cache c, read unless it is the block c holds
+static const void *quickCached(struct quickstate *q, struct quickcache *c, uint block) {
+  if (c->data == NULL || c->block != block) {
+    c->data = quickRead(q, block, c->buf);
+    c->block = block;
+  }
+  return c->data;
+}
+
+// one block of the image, counted against the budget
+static const void *quickRead(struct quickstate *q, uint block, void *buf) {
+  q->sum->bytes += BLOCK_SIZE;
+  return sourceBlocks(q->cs->src, block, 1, buf);
+}
+
+// whether the budget is spent, which ends the check
+static bool quickSpent(struct quickstate *q) {
+  if (!q->bounded)
+    return false;
+  if ((q->maxBytes != 0 && q->sum->bytes >= q->maxBytes) ||
+      (q->maxNs != 0 && quickNow() - q->startNs >= q->maxNs))
+    q->sum->spent = true;
+  return q->sum->spent;
+}
+
+// whether an error was found and the first one is all that is wanted
+static bool quickFailed(struct quickstate *q) {
+  uint i;
+
+  if (q->cs->collectAll)
+    return false;
+  for (i = 0; i < NPHASE; i++)
+    if (q->sh->first[i].error != NULL)
+      return true;
+  return false;
+}
+
+// uniform in [0, n), n at most 2^32, from xorshift64*
+static uint quickRandom(struct quickstate *q, uint64_t n) {
+  q->rng ^= q->rng >> 12;
+  q->rng ^= q->rng << 25;
+  q->rng ^= q->rng >> 27;
+  return (q->rng * 0x2545f4914f6cdd1dull >> 32) * n >> 32;
+}
+
+static uint64_t quickNow(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*
+The fraction of corrupt inodes a clean sample of n inodes rules out with
+the given confidence. If a fraction p of the inodes is corrupt, and p_i of
+stratum i, a round of s strata misses them all with probability the
+product of the 1 - p_i, at most (1 - p)^s since the p_i average p; whole
+rounds of n inodes in all miss them with at most (1 - p)^n, as n inodes
+drawn at random would. The bound is the p at which that is 1 - confidence,
+found by bisection.
+*/
+static double quickBound(uint64_t n, double confidence) {
+  double lo = 0, hi = 1, p, x, miss;
+  uint64_t e;
+  int i;
+
+  if (n == 0)
+    return 1;
+  for (i = 0; i < 64; i++) {
+    p = (lo + hi) / 2;
+    for (miss = 1, x = 1 - p, e = n; e != 0; e >>= 1, x *= x)
+      if (e & 1)
+        miss *= x;
+    if (miss > 1 - confidence)
+      lo = p;
+    else
+      hi = p;
+  }
+  return hi;
+}
@@ -0,0 +1,601 @@
+// Repair of an image, for one geometry
+//
+// Included by checker.c, so that the repair sees the geometry and the block
+// walker of the checker. The repair works on copies of the metadata it
+// changes and writes the blocks that differ from the image once, at the end.
+#ifndef GEOMETRY
+#error "repair.c is compiled through the geom*.c files"
+#endif
+
+// dirty blocks next to each other are written at once, this many at most
+#define REPAIR_EXTENT 64
+
+// directory of the root orphans are moved to
+#define LOST_FOUND "lost+found"
+
+// a block the repair changed, and its new contents
+struct patch {
+  uint block;
+  char *data;
+};
+
+// what the repair knows about the image, and what it changed
+struct repairstate {
+  struct blocksource *src;
+  struct superblock *sb;
+  uint imageBlocks;
+  uint firstDataBlock;        // blocks in use are in [firstDataBlock, dataBlockEnd)
+  uint dataBlockEnd;
+  uint bitmapStart;
+  uint bitmapBlocks;          // bitmap blocks with a bit below dataBlockEnd
+  uint nextFree;              // where to look for a free block next
+  struct dinode *inodes;      // the inode table, changed in place
+  bitword *inodeDirty;        // inode table blocks changed
+  bitword *bitmap;            // the bitmap, rebuilt in place
+  bitword *bitmapDirty;       // bitmap blocks changed
+  bitword *isBlockUsed;       // blocks kept by an inode
+  bitword *isInodeInDir;      // inodes referred to by an entry
+  bitword *hasFreeParent;     // directories whose .. refers to a free inode
+  uint16_t *inodeRefCount;    // references other than . and ..
+  uint *namedBy;              // lowest directory with an entry other than . and .. for an inode, plus 1
+  struct patch *patches;      // indirect and directory blocks changed
+  uint *patchOf;              // index of the patch of every block plus 1, 0 if none
+  size_t npatches;
+  size_t patchCapacity;
+  struct report *fixes;       // what was repaired
+};
+
+static int repairImage(struct blocksource *src, struct superblock *sb, struct report *fixes);
+static void repairInode(struct repairstate *rs, uint inum);
+static void repairDirBlock(struct repairstate *rs, uint inum, uint fileBlock, uint block);
+static void repairOrphans(struct repairstate *rs);
+static uint findLostFound(struct repairstate *rs);
+static bool addEntry(struct repairstate *rs, uint dir, const char *name, uint child, bool grow);
+static void setParent(struct repairstate *rs, uint dir, uint parent);
+static void setEntry(struct dirent *de, const char *name, uint inum);
+static void repairLinks(struct repairstate *rs);
+static void repairBitmap(struct repairstate *rs);
+static void installLog(struct repairstate *rs);
+static int writeRepairs(struct repairstate *rs);
+static int emptyLog(struct repairstate *rs);
+static uint allocRepairBlock(struct repairstate *rs);
+static char *patchBlock(struct repairstate *rs, uint block, bool zero);
+static const void *repairBlock(struct repairstate *rs, uint block, void *buf);
+static void noteFix(struct repairstate *rs, int rule, long inum, long block, const char *what);
+static bool validType(short type);
+
+/*
+Repair the image in place, for the rules a repair can settle without
+guessing:
+
+  rules 1, 2, 7, 8: clear bad inodes, and addresses out of the data blocks
+                    or used a second time, along with what lies below them
+  rule 10:          clear the entries of free inodes
+  rule 9:           move inodes no entry refers to, and directories whose
+                    .. refers to a free inode, into /lost+found, made in a
+                    free slot of the root if it is missing
+  rule 11:          set the link count of files to their references
+  rules 5, 6:       rebuild the bitmap of the data blocks from the blocks
+                    kept
+
+A replayed log is installed with the fixes, as the kernel would, and
+emptied once they are flushed, so that it does not undo them later.
+
+One pass over the inode table works out all of it on copies of the inode
+table, the bitmap and the blocks that change; only then are the blocks
+that differ written, adjacent ones together, and flushed once. Every fix
+goes to fixes. Returns the number of blocks written, -1 if the image could
+not be read or written.
+*/
+static int repairImage(struct blocksource *src, struct superblock *sb, struct report *fixes) {
+  struct repairstate rs;
+  uint i, patchBlocks, inodeBlocks = (sb->ninodes + IPB - 1) / IPB;
+  const void *p;
+  size_t k;
+  int written;
+
+  memset(&rs, 0, sizeof(rs));
+  rs.src = src;
+  rs.sb = sb;
+  rs.fixes = fixes;
+  rs.imageBlocks = src->nblocks;
+  rs.firstDataBlock = BBLOCK(0, sb->ninodes) + sb->size/BPB + 1;
+  rs.dataBlockEnd = rs.firstDataBlock + sb->nblocks;
+  rs.nextFree = rs.firstDataBlock;
+  rs.bitmapStart = BBLOCK(0, sb->ninodes);
+  rs.bitmapBlocks = (rs.dataBlockEnd + BPB - 1) / BPB;
+
+  // copies of the inode table and the bitmap, whole blocks
+  rs.inodes = malloc((size_t)inodeBlocks * BLOCK_SIZE);
+  rs.bitmap = malloc((size_t)rs.bitmapBlocks * BLOCK_SIZE + sizeof(bitword));
+  if (rs.inodes == NULL || rs.bitmap == NULL) {
+    perror("repair");
+    exit(1);
+  }
+  p = sourceBlocks(src, IBLOCK(0), inodeBlocks, rs.inodes);
+  if (p != rs.inodes)
+    memcpy(rs.inodes, p, (size_t)inodeBlocks * BLOCK_SIZE);
+  p = sourceBlocks(src, rs.bitmapStart, rs.bitmapBlocks, rs.bitmap);
+  if (p != rs.bitmap)
+    memcpy(rs.bitmap, p, (size_t)rs.bitmapBlocks * BLOCK_SIZE);
+  rs.inodeDirty = bitsetAlloc(inodeBlocks);
+  rs.bitmapDirty = bitsetAlloc(rs.bitmapBlocks);
+  rs.isBlockUsed = bitsetAlloc(rs.dataBlockEnd);
+  rs.isInodeInDir = bitsetAlloc(sb->ninodes);
+  rs.hasFreeParent = bitsetAlloc(sb->ninodes);
+  rs.inodeRefCount = counterAlloc(sb->ninodes);
+  rs.namedBy = calloc((size_t)sb->ninodes + 1, sizeof(uint));
+  // the home blocks of a replayed log may lie past the end of the image
+  patchBlocks = rs.imageBlocks;
+  if (src->nlogged > 0 && sb->size - sb->nlog > patchBlocks)
+    patchBlocks = sb->size - sb->nlog;
+  rs.patchOf = calloc((size_t)patchBlocks + 1, sizeof(uint));
+  if (rs.namedBy == NULL || rs.patchOf == NULL) {
+    perror("repair");
+    exit(1);
+  }
+
+  for (i = 0; i < sb->ninodes; i++)
+    repairInode(&rs, i);
+  repairOrphans(&rs);
+  repairLinks(&rs);
+  repairBitmap(&rs);
+
+  if (src->readErrors > 0) {
+    fprintf(stderr, "read error, image not repaired\n");
+    written = -1;
+  } else {
+    installLog(&rs);
+    written = writeRepairs(&rs);
+  }
+
+  for (k = 0; k < rs.npatches; k++)
+    free(rs.patches[k].data);
+  free(rs.patches);
+  free(rs.patchOf);
+  free(rs.inodes);
+  free(rs.bitmap);
+  free(rs.inodeDirty);
+  free(rs.bitmapDirty);
+  free(rs.isBlockUsed);
+  free(rs.isInodeInDir);
+  free(rs.hasFreeParent);
+  free(rs.inodeRefCount);
+  free(rs.namedBy);
+  return written;
+}
+
+// clear what is wrong with one inode and keep its blocks
+static void repairInode(struct repairstate *rs, uint inum) {
+  struct dinode *dip = &rs->inodes[inum];
+  uint ind[WALK_HEIGHT][NINDIRECT];
+  uint holder[WALK_HEIGHT + 1]; // indirect block of every level of the walk
+  struct blockwalk w;
+  struct blockref ref;
+
+  if (dip->type == 0)
+    return;
+  if (!validType(dip->type)) {
+    memset(dip, 0, sizeof(*dip));
+    bitsetSet(rs->inodeDirty, inum / IPB);
+    noteFix(rs, 1, inum, NOVALUE, "REPAIRED: cleared bad inode.");
+    return;
+  }
+
+  walkInode(&w, dip);
+  while (walkNext(&w, &ref)) {
+    bool direct = ref.inInode && ref.height == 0;
+    const char *what = NULL;
+    int rule = 2;
+
+    if (ref.block < rs->firstDataBlock || ref.block >= rs->dataBlockEnd)
+      what = direct ? "REPAIRED: cleared bad direct address."
+                    : "REPAIRED: cleared bad indirect address.";
+    else if (bitsetTestAndSet(rs->isBlockUsed, ref.block)) {
+      rule = direct ? 7 : 8;
+      what = direct ? "REPAIRED: cleared direct address used more than once."
+                    : "REPAIRED: cleared indirect address used more than once.";
+    }
+    if (what != NULL) {
+      // the address walkNext just gave, nothing below it is walked
+      uint slot = w.level[w.depth].next - 1;
+      if (w.depth == 0) {
+        dip->addrs[slot] = 0;
+        bitsetSet(rs->inodeDirty, inum / IPB);
+      } else
+        ((uint *) patchBlock(rs, holder[w.depth], false))[slot] = 0;
+      noteFix(rs, rule, inum, ref.block, what);
+      continue;
+    }
+
+    if (ref.block >= rs->imageBlocks) // not in the image, reads as zeros
+      continue;
+    if (ref.height > 0) {
+      walkDescend(&w, &ref, sourceBlocks(rs->src, ref.block, 1, ind[w.depth]));
+      holder[w.depth] = ref.block;
+    } else if (dip->type == 1)
+      repairDirBlock(rs, inum, ref.fileBlock, ref.block);
+  }
+}
+
+// clear the entries of a directory block that refer to free inodes, count
+// the references of the others
+static void repairDirBlock(struct repairstate *rs, uint inum, uint fileBlock, uint block) {
+  struct dirent buf[DPB], *patched = NULL;
+  const struct dirent *de = sourceBlocks(rs->src, block, 1, buf);
+  uint k, n = dirBlockEntries(rs->inodes[inum].size, fileBlock);
+
+  for (k = 0; k < n; k++) {
+    uint child = de[k].inum;
+    bool dotdot = strncmp(de[k].name, "..", DIRSIZ) == 0;
+    if (child == 0)
+      continue;
+    if (child >= rs->sb->ninodes || !validType(rs->inodes[child].type)) {
+      // the directory lost its parent, it goes to lost+found
+      if (dotdot) {
+        bitsetSet(rs->hasFreeParent, inum);
+        continue;
+      }
+      struct diagnostic d = { .rule = 10, .inum = child, .block = NOVALUE, .dirInum = inum,
+                              .slot = fileBlock * DPB + k,
+                              .error = "REPAIRED: cleared entry of a free inode." };
+      memcpy(d.name, de[k].name, DIRSIZ);
+      d.name[DIRSIZ] = '\0';
+      reportAdd(rs->fixes, &d);
+      if (patched == NULL)
+        patched = (struct dirent *) patchBlock(rs, block, false);
+      patched[k].inum = 0;
+      continue;
+    }
+    bitsetSet(rs->isInodeInDir, child);
+    if (!dotdot && strncmp(de[k].name, ".", DIRSIZ) != 0) {
+      counterInc(rs->inodeRefCount, child);
+      // directories are visited in order, the first one is the lowest
+      if (rs->namedBy[child] == 0)
+        rs->namedBy[child] = inum + 1;
+    }
+  }
+}
+
+// Give every inode no entry refers to an entry in lost+found, and every
+// directory whose parent is gone. A directory whose .. refers to a free
+// inode but that another directory still names takes that one as its
+// parent; the .. entries of the directories left over are cleared.
+static void repairOrphans(struct repairstate *rs) {
+  char name[DIRSIZ + 1];
+  uint i, lostFound = 0;
+  bool full = false;
+
+  // inode 0 cannot be named by an entry, the root is rule 3
+  for (i = ROOTINO + 1; i < rs->sb->ninodes; i++) {
+    bool orphan = validType(rs->inodes[i].type) && !bitsetTest(rs->isInodeInDir, i);
+    bool lostParent = bitsetTest(rs->hasFreeParent, i), placed = false;
+    if (!orphan && !lostParent)
+      continue;
+    // a directory another one still names would get a second name
+    if (!full && (orphan || rs->inodeRefCount[i] == 0)) {
+      if (lostFound == 0 && (lostFound = findLostFound(rs)) == 0) {
+        fprintf(stderr, "no room for /%s, orphans left in place\n", LOST_FOUND);
+        full = true;
+      } else {
+        snprintf(name, sizeof(name), "#%u", i);
+        placed = addEntry(rs, lostFound, name, i, true);
+        if (!placed) {
+          fprintf(stderr, "/%s is full, orphans left in place\n", LOST_FOUND);
+          full = true;
+        }
+      }
+    }
+    if (placed) {
+      if (rs->inodes[i].type == 1)
+        setParent(rs, i, lostFound);
+      noteFix(rs, 9, i, NOVALUE, "REPAIRED: moved inode to lost+found.");
+    } else if (lostParent && rs->namedBy[i] != 0) {
+      setParent(rs, i, rs->namedBy[i] - 1);
+      noteFix(rs, 10, i, NOVALUE, "REPAIRED: pointed .. entry to the directory naming it.");
+    } else if (lostParent) {
+      setParent(rs, i, 0);
+      noteFix(rs, 10, i, NOVALUE, "REPAIRED: cleared .. entry of a free inode.");
+    }
+  }
+}
+
+// the lost+found directory of the root, made if there is none, 0 if there
+// is no room for it
+static uint findLostFound(struct repairstate *rs) {
+  struct dirent buf[DPB];
+  const struct dirent *de;
+  struct dinode *root = &rs->inodes[ROOTINO], *dip;
+  struct dirent *dot;
+  uint i, j, k, block, inum;
+
+  for (j = 0; j < NDIRECT; j++) {
+    if (root->type != 1 || root->addrs[j] == 0 || root->addrs[j] >= rs->imageBlocks)
+      continue;
+    de = repairBlock(rs, root->addrs[j], buf);
+    for (k = 0; k < dirBlockEntries(root->size, j); k++)
+      if (de[k].inum != 0 && de[k].inum < rs->sb->ninodes &&
+          strncmp(de[k].name, LOST_FOUND, DIRSIZ) == 0 && rs->inodes[de[k].inum].type == 1)
+        return de[k].inum;
+  }
+
+  // a free inode and a free block, then a slot in the root
+  for (inum = ROOTINO + 1; inum < rs->sb->ninodes && rs->inodes[inum].type != 0; inum++)
+    ;
+  if (root->type != 1 || inum == rs->sb->ninodes)
+    return 0;
+  for (i = rs->nextFree; i < rs->dataBlockEnd && i < rs->imageBlocks; i++)
+    if (!bitsetTest(rs->isBlockUsed, i))
+      break;
+  if (i == rs->dataBlockEnd || i == rs->imageBlocks ||
+      !addEntry(rs, ROOTINO, LOST_FOUND, inum, false))
+    return 0;
+  block = allocRepairBlock(rs);
+
+  dip = &rs->inodes[inum];
+  memset(dip, 0, sizeof(*dip));
+  dip->type = 1;
+  dip->nlink = 1;
+  dip->size = BLOCK_SIZE;
+  dip->addrs[0] = block;
+  bitsetSet(rs->inodeDirty, inum / IPB);
+  dot = (struct dirent *) patchBlock(rs, block, true);
+  setEntry(&dot[0], ".", inum);
+  setEntry(&dot[1], "..", ROOTINO);
+  noteFix(rs, 9, inum, block, "REPAIRED: created lost+found.");
+  return inum;
+}
+
+// Add an entry for child to directory dir, in a free slot of its direct
+// blocks, or in a new one if grow is set. Returns false if there is no
+// room.
+static bool addEntry(struct repairstate *rs, uint dir, const char *name, uint child, bool grow) {
+  struct dirent buf[DPB], *patched;
+  const struct dirent *de;
+  struct dinode *dip = &rs->inodes[dir];
+  uint j, k, block;
+
+  for (j = 0; j < NDIRECT; j++) {
+    block = dip->addrs[j];
+    if (block == 0) {
+      if (!grow || (block = allocRepairBlock(rs)) == 0)
+        return false;
+      dip->addrs[j] = block;
+      if (dip->size < (j + 1) * BLOCK_SIZE)
+        dip->size = (j + 1) * BLOCK_SIZE;
+      bitsetSet(rs->inodeDirty, dir / IPB);
+      patchBlock(rs, block, true);
+    }
+    if (block >= rs->imageBlocks)
+      continue;
+    de = repairBlock(rs, block, buf);
+    // slots 0 and 1 are . and .., the slots past the size are free and the
+    // size grows to take one
+    for (k = j == 0 ? 2 : 0; k < DPB; k++) {
+      if (k < dirBlockEntries(dip->size, j) && de[k].inum != 0)
+        continue;
+      if (k >= dirBlockEntries(dip->size, j)) {
+        dip->size = j * BLOCK_SIZE + (k + 1) * sizeof(struct dirent);
+        bitsetSet(rs->inodeDirty, dir / IPB);
+      }
+      patched = (struct dirent *) patchBlock(rs, block, false);
+      setEntry(&patched[k], name, child);
+      bitsetSet(rs->isInodeInDir, child);
+      counterInc(rs->inodeRefCount, child);
+      return true;
+    }
+  }
+  return false;
+}
+
+// point the .. entry of directory dir to parent, clear it for 0
+static void setParent(struct repairstate *rs, uint dir, uint parent) {
+  struct dirent buf[DPB];
+  const struct dirent *de;
+  uint j, k, block;
+
+  for (j = 0; j < NDIRECT; j++) {
+    block = rs->inodes[dir].addrs[j];
+    if (block == 0 || block >= rs->imageBlocks)
+      continue;
+    de = repairBlock(rs, block, buf);
+    for (k = 0; k < dirBlockEntries(rs->inodes[dir].size, j); k++) {
+      if (de[k].inum != 0 && strncmp(de[k].name, "..", DIRSIZ) == 0) {
+        ((struct dirent *) patchBlock(rs, block, false))[k].inum = parent;
+        return;
+      }
+    }
+  }
+}
+
+// an entry for inum, the name padded with zeros and cut at DIRSIZ bytes
+// without a terminator, as on disk
+static void setEntry(struct dirent *de, const char *name, uint inum) {
+  de->inum = inum;
+  memset(de->name, 0, DIRSIZ);
+  memcpy(de->name, name, strnlen(name, DIRSIZ));
+}
+
+// set the link count of every file to the entries that refer to it
+static void repairLinks(struct repairstate *rs) {
+  uint i;
+
+  for (i = 0; i < rs->sb->ninodes; i++) {
+    struct dinode *dip = &rs->inodes[i];
+    if (dip->type != 2 || (uint16_t)dip->nlink == rs->inodeRefCount[i])
+      continue;
+    dip->nlink = rs->inodeRefCount[i];
+    bitsetSet(rs->inodeDirty, i / IPB);
+    noteFix(rs, 11, i, NOVALUE, "REPAIRED: set reference count of file.");
+  }
+}
+
+// mark exactly the data blocks kept in use in the bitmap, a word at a time
+static void repairBitmap(struct repairstate *rs) {
+  uint64_t w, first = rs->firstDataBlock / WORDBITS;
+
+  for (w = first; w < BITSET_WORDS(rs->dataBlockEnd); w++) {
+    bitword mask = ~(bitword)0, onDisk = le64toh(rs->bitmap[w]), diff;
+    if (w == first)
+      mask &= ~(((bitword)1 << (rs->firstDataBlock % WORDBITS)) - 1);
+    if (w == rs->dataBlockEnd / WORDBITS)
+      mask &= ((bitword)1 << (rs->dataBlockEnd % WORDBITS)) - 1;
+    diff = (onDisk ^ rs->isBlockUsed[w]) & mask;
+    if (diff == 0)
+      continue;
+    rs->bitmap[w] = htole64(onDisk ^ diff);
+    for (; diff; diff &= diff - 1) {
+      uint64_t b = w * WORDBITS + __builtin_ctzll(diff);
+      bitsetSet(rs->bitmapDirty, b / BPB);
+      if (bitsetTest(rs->isBlockUsed, b))
+        noteFix(rs, 5, NOVALUE, b, "REPAIRED: marked block in use in bitmap.");
+      else
+        noteFix(rs, 6, NOVALUE, b, "REPAIRED: marked block free in bitmap.");
+    }
+  }
+}
+
+// write the home blocks of the replayed log with the rest, as replayed
+static void installLog(struct repairstate *rs) {
+  uint i, inodeBlocks = (rs->sb->ninodes + IPB - 1) / IPB;
+
+  for (i = 0; i < rs->src->nlogged; i++) {
+    uint home = rs->src->logged[i].home;
+    if (home - IBLOCK(0) < inodeBlocks)
+      bitsetSet(rs->inodeDirty, home - IBLOCK(0));
+    else if (home - rs->bitmapStart < rs->bitmapBlocks)
+      bitsetSet(rs->bitmapDirty, home - rs->bitmapStart);
+    else
+      patchBlock(rs, home, false);
+  }
+  if (rs->src->nlogged > 0)
+    noteFix(rs, 0, NOVALUE, rs->sb->size - rs->sb->nlog, "REPAIRED: installed committed log.");
+}
+
+static int comparePatches(const void *a, const void *b) {
+  const struct patch *x = a, *y = b;
+  return (x->block > y->block) - (x->block < y->block);
+}
+
+// write every changed block, runs of adjacent blocks at once, then flush
+// them all. Returns the number of blocks written, -1 if a write failed.
+static int writeRepairs(struct repairstate *rs) {
+  struct patch *dirty;
+  size_t n = 0, k, next;
+  uint u, inodeBlocks = (rs->sb->ninodes + IPB - 1) / IPB;
+  char *extent;
+  int r = 0;
+
+  dirty = malloc((rs->npatches + bitsetCount(rs->inodeDirty, inodeBlocks) +
+                  bitsetCount(rs->bitmapDirty, rs->bitmapBlocks) + 1) * sizeof(struct patch));
+  extent = malloc((size_t)REPAIR_EXTENT * BLOCK_SIZE);
+  if (dirty == NULL || extent == NULL) {
+    perror("repair");
+    exit(1);
+  }
+  for (u = 0; u < inodeBlocks; u++)
+    if (bitsetTest(rs->inodeDirty, u))
+      dirty[n++] = (struct patch){ IBLOCK(u * IPB), (char *) rs->inodes + (size_t)u * BLOCK_SIZE };
+  for (u = 0; u < rs->bitmapBlocks; u++)
+    if (bitsetTest(rs->bitmapDirty, u))
+      dirty[n++] = (struct patch){ rs->bitmapStart + u,
+                                   (char *) rs->bitmap + (size_t)u * BLOCK_SIZE };
+  if (rs->npatches > 0)
+    memcpy(dirty + n, rs->patches, rs->npatches * sizeof(struct patch));
+  n += rs->npatches;
+  qsort(dirty, n, sizeof(struct patch), comparePatches);
+
+  for (k = 0; k < n && r == 0; k = next) {
+    for (next = k + 1; next < n && next - k < REPAIR_EXTENT &&
+         dirty[next].block == dirty[k].block + (next - k); next++)
+      memcpy(extent + (next - k) * BLOCK_SIZE, dirty[next].data, BLOCK_SIZE);
+    memcpy(extent, dirty[k].data, BLOCK_SIZE);
+    r = sourceWrite(rs->src, dirty[k].block, next - k, extent);
+  }
+  if (r == 0 && n > 0)
+    r = sourceSync(rs->src);
+  // only once the installed blocks are on the device
+  if (r == 0 && rs->src->nlogged > 0 && (r = emptyLog(rs)) == 0)
+    n++;
+  if (r != 0)
+    perror("repair");
+
+  free(dirty);
+  free(extent);
+  return r == 0 ? (int)n : -1;
+}
+
+// clear the count of the log header and flush it, the log is no longer
+// replayed. Returns -1 if that failed.
+static int emptyLog(struct repairstate *rs) {
+  uint logStart = rs->sb->size - rs->sb->nlog;
+  uint buf[NINDIRECT];
+  const void *p;
+  int r;
+
+  if ((p = sourceBlocks(rs->src, logStart, 1, buf)) != buf)
+    memcpy(buf, p, BLOCK_SIZE);
+  ((struct logheader *) buf)->n = 0;
+  if ((r = sourceWrite(rs->src, logStart, 1, buf)) == 0)
+    r = sourceSync(rs->src);
+  sourceOverlay(rs->src, NULL, 0);
+  return r;
+}
+
+// a free data block of the image, now used, or 0 if there is none
+static uint allocRepairBlock(struct repairstate *rs) {
+  for (; rs->nextFree < rs->dataBlockEnd && rs->nextFree < rs->imageBlocks; rs->nextFree++) {
+    if (!bitsetTest(rs->isBlockUsed, rs->nextFree)) {
+      bitsetSet(rs->isBlockUsed, rs->nextFree);
+      return rs->nextFree++;
+    }
+  }
+  return 0;
+}
+
+// the new contents of block, the old ones or zeros to start with
+static char *patchBlock(struct repairstate *rs, uint block, bool zero) {
+  struct patch *pt;
+  const void *p;
+
+  if (rs->patchOf[block] != 0)
+    return rs->patches[rs->patchOf[block] - 1].data;
+  if (rs->npatches == rs->patchCapacity) {
+    rs->patchCapacity = rs->patchCapacity ? rs->patchCapacity * 2 : 64;
+    rs->patches = realloc(rs->patches, rs->patchCapacity * sizeof(struct patch));
+    if (rs->patches == NULL) {
+      perror("repair");
+      exit(1);
+    }
+  }
+  pt = &rs->patches[rs->npatches++];
+  rs->patchOf[block] = rs->npatches;
+  pt->block = block;
+  pt->data = malloc(BLOCK_SIZE);
+  if (pt->data == NULL) {
+    perror("repair");
+    exit(1);
+  }
+  if (zero)
+    memset(pt->data, 0, BLOCK_SIZE);
+  else if ((p = sourceBlocks(rs->src, block, 1, pt->data)) != pt->data)
+    memcpy(pt->data, p, BLOCK_SIZE);
+  return pt->data;
+}
+
+// block as the repair left it so far
+static const void *repairBlock(struct repairstate *rs, uint block, void *buf) {
+  if (rs->patchOf[block] != 0)
+    return rs->patches[rs->patchOf[block] - 1].data;
+  return sourceBlocks(rs->src, block, 1, buf);
+}
+
+static void noteFix(struct repairstate *rs, int rule, long inum, long block, const char *what) {
+  struct diagnostic d = { .rule = rule, .inum = inum, .block = block,
+                          .dirInum = NOVALUE, .slot = NOVALUE, .error = what };
+  reportAdd(rs->fixes, &d);
+}
+
+static bool validType(short type) {
+  return type == 1 || type == 2 || type == 3;
+}
@@ -0,0 +1,213 @@
+// Diagnostic report
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "types.h"
+#include "fs.h"
+#include "report.h"
+
+// append one diagnostic
+void reportAdd(struct report *rp, const struct diagnostic *d) {
+  if (rp->count == rp->capacity) {
+    size_t capacity = rp->capacity ? rp->capacity * 2 : 64;
+    rp->diags = scratchRealloc(rp->scratch, rp->diags, rp->capacity * sizeof(struct diagnostic),
+                               capacity * sizeof(struct diagnostic));
+    rp->capacity = capacity;
+  }
+  rp->diags[rp->count++] = *d;
+}
+
+// move all diagnostics of other to rp
+void reportMerge(struct report *rp, struct report *other) {
+  size_t i;
+
+  for (i = 0; i < other->count; i++)
+    reportAdd(rp, &other->diags[i]);
+  reportFree(other);
+}
+
+static int compareLong(long a, long b) {
+  return (a > b) - (a < b);
+}
+
+static int compareDiagnostics(const void *a, const void *b) {
+  const struct diagnostic *x = a, *y = b;
+  int r;
+
+  if ((r = compareLong(x->rule, y->rule)) != 0)
+    return r;
+  if ((r = compareLong(x->inum, y->inum)) != 0)
+    return r;
+  if ((r = compareLong(x->block, y->block)) != 0)
+    return r;
+  if ((r = compareLong(x->dirInum, y->dirInum)) != 0)
+    return r;
+  return compareLong(x->slot, y->slot);
+}
+
+// order by rule, then inode, then block, so the report does not depend on
+// the order the threads found the errors in
+void reportSort(struct report *rp) {
+  if (rp->count > 1)
+    qsort(rp->diags, rp->count, sizeof(struct diagnostic), compareDiagnostics);
+}
+
+static void printDiagnostic(FILE *f, const struct diagnostic *d) {
+  if (d->rule == 0)
+    fprintf(f, "%s [log", d->error);
+  else
+    fprintf(f, "%s [rule %d", d->error, d->rule);
+  if (d->inum != NOVALUE)
+    fprintf(f, ", inode %ld", d->inum);
+  if (d->block != NOVALUE)
+    fprintf(f, ", block %ld", d->block);
+  if (d->dirInum != NOVALUE)
+    fprintf(f, ", directory %ld entry %ld \"%s\"", d->dirInum, d->slot, d->name);
+  if (d->ownerUse != NULL)
+    fprintf(f, ", first used by inode %ld, %s", d->owner, d->ownerUse);
+  fprintf(f, "]\n");
+}
+
+// one line per diagnostic, then a summary line
+void reportPrintText(FILE *f, const struct report *rp) {
+  size_t i;
+
+  for (i = 0; i < rp->count; i++)
+    printDiagnostic(f, &rp->diags[i]);
+  fprintf(f, "%zu error%s found\n", rp->count, rp->count == 1 ? "" : "s");
+}
+
+// the result of an image checked among others: why it could not be
+// checked, OK, its first error, or with all every error, then its digests
+void reportPrintResult(FILE *f, const char *image, const char *failure, const struct report *rp,
+                       bool all) {
+  if (failure != NULL)
+    fprintf(f, "%s: %s\n", image, failure);
+  else if (rp->count == 0)
+    fprintf(f, "%s: OK\n", image);
+  else if (all) {
+    fprintf(f, "%s:\n", image);
+    reportPrintText(f, rp);
+  } else
+    fprintf(f, "%s: %s\n", image, rp->diags[0].error);
+  if (rp->digests.done)
+    digestsPrintText(f, image, &rp->digests);
+}
+
+// the fixes of a repair, one line each, then how many blocks it wrote
+void reportPrintRepairs(FILE *f, const struct report *rp, int written) {
+  size_t i;
+
+  for (i = 0; i < rp->count; i++)
+    printDiagnostic(f, &rp->diags[i]);
+  fprintf(f, "%zu fix%s, %d block%s written\n", rp->count, rp->count == 1 ? "" : "es",
+          written, written == 1 ? "" : "s");
+}
+
+// what a quick check covered, and unless it found errors the bound it
+// puts on the inodes it did not look at
+void reportPrintSample(FILE *f, const struct report *rp) {
+  const struct samplesummary *q = &rp->sample;
+
+  fprintf(f, "quick: %llu of %llu inodes, %llu directory block%s, %.1f MB in %llu ms%s\n",
+          (unsigned long long)q->sampled, (unsigned long long)q->inodes,
+          (unsigned long long)q->dirBlocks, q->dirBlocks == 1 ? "" : "s",
+          q->bytes / 1048576.0, (unsigned long long)q->millis,
+          q->spent ? ", budget spent" : "");
+  if (rp->count == 0 && q->bound == 0)
+    fprintf(f, "quick: every inode checked\n");
+  else if (rp->count == 0)
+    fprintf(f, "quick: %g%% confidence that fewer than %.3g%% of the inodes (%.0f) are corrupt\n",
+            q->confidence * 100, q->bound * 100, q->bound * q->inodes);
+}
+
+// JSON string, bytes outside printable ASCII are escaped
+void printJsonString(FILE *f, const char *s) {
+  fputc('"', f);
+  for (; *s; s++) {
+    unsigned char c = *s;
+    if (c == '"' || c == '\\')
+      fprintf(f, "\\%c", c);
+    else if (c < 0x20 || c >= 0x7f)
+      fprintf(f, "\\u%04x", c);
+    else
+      fputc(c, f);
+  }
+  fputc('"', f);
+}
+
+static void printJsonNumber(FILE *f, long v) {
+  if (v == NOVALUE)
+    fprintf(f, "null");
+  else
+    fprintf(f, "%ld", v);
+}
+
+void reportPrintJson(FILE *f, const char *image, const struct report *rp) {
+  size_t i;
+
+  fprintf(f, "{\"image\": ");
+  printJsonString(f, image);
+  fprintf(f, ", \"errorCount\": %zu, \"errors\": [", rp->count);
+  for (i = 0; i < rp->count; i++) {
+    const struct diagnostic *d = &rp->diags[i];
+    fprintf(f, "%s\n  {\"rule\": %d, \"inode\": ", i ? "," : "", d->rule);
+    printJsonNumber(f, d->inum);
+    fprintf(f, ", \"block\": ");
+    printJsonNumber(f, d->block);
+    fprintf(f, ", \"directory\": ");
+    printJsonNumber(f, d->dirInum);
+    fprintf(f, ", \"entry\": ");
+    printJsonNumber(f, d->dirInum == NOVALUE ? NOVALUE : d->slot);
+    fprintf(f, ", \"name\": ");
+    if (d->dirInum == NOVALUE)
+      fprintf(f, "null");
+    else
+      printJsonString(f, d->name);
+    fprintf(f, ", \"owner\": ");
+    printJsonNumber(f, d->ownerUse != NULL ? d->owner : NOVALUE);
+    fprintf(f, ", \"ownerUse\": ");
+    if (d->ownerUse == NULL)
+      fprintf(f, "null");
+    else
+      printJsonString(f, d->ownerUse);
+    fprintf(f, ", \"error\": ");
+    printJsonString(f, d->error);
+    fprintf(f, "}");
+  }
+  fprintf(f, "%s]", rp->count ? "\n" : "");
+  if (rp->digests.done) {
+    fprintf(f, ", \"fingerprint\": ");
+    digestsPrintJson(f, &rp->digests);
+  }
+  if (rp->sample.done) {
+    const struct samplesummary *q = &rp->sample;
+    fprintf(f, ", \"quick\": {\"inodes\": %llu, \"sampled\": %llu, \"dirBlocks\": %llu, "
+               "\"bytes\": %llu, \"ms\": %llu, \"budgetSpent\": %s, \"confidence\": %g, "
+               "\"bound\": ",
+            (unsigned long long)q->inodes, (unsigned long long)q->sampled,
+            (unsigned long long)q->dirBlocks, (unsigned long long)q->bytes,
+            (unsigned long long)q->millis, q->spent ? "true" : "false", q->confidence);
+    if (rp->count == 0)
+      fprintf(f, "%g}", q->bound);
+    else
+      fprintf(f, "null}");
+  }
+  fprintf(f, "}\n");
+}
+
+// JSON object for an image that could not be checked
+void reportPrintJsonFailure(FILE *f, const char *image, const char *failure) {
+  fprintf(f, "{\"image\": ");
+  printJsonString(f, image);
+  fprintf(f, ", \"failure\": ");
+  printJsonString(f, failure);
+  fprintf(f, "}\n");
+}
+
+void reportFree(struct report *rp) {
+  scratchFree(rp->scratch, rp->diags);
+  rp->diags = NULL;
+  rp->count = rp->capacity = 0;
+}
@@ -0,0 +1,66 @@
+#ifndef _REPORT_H_
+#define _REPORT_H_
+
+// Diagnostics found by the checker and the report they are printed in.
+// Include types.h and fs.h first.
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "fingerprint.h"
+#include "scratch.h"
+
+#define NOVALUE (-1L)  // field does not apply to the diagnostic
+
+// one rule violation
+struct diagnostic {
+  int rule;              // rule number, 1 to 14, 0 for the log
+  long inum;             // inode the error is about
+  long block;            // block address the error is about
+  long dirInum;          // directory holding the offending entry
+  long slot;             // index of the entry in that directory
+  char name[DIRSIZ + 1]; // name of the entry
+  long owner;            // rules 7 and 8 with -a: inode that used the block first
+  const char *ownerUse;  // and how, "direct" or "indirect", NULL if no owner
+  const char *error;     // error message
+};
+
+// what a --quick check looked at, and what that says of the rest
+struct samplesummary {
+  bool done;             // the check was a quick one
+  uint64_t inodes;       // inodes of the image
+  uint64_t sampled;      // inodes checked, the root aside
+  uint64_t dirBlocks;    // directory blocks checked
+  uint64_t bytes;        // bytes of the image read
+  uint64_t millis;       // wall time
+  bool spent;            // the budget ran out before the sample was done
+  double confidence;     // with this confidence,
+  double bound;          // fewer than this fraction of the inodes break a sampled rule
+};
+
+// growable list of diagnostics, and the image digests and the sample when
+// asked for
+struct report {
+  struct diagnostic *diags;
+  size_t count;
+  size_t capacity;
+  struct digests digests;
+  struct samplesummary sample;
+  struct scratch *scratch;    // arena diags come from, NULL for the heap
+};
+
+void reportAdd(struct report *rp, const struct diagnostic *d);
+void reportMerge(struct report *rp, struct report *other);
+void reportSort(struct report *rp);
+void reportPrintText(FILE *f, const struct report *rp);
+void reportPrintResult(FILE *f, const char *image, const char *failure, const struct report *rp,
+                       bool all);
+void reportPrintRepairs(FILE *f, const struct report *rp, int written);
+void reportPrintSample(FILE *f, const struct report *rp);
+void reportPrintJson(FILE *f, const char *image, const struct report *rp);
+void reportPrintJsonFailure(FILE *f, const char *image, const char *failure);
+void reportFree(struct report *rp);
+void printJsonString(FILE *f, const char *s);
+
+#endif // _REPORT_H_
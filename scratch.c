@@ -0,0 +1,95 @@
+// Scratch arena
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "scratch.h"
+
+// buffers start on a cache line, so threads do not share one
+#define SCRATCH_ALIGN 64
+
+static bool inArena(const struct scratch *s, const void *p) {
+  return s != NULL && (const char *) p >= s->base && (const char *) p < s->base + s->size;
+}
+
+// n bytes cut from the arena, NULL if they do not fit
+static void *arenaCut(struct scratch *s, size_t n) {
+  size_t at;
+
+  if (s == NULL)
+    return NULL;
+  n = (n + SCRATCH_ALIGN - 1) & ~(size_t)(SCRATCH_ALIGN - 1);
+  __atomic_fetch_add(&s->wanted, n, __ATOMIC_RELAXED);
+  at = __atomic_fetch_add(&s->used, n, __ATOMIC_RELAXED);
+  return at + n <= s->size ? s->base + at : NULL;
+}
+
+// n bytes, exits if there is no memory left
+void *scratchAlloc(struct scratch *s, size_t n) {
+  void *p = arenaCut(s, n);
+
+  if (p == NULL && (p = malloc(n ? n : 1)) == NULL) {
+    perror("scratch");
+    exit(1);
+  }
+  return p;
+}
+
+// n zeroed bytes; off the arena, calloc gets them zeroed for free
+void *scratchCalloc(struct scratch *s, size_t n) {
+  void *p = arenaCut(s, n);
+
+  if (p != NULL)
+    memset(p, 0, n);
+  else if ((p = calloc(1, n ? n : 1)) == NULL) {
+    perror("scratch");
+    exit(1);
+  }
+  return p;
+}
+
+// p, of old bytes, grown or shrunk to n bytes
+void *scratchRealloc(struct scratch *s, void *p, size_t old, size_t n) {
+  void *q;
+
+  if (s == NULL) {
+    if ((q = realloc(p, n)) == NULL) {
+      perror("scratch");
+      exit(1);
+    }
+    return q;
+  }
+  q = scratchAlloc(s, n);
+  if (p != NULL) {
+    memcpy(q, p, old < n ? old : n);
+    scratchFree(s, p);
+  }
+  return q;
+}
+
+// give p back, buffers of the arena wait for its reset
+void scratchFree(struct scratch *s, void *p) {
+  if (!inArena(s, p))
+    free(p);
+}
+
+// take back every buffer of the arena, no longer in use, and grow it to
+// what was asked for since the last reset
+void scratchReset(struct scratch *s) {
+  if (s->wanted > s->size) {
+    free(s->base);
+    s->size = s->wanted + s->wanted / 4;
+    if ((s->base = malloc(s->size)) == NULL) {
+      perror("scratch");
+      exit(1);
+    }
+  }
+  s->used = 0;
+  s->wanted = 0;
+}
+
+void scratchRelease(struct scratch *s) {
+  free(s->base);
+  memset(s, 0, sizeof(*s));
+}
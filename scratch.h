@@ -0,0 +1,29 @@
+#ifndef _SCRATCH_H_
+#define _SCRATCH_H_
+
+// Memory the buffers of a check come from. Without an arena (NULL) every
+// buffer is allocated and freed on its own. A caller that checks many
+// images in one process keeps an arena instead: buffers are cut from it by
+// bumping a cursor, from any thread, and freeing them does nothing until
+// the arena is reset before the next check. A buffer that does not fit is
+// allocated on its own, and the reset grows the arena to what the checks
+// since the last one asked for, so once the arena has seen an image of a
+// size, checking another allocates nothing.
+
+#include <stddef.h>
+
+struct scratch {
+  char *base;
+  size_t size;
+  size_t used;                // bytes cut so far, bumped atomically
+  size_t wanted;              // bytes asked for since the last reset, likewise
+};
+
+void *scratchAlloc(struct scratch *s, size_t n);
+void *scratchCalloc(struct scratch *s, size_t n);
+void *scratchRealloc(struct scratch *s, void *p, size_t old, size_t n);
+void scratchFree(struct scratch *s, void *p);
+void scratchReset(struct scratch *s);
+void scratchRelease(struct scratch *s);
+
+#endif // _SCRATCH_H_
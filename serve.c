@@ -0,0 +1,417 @@
+// Check daemon
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "types.h"
+#include "fs.h"
+#include "check.h"
+#include "serve.h"
+
+// images kept open, and the buckets of the table they are found in by path
+#define SERVE_IMAGES 256
+#define SERVE_BUCKETS 1024
+
+// an image a client asked about, kept open with the result of its check
+struct servedimage {
+  struct servedimage *next;   // in its bucket
+  struct servedimage *newer;  // in the order of the last request
+  struct servedimage *older;
+  char *path;
+  struct stat st;             // the image when it was checked
+  bool open;                  // src, sb and geo hold the image
+  struct blocksource src;
+  struct superblock sb;
+  const struct geometry *geo;
+  char *result;               // the answer to a request for it, NULL if not to be reused
+  size_t resultSize;
+  bool checking;              // a worker is checking it
+  int users;                  // requests in progress for it
+};
+
+// the daemon, everything below lock is guarded by it
+struct server {
+  struct checkopts *opts;
+  uint64_t memCap;            // bytes of heap all running checks may use, 0 for no cap
+  pthread_mutex_t lock;
+  pthread_cond_t connected;   // a connection is waiting for a worker
+  pthread_cond_t checked;     // an image is no longer being checked
+  pthread_cond_t memFreed;    // a check finished and gave its memory back
+  int *pending;               // connections accepted, not yet served
+  size_t npending;
+  size_t capacity;
+  struct servedimage *buckets[SERVE_BUCKETS];
+  struct servedimage *newest;
+  struct servedimage *oldest;
+  size_t nimages;
+  int running;                // checks in progress
+  uint64_t memInUse;          // heap of the checks in progress
+};
+
+// function declarations
+static void *serveWorker(void *arg);
+static void serveConnection(struct server *sv, int fd);
+static void serveImage(struct server *sv, const char *path, int fd);
+static void checkServed(struct server *sv, struct servedimage *im, const struct stat *st);
+static struct servedimage *findServed(struct server *sv, const char *path);
+static void useServed(struct server *sv, struct servedimage *im);
+static void dropServed(struct server *sv);
+static bool sameFile(const struct stat *a, const struct stat *b);
+static uint hashPath(const char *path);
+static void writeAll(int fd, const char *buf, size_t n);
+static void stopServing(int sig);
+
+// the socket, removed when the daemon is stopped
+static const char *servedSocket;
+
+/*
+Serve checks on a Unix socket until stopped by SIGINT or SIGTERM. A client
+writes one image path per line, and reads back for each what a batch
+prints for it, followed by an empty line. Each connection is served by
+one of nworkers workers, in order; the checks of different connections
+run concurrently under the memory cap of a batch.
+
+The images checked are kept open, mapped unless -S is given, the last
+SERVE_IMAGES that were asked about. An image is reused while stat gives
+the same file, size, and modification and change times as when it was
+checked: the answer is the one given then. An image changed in place is
+checked again in the mapping it already has, one replaced or resized is
+opened again. Anything but a regular file is opened and checked on every
+request, since its times do not follow writes to it.
+*/
+int serveChecks(const char *socketPath, struct checkopts *opts, int nworkers, uint64_t memCap) {
+  struct server *sv = calloc(1, sizeof(struct server));
+  struct sockaddr_un addr = { .sun_family = AF_UNIX };
+  struct stat st;
+  pthread_t thread;
+  int t, sock, fd;
+
+  if (sv == NULL) {
+    perror("calloc");
+    return 1;
+  }
+  if (strlen(socketPath) >= sizeof(addr.sun_path)) {
+    fprintf(stderr, "%s: socket path too long\n", socketPath);
+    return 1;
+  }
+  strcpy(addr.sun_path, socketPath);
+  // a socket left by a daemon that did not stop cleanly, nothing else
+  if (lstat(socketPath, &st) == 0 && S_ISSOCK(st.st_mode))
+    unlink(socketPath);
+  sock = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (sock < 0 || bind(sock, (struct sockaddr *) &addr, sizeof(addr)) != 0 ||
+      listen(sock, SOMAXCONN) != 0) {
+    perror(socketPath);
+    return 1;
+  }
+  servedSocket = socketPath;
+  signal(SIGPIPE, SIG_IGN);
+  signal(SIGINT, stopServing);
+  signal(SIGTERM, stopServing);
+
+  sv->opts = opts;
+  sv->memCap = memCap;
+  pthread_mutex_init(&sv->lock, NULL);
+  pthread_cond_init(&sv->connected, NULL);
+  pthread_cond_init(&sv->checked, NULL);
+  pthread_cond_init(&sv->memFreed, NULL);
+  for (t = 0; t < nworkers; t++) {
+    if (pthread_create(&thread, NULL, serveWorker, sv) != 0) {
+      perror("pthread_create");
+      exit(1);
+    }
+    pthread_detach(thread);
+  }
+
+  for (;;) {
+    if ((fd = accept(sock, NULL, NULL)) < 0) {
+      if (errno != EINTR && errno != ECONNABORTED)
+        perror("accept");
+      continue;
+    }
+    pthread_mutex_lock(&sv->lock);
+    if (sv->npending == sv->capacity) {
+      size_t capacity = sv->capacity ? sv->capacity * 2 : 64;
+      int *pending = realloc(sv->pending, capacity * sizeof(int));
+      if (pending == NULL) {
+        perror("realloc");
+        exit(1);
+      }
+      sv->pending = pending;
+      sv->capacity = capacity;
+    }
+    sv->pending[sv->npending++] = fd;
+    pthread_cond_signal(&sv->connected);
+    pthread_mutex_unlock(&sv->lock);
+  }
+}
+
+// serve connections, the oldest waiting first
+static void *serveWorker(void *arg) {
+  struct server *sv = arg;
+  int fd;
+
+  for (;;) {
+    pthread_mutex_lock(&sv->lock);
+    while (sv->npending == 0)
+      pthread_cond_wait(&sv->connected, &sv->lock);
+    fd = sv->pending[0];
+    memmove(sv->pending, sv->pending + 1, --sv->npending * sizeof(int));
+    pthread_mutex_unlock(&sv->lock);
+    serveConnection(sv, fd);
+  }
+  return NULL;
+}
+
+// answer the requests of a client until it hangs up
+static void serveConnection(struct server *sv, int fd) {
+  FILE *in = fdopen(fd, "r");
+  char *line = NULL;
+  size_t cap = 0;
+  ssize_t n;
+
+  if (in == NULL) {
+    close(fd);
+    return;
+  }
+  while ((n = getline(&line, &cap, in)) != -1) {
+    while (n > 0 && (line[n - 1] == '\n' || line[n - 1] == '\r'))
+      line[--n] = '\0';
+    if (n > 0)
+      serveImage(sv, line, fd);
+  }
+  free(line);
+  fclose(in);
+}
+
+// answer a request for the image at path, checking it if it changed
+static void serveImage(struct server *sv, const char *path, int fd) {
+  struct servedimage *im;
+  struct stat st;
+  bool found = stat(path, &st) == 0;
+  char *answer;
+  size_t size;
+
+  pthread_mutex_lock(&sv->lock);
+  im = findServed(sv, path);
+  im->users++;
+  while (im->checking)
+    pthread_cond_wait(&sv->checked, &sv->lock);
+  if (im->result == NULL || !found || !sameFile(&im->st, &st)) {
+    im->checking = true;
+    pthread_mutex_unlock(&sv->lock);
+    checkServed(sv, im, found ? &st : NULL);
+    pthread_mutex_lock(&sv->lock);
+    im->checking = false;
+    pthread_cond_broadcast(&sv->checked);
+  }
+  // another request may check it again while this answer is written
+  size = im->resultSize;
+  answer = malloc(size);
+  if (answer == NULL) {
+    perror("malloc");
+    exit(1);
+  }
+  memcpy(answer, im->result, size);
+  if (im->st.st_mode == 0) {
+    // not to be reused
+    free(im->result);
+    im->result = NULL;
+  }
+  im->users--;
+  dropServed(sv);
+  pthread_mutex_unlock(&sv->lock);
+
+  writeAll(fd, answer, size);
+  free(answer);
+}
+
+/*
+Check the image of im again, the way a batch checks it, and keep the
+answer. st is what stat gave for its path, NULL if stat failed; it is
+kept in im to tell when the image changes, or cleared if the image is not
+to be reused.
+*/
+static void checkServed(struct server *sv, struct servedimage *im, const struct stat *st) {
+  struct checkopts *opts = sv->opts;
+  struct report rp = { 0 };
+  const char *failure = NULL;
+  bool regular = st != NULL && S_ISREG(st->st_mode);
+  uint64_t need;
+  FILE *f;
+
+  if (im->open && (!regular || st->st_dev != im->st.st_dev || st->st_ino != im->st.st_ino ||
+                   st->st_size != im->st.st_size)) {
+    sourceClose(&im->src);
+    im->open = false;
+  }
+  if (strcmp(im->path, "-") == 0)
+    failure = "image not found";
+  else if (im->open) {
+    // changed in place, the mapping shows the new contents
+    sourceOverlay(&im->src, NULL, 0);
+    im->src.readErrors = 0;
+    failure = loadImage(&im->src, opts, &im->sb, &im->geo);
+  } else if ((failure = openImage(im->path, opts, &im->src, &im->sb, &im->geo)) == NULL)
+    im->open = true;
+
+  if (failure == NULL) {
+    need = im->geo->checkMemory(&im->sb, opts);
+
+    // wait for room under the cap
+    pthread_mutex_lock(&sv->lock);
+    while (sv->memCap != 0 && sv->running > 0 && sv->memInUse + need > sv->memCap)
+      pthread_cond_wait(&sv->memFreed, &sv->lock);
+    sv->running++;
+    sv->memInUse += need;
+    pthread_mutex_unlock(&sv->lock);
+
+    im->geo->checkImage(&im->src, &im->sb, opts, &rp);
+    if (im->src.readErrors > 0)
+      failure = "read error";
+
+    pthread_mutex_lock(&sv->lock);
+    sv->running--;
+    sv->memInUse -= need;
+    pthread_cond_broadcast(&sv->memFreed);
+    pthread_mutex_unlock(&sv->lock);
+  }
+  if (im->open && (!regular || failure != NULL)) {
+    sourceClose(&im->src);
+    im->open = false;
+  }
+
+  free(im->result);
+  f = open_memstream(&im->result, &im->resultSize);
+  if (f == NULL) {
+    perror("open_memstream");
+    exit(1);
+  }
+  reportPrintResult(f, im->path, failure, &rp, opts->collectAll);
+  fputc('\n', f);
+  fclose(f);
+  reportFree(&rp);
+  if (regular)
+    im->st = *st;
+  else
+    memset(&im->st, 0, sizeof(im->st));
+}
+
+// the image at path, added as the newest if it is not there yet; called
+// with the lock held
+static struct servedimage *findServed(struct server *sv, const char *path) {
+  struct servedimage *im;
+  uint hash = hashPath(path);
+
+  for (im = sv->buckets[hash % SERVE_BUCKETS]; im != NULL; im = im->next) {
+    if (strcmp(im->path, path) == 0) {
+      useServed(sv, im);
+      return im;
+    }
+  }
+
+  im = calloc(1, sizeof(struct servedimage));
+  if (im == NULL || (im->path = strdup(path)) == NULL) {
+    perror("calloc");
+    exit(1);
+  }
+  im->next = sv->buckets[hash % SERVE_BUCKETS];
+  sv->buckets[hash % SERVE_BUCKETS] = im;
+  useServed(sv, im);
+  sv->nimages++;
+  return im;
+}
+
+// make im the newest image
+static void useServed(struct server *sv, struct servedimage *im) {
+  if (sv->newest == im)
+    return;
+  if (im->older != NULL)
+    im->older->newer = im->newer;
+  if (im->newer != NULL)
+    im->newer->older = im->older;
+  if (sv->oldest == im)
+    sv->oldest = im->newer;
+  im->older = sv->newest;
+  im->newer = NULL;
+  if (sv->newest != NULL)
+    sv->newest->newer = im;
+  sv->newest = im;
+  if (sv->oldest == NULL)
+    sv->oldest = im;
+}
+
+// close the oldest images no request is using until SERVE_IMAGES are
+// left; called with the lock held
+static void dropServed(struct server *sv) {
+  struct servedimage *im, *newer, **link;
+
+  for (im = sv->oldest; im != NULL && sv->nimages > SERVE_IMAGES; im = newer) {
+    newer = im->newer;
+    if (im->users > 0)
+      continue;
+    for (link = &sv->buckets[hashPath(im->path) % SERVE_BUCKETS]; *link != im; link = &(*link)->next)
+      ;
+    *link = im->next;
+    if (im->older != NULL)
+      im->older->newer = im->newer;
+    else
+      sv->oldest = im->newer;
+    if (im->newer != NULL)
+      im->newer->older = im->older;
+    else
+      sv->newest = im->older;
+    if (im->open)
+      sourceClose(&im->src);
+    free(im->result);
+    free(im->path);
+    free(im);
+    sv->nimages--;
+  }
+}
+
+// whether stat gave the same file, unchanged, both times
+static bool sameFile(const struct stat *a, const struct stat *b) {
+  return a->st_mode != 0 && a->st_dev == b->st_dev && a->st_ino == b->st_ino &&
+         a->st_size == b->st_size && a->st_mtim.tv_sec == b->st_mtim.tv_sec &&
+         a->st_mtim.tv_nsec == b->st_mtim.tv_nsec && a->st_ctim.tv_sec == b->st_ctim.tv_sec &&
+         a->st_ctim.tv_nsec == b->st_ctim.tv_nsec;
+}
+
+// FNV-1a hash of a path
+static uint hashPath(const char *path) {
+  uint hash = 2166136261u;
+
+  for (; *path; path++)
+    hash = (hash ^ (uchar)*path) * 16777619u;
+  return hash;
+}
+
+// write all of buf, unless the client hung up
+static void writeAll(int fd, const char *buf, size_t n) {
+  ssize_t w;
+
+  while (n > 0) {
+    if ((w = write(fd, buf, n)) < 0) {
+      if (errno == EINTR)
+        continue;
+      return;
+    }
+    buf += w;
+    n -= w;
+  }
+}
+
+static void stopServing(int sig) {
+  (void) sig;
+  unlink(servedSocket);
+  _exit(0);
+}
@@ -0,0 +1,13 @@
+#ifndef _SERVE_H_
+#define _SERVE_H_
+
+// Daemon mode, for --serve: checks images named by clients of a Unix
+// socket, and keeps the images it checked open with their results, so
+// that asking again about an image that did not change costs a stat.
+// Include types.h, fs.h and check.h first.
+
+#include <stdint.h>
+
+int serveChecks(const char *socketPath, struct checkopts *opts, int nworkers, uint64_t memCap);
+
+#endif // _SERVE_H_
@@ -0,0 +1,180 @@
+// Check statistics
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "stats.h"
+
+static const char *phaseNames[NSTATPHASE] = { "prefetch", "scan", "digest", "bitmap", "namespace" };
+
+static uint64_t nowNs(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// user-space hardware counter of this process and the threads it creates later
+static int openCounter(uint64_t config) {
+  struct perf_event_attr attr;
+
+  memset(&attr, 0, sizeof(attr));
+  attr.type = PERF_TYPE_HARDWARE;
+  attr.size = sizeof(attr);
+  attr.config = config;
+  attr.inherit = 1;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static uint64_t readCounter(int fd) {
+  uint64_t v = 0;
+  if (read(fd, &v, sizeof(v)) != sizeof(v))
+    return 0;
+  return v;
+}
+
+// start collecting, hardware counters are left out if the kernel refuses them
+void statsOpen(struct checkstats *st) {
+  memset(st, 0, sizeof(*st));
+  st->perfFd[0] = openCounter(PERF_COUNT_HW_CACHE_MISSES);
+  st->perfFd[1] = openCounter(PERF_COUNT_HW_BRANCH_MISSES);
+  st->hwCounters = st->perfFd[0] >= 0 && st->perfFd[1] >= 0;
+}
+
+// snapshot at the start of a phase
+void statsBegin(struct checkstats *st) {
+  struct rusage ru;
+  int i;
+
+  getrusage(RUSAGE_SELF, &ru);
+  st->startMinor = ru.ru_minflt;
+  st->startMajor = ru.ru_majflt;
+  if (st->hwCounters)
+    for (i = 0; i < 2; i++)
+      st->startCounters[i] = readCounter(st->perfFd[i]);
+  st->startNs = nowNs();
+}
+
+// charge everything since statsBegin to phase, with the work counted in c.
+// Threads started in the phase must have been joined.
+void statsEnd(struct checkstats *st, int phase, const struct statcounts *c) {
+  struct phasestats *ps = &st->phase[phase];
+  struct rusage ru;
+
+  ps->ns += nowNs() - st->startNs;
+  getrusage(RUSAGE_SELF, &ru);
+  ps->minorFaults += ru.ru_minflt - st->startMinor;
+  ps->majorFaults += ru.ru_majflt - st->startMajor;
+  if (st->hwCounters) {
+    ps->cacheMisses += readCounter(st->perfFd[0]) - st->startCounters[0];
+    ps->branchMisses += readCounter(st->perfFd[1]) - st->startCounters[1];
+  }
+  ps->counts.inodes += c->inodes;
+  ps->counts.dirents += c->dirents;
+  ps->counts.indirect += c->indirect;
+  ps->counts.bytes += c->bytes;
+  ps->ran = true;
+}
+
+// the phases that ran and their sum
+static struct phasestats total(const struct checkstats *st) {
+  struct phasestats t;
+  int i;
+
+  memset(&t, 0, sizeof(t));
+  for (i = 0; i < NSTATPHASE; i++) {
+    const struct phasestats *ps = &st->phase[i];
+    t.ns += ps->ns;
+    t.counts.inodes += ps->counts.inodes;
+    t.counts.dirents += ps->counts.dirents;
+    t.counts.indirect += ps->counts.indirect;
+    t.counts.bytes += ps->counts.bytes;
+    t.minorFaults += ps->minorFaults;
+    t.majorFaults += ps->majorFaults;
+    t.cacheMisses += ps->cacheMisses;
+    t.branchMisses += ps->branchMisses;
+  }
+  return t;
+}
+
+static void printRow(FILE *f, const char *name, const struct phasestats *ps, bool hw) {
+  fprintf(f, "%-10s %10.3f %10lu %10lu %9lu %12lu %8ld %7ld", name, ps->ns / 1e6,
+          ps->counts.inodes, ps->counts.dirents, ps->counts.indirect, ps->counts.bytes,
+          ps->minorFaults, ps->majorFaults);
+  if (hw)
+    fprintf(f, " %12lu %12lu", ps->cacheMisses, ps->branchMisses);
+  fprintf(f, "\n");
+}
+
+// one line per phase that ran, then the total
+void statsPrintText(FILE *f, const struct checkstats *st) {
+  struct phasestats t = total(st);
+  int i;
+
+  fprintf(f, "%-10s %10s %10s %10s %9s %12s %8s %7s", "phase", "time-ms", "inodes",
+          "dirents", "indirect", "bytes-read", "minflt", "majflt");
+  if (st->hwCounters)
+    fprintf(f, " %12s %12s", "cache-miss", "branch-miss");
+  fprintf(f, "\n");
+  for (i = 0; i < NSTATPHASE; i++)
+    if (st->phase[i].ran)
+      printRow(f, phaseNames[i], &st->phase[i], st->hwCounters);
+  printRow(f, "total", &t, st->hwCounters);
+  if (!st->hwCounters)
+    fprintf(f, "hardware counters not available\n");
+}
+
+static void printJsonPhase(FILE *f, const char *name, const struct phasestats *ps, bool hw) {
+  fprintf(f, "\"%s\": {\"timeMs\": %.3f, \"inodes\": %lu, \"dirents\": %lu, "
+          "\"indirectBlocks\": %lu, \"bytesRead\": %lu, \"minorFaults\": %ld, "
+          "\"majorFaults\": %ld", name, ps->ns / 1e6, ps->counts.inodes, ps->counts.dirents,
+          ps->counts.indirect, ps->counts.bytes, ps->minorFaults, ps->majorFaults);
+  if (hw)
+    fprintf(f, ", \"cacheMisses\": %lu, \"branchMisses\": %lu", ps->cacheMisses,
+            ps->branchMisses);
+  else
+    fprintf(f, ", \"cacheMisses\": null, \"branchMisses\": null");
+  fprintf(f, "}");
+}
+
+void statsPrintJson(FILE *f, const char *image, const struct checkstats *st) {
+  struct phasestats t = total(st);
+  bool first = true;
+  int i;
+
+  // image names come from the command line, quote what JSON needs quoted
+  fprintf(f, "{\"image\": \"");
+  for (; *image; image++) {
+    unsigned char c = *image;
+    if (c == '"' || c == '\\')
+      fprintf(f, "\\%c", c);
+    else if (c < 0x20 || c >= 0x7f)
+      fprintf(f, "\\u%04x", c);
+    else
+      fputc(c, f);
+  }
+  fprintf(f, "\", \"phases\": {");
+  for (i = 0; i < NSTATPHASE; i++) {
+    if (!st->phase[i].ran)
+      continue;
+    fprintf(f, "%s\n  ", first ? "" : ",");
+    printJsonPhase(f, phaseNames[i], &st->phase[i], st->hwCounters);
+    first = false;
+  }
+  fprintf(f, "},\n ");
+  printJsonPhase(f, "total", &t, st->hwCounters);
+  fprintf(f, "}\n");
+}
+
+void statsClose(struct checkstats *st) {
+  int i;
+
+  for (i = 0; i < 2; i++)
+    if (st->perfFd[i] >= 0)
+      close(st->perfFd[i]);
+}
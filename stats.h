@@ -0,0 +1,67 @@
+#ifndef _STATS_H_
+#define _STATS_H_
+
+// Per-phase statistics of a check, for --stats. Only built in with
+// -DFCHECK_STATS: without it the STAT_* macros expand to nothing, so the
+// checker carries no counting code at all.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// phases of a check, in the order they run
+enum {
+  STAT_PREFETCH,            // -p, collect and request scattered blocks
+  STAT_SCAN,                // inode table, rules 1, 2, 7, 8, dirents into the index
+  STAT_DIGEST,              // -F, region digests from the pieces hashed by the scan
+  STAT_BITMAP,              // rules 5, 6
+  STAT_NAMESPACE,           // rules 3, 4, 9 to 14 from the index
+  NSTATPHASE
+};
+
+// work done in a phase, counted by the checker
+struct statcounts {
+  uint64_t inodes;          // inodes visited
+  uint64_t dirents;         // directory entries decoded or queried
+  uint64_t indirect;        // indirect blocks dereferenced
+  uint64_t bytes;           // bytes of the image read
+};
+
+struct phasestats {
+  bool ran;
+  uint64_t ns;              // wall time
+  struct statcounts counts;
+  long minorFaults;
+  long majorFaults;
+  uint64_t cacheMisses;     // hardware counters, when hwCounters is set
+  uint64_t branchMisses;
+};
+
+struct checkstats {
+  struct phasestats phase[NSTATPHASE];
+  bool hwCounters;          // perf_event counters could be opened
+  int perfFd[2];
+  // snapshot taken when the running phase began
+  uint64_t startNs;
+  long startMinor, startMajor;
+  uint64_t startCounters[2];
+};
+
+void statsOpen(struct checkstats *st);
+void statsBegin(struct checkstats *st);
+void statsEnd(struct checkstats *st, int phase, const struct statcounts *c);
+void statsPrintText(FILE *f, const struct checkstats *st);
+void statsPrintJson(FILE *f, const char *image, const struct checkstats *st);
+void statsClose(struct checkstats *st);
+
+#ifdef FCHECK_STATS
+#define STAT_COUNT(c, field, n)    ((c)->field += (n))
+#define STAT_BEGIN(st)             do { if (st) statsBegin(st); } while (0)
+#define STAT_END(st, phase, c)     do { if (st) statsEnd(st, phase, c); } while (0)
+#else
+#define STAT_COUNT(c, field, n)    ((void)0)
+#define STAT_BEGIN(st)             ((void)0)
+#define STAT_END(st, phase, c)     ((void)0)
+#endif
+
+#endif // _STATS_H_